@@ -0,0 +1,133 @@
+// Per guild playback cost of the DSP chain.
+//
+//   cmake -S . -B build -DBUILD_BENCHMARKS=ON && cmake --build build --target dsp_bench
+//   ./build/dsp_bench [seconds]
+//
+// Packets are made here with libopus from a synthetic tone, so no track on
+// disk is needed. One Discord voice packet is 20 ms, a guild with volume or
+// EQ costs one process() call per packet. A crossfade is paid once per
+// track change, for every packet of the overlap.
+
+#include "policarpo/crossfade.hpp"
+#include "policarpo/dsp.hpp"
+#include "policarpo/dsp_chain.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <opus/opus.h>
+
+namespace {
+  constexpr int k_rate = 48000;
+  constexpr int k_frame = 960;
+  constexpr int k_bitrate = 128000;
+
+  using Clock = std::chrono::steady_clock;
+
+  double micros_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  }
+
+  // A few seconds of two detuned tones plus noise, encoded like ingest does
+  std::vector<std::vector<unsigned char>> make_packets(int seconds) {
+    int error = 0;
+    OpusEncoder* enc = opus_encoder_create(k_rate, 2, OPUS_APPLICATION_AUDIO, &error);
+    if (error != OPUS_OK) return {};
+    opus_encoder_ctl(enc, OPUS_SET_BITRATE(k_bitrate));
+
+    std::vector<std::vector<unsigned char>> packets;
+    std::vector<float> pcm(k_frame * 2);
+    unsigned seed = 1;
+    for (int f = 0; f < seconds * 50; ++f) {
+      for (int i = 0; i < k_frame; ++i) {
+        const double t = static_cast<double>(f * k_frame + i) / k_rate;
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = static_cast<float>(seed >> 8) / 16777216.0f - 0.5f;
+        pcm[i * 2] = static_cast<float>(0.3 * std::sin(2 * M_PI * 220 * t) + 0.05 * noise);
+        pcm[i * 2 + 1] = static_cast<float>(0.3 * std::sin(2 * M_PI * 331 * t) + 0.05 * noise);
+      }
+      std::vector<unsigned char> packet(4000);
+      const int bytes = opus_encode_float(enc, pcm.data(), k_frame, packet.data(), static_cast<opus_int32>(packet.size()));
+      if (bytes <= 0) break;
+      packet.resize(static_cast<std::size_t>(bytes));
+      packets.push_back(std::move(packet));
+    }
+    opus_encoder_destroy(enc);
+    return packets;
+  }
+
+  void report(const char* what, double per_packet_us) {
+    // Realtime factor of one stream is also how many guilds one core keeps fed
+    std::printf("%-24s %9.2f us/packet  ~%.0f guilds/core\n", what, per_packet_us, 20000.0 / per_packet_us);
+  }
+}
+
+int main(int argc, char** argv) {
+  const int seconds = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  const auto packets = make_packets(seconds);
+  if (packets.empty()) {
+    std::fprintf(stderr, "can't encode test packets\n");
+    return 1;
+  }
+  std::printf("%zu packets (%d s), EQ kernel: %.*s\n", packets.size(), seconds,
+    static_cast<int>(policarpo::dsp_kernel_name().size()), policarpo::dsp_kernel_name().data());
+
+  // EQ alone on decoded-sized frames
+  {
+    policarpo::Equalizer eq;
+    eq.set({
+      policarpo::biquad_low_shelf(policarpo::k_eq_frequencies[0], 6.0f),
+      policarpo::biquad_peaking(policarpo::k_eq_frequencies[1], 0.7f, -3.0f),
+      policarpo::biquad_high_shelf(policarpo::k_eq_frequencies[2], 4.0f),
+    }, 0.8f);
+    std::vector<float> frame(k_frame * 2, 0.25f);
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < packets.size(); ++i) eq.process(frame.data(), k_frame);
+    report("eq", micros_since(start) / static_cast<double>(packets.size()));
+  }
+
+  // Whole chain: decode, process, re-encode
+  const policarpo::DspSettings cases[] = {
+    {0.8f, {}},
+    {0.8f, {6.0f, -3.0f, 4.0f}},
+  };
+  const char* names[] = {"decode+gain+encode", "decode+eq+encode"};
+  for (std::size_t c = 0; c < 2; ++c) {
+    auto chain = policarpo::DspChain::create(cases[c], k_bitrate);
+    if (!chain) {
+      std::fprintf(stderr, "can't create DSP chain\n");
+      return 1;
+    }
+    std::vector<unsigned char> out(4000);
+    std::size_t bytes = 0;
+    const auto start = Clock::now();
+    for (const auto& packet : packets) {
+      bytes += static_cast<std::size_t>(chain->process(packet.data(), static_cast<int>(packet.size()), out.data(), static_cast<int>(out.size())));
+    }
+    report(names[c], micros_since(start) / static_cast<double>(packets.size()));
+    if (bytes == 0) std::fprintf(stderr, "warning: chain produced no output\n");
+  }
+
+  // Crossfade: two decodes, the mix and one encode per overlap packet
+  {
+    auto fade = policarpo::Crossfade::create(k_bitrate);
+    if (!fade) {
+      std::fprintf(stderr, "can't create crossfade\n");
+      return 1;
+    }
+    const std::size_t overlap = std::min<std::size_t>(packets.size() / 2, 300);
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < overlap; ++i) {
+      const auto& tail = packets[i];
+      const auto& head = packets[packets.size() - overlap + i];
+      fade->add_tail(tail.data(), static_cast<int>(tail.size()));
+      fade->add_head(head.data(), static_cast<int>(head.size()));
+    }
+    const auto out = fade->finish(0.8f, 0.8f, {1.0f, {6.0f, -3.0f, 4.0f}});
+    report("crossfade", micros_since(start) / static_cast<double>(overlap));
+    if (out.size() != overlap) std::fprintf(stderr, "warning: crossfade made %zu of %zu packets\n", out.size(), overlap);
+  }
+  return 0;
+}
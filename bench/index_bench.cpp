@@ -0,0 +1,239 @@
+// Track index import, export and lookup on a generated library.
+//
+//   cmake -S . -B build -DBUILD_BENCHMARKS=ON && cmake --build build --target index_bench
+//   ./build/index_bench <mode> [entries]
+//
+// One mode per run, since max RSS only ever grows within a process:
+//   import      stream index.json into a snapshot (the SAX path)
+//   export      stream the snapshot back out as JSON
+//   import-dom  parse index.json into a whole nlohmann DOM first, for comparison
+//   export-dom  build a DOM of every entry and dump it, for comparison
+//   lookup      random hits and misses against the mapped snapshot
+//   title-search  title index build, best match queries, prefix lookups and
+//                 upserts, memory only
+// Files go to ./index_bench/, import writes the snapshot the others read.
+
+#include "policarpo/title_search.hpp"
+#include "policarpo/track_index.hpp"
+#include "policarpo/video_id.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <nlohmann/json.hpp>
+#include <sys/resource.h>
+
+namespace {
+  const std::filesystem::path k_dir = "index_bench";
+  const std::filesystem::path k_json = k_dir / "index.json";
+  const std::filesystem::path k_snapshot = k_dir / "index.bin";
+
+  using Clock = std::chrono::steady_clock;
+
+  double millis_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  long max_rss_mib() {
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+  }
+
+  // YouTube shaped ids: 10 free characters, the last one from the 16 that
+  // only carry 4 bits
+  std::string random_id(std::mt19937_64& rng) {
+    static constexpr char k_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    static constexpr char k_last[] = "AEIMQUYcgkosw048";
+    std::string id(11, 'A');
+    for (int i = 0; i < 10; ++i) id[i] = k_chars[rng() % 64];
+    id[10] = k_last[rng() % 16];
+    return id;
+  }
+
+  // Same shape index.json has always had, titles of a typical length
+  void generate(std::size_t entries) {
+    std::filesystem::create_directories(k_dir);
+    std::ofstream out(k_json, std::ios::binary | std::ios::trunc);
+    std::mt19937_64 rng(42);
+    out << "{";
+    for (std::size_t i = 0; i < entries; ++i) {
+      out << (i ? ",\n  " : "\n  ") << '"' << random_id(rng) << "\": {\n"
+          << "    \"duration_ms\": " << 120000 + rng() % 300000 << ",\n"
+          << "    \"title\": \"Artist " << rng() % 5000 << " - Some Song Title " << i << " (Official Video)\"\n  }";
+    }
+    out << "\n}\n";
+  }
+
+  // Titles made of words from a fixed vocabulary, squaring the draw makes
+  // the first words far more common than the last, like real titles
+  std::vector<std::string> vocabulary(std::mt19937_64& rng, std::size_t words) {
+    std::vector<std::string> out;
+    for (std::size_t i = 0; i < words; ++i) {
+      std::string word(4 + rng() % 6, 'a');
+      for (char& c : word) c = static_cast<char>('a' + rng() % 26);
+      out.push_back(std::move(word));
+    }
+    return out;
+  }
+
+  const std::string& common_word(const std::vector<std::string>& words, std::mt19937_64& rng) {
+    const double u = static_cast<double>(rng() % 1000000) / 1000000.0;
+    return words[static_cast<std::size_t>(u * u * static_cast<double>(words.size()))];
+  }
+
+  std::vector<policarpo::Song> title_songs(std::size_t entries) {
+    std::mt19937_64 rng(42);
+    const std::vector<std::string> artists = vocabulary(rng, 5000);
+    const std::vector<std::string> words = vocabulary(rng, 20000);
+    std::vector<policarpo::Song> songs;
+    songs.reserve(entries);
+    for (std::size_t i = 0; i < entries; ++i) {
+      policarpo::Song song{random_id(rng)};
+      song.title = artists[rng() % artists.size()] + " -";
+      for (std::size_t n = 2 + rng() % 5; n > 0; --n) song.title += " " + common_word(words, rng);
+      if (rng() % 4 == 0) song.title += " (Official Video)";
+      song.duration = std::chrono::milliseconds(120000 + rng() % 300000);
+      songs.push_back(std::move(song));
+    }
+    return songs;
+  }
+
+  // Threshold title_search_best uses
+  constexpr double k_title_min_score = 0.9;
+
+  void report(const char* what, double ms, std::size_t entries) {
+    std::printf("%-12s %9.1f ms  %5ld MiB max RSS  (%zu entries)\n", what, ms, max_rss_mib(), entries);
+  }
+}
+
+int main(int argc, char** argv) {
+  const std::string mode = argc > 1 ? argv[1] : "";
+  const std::size_t entries = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+
+  if (mode == "import" || mode == "import-dom") {
+    generate(entries);
+    std::error_code ec;
+    std::filesystem::remove(k_snapshot, ec);
+    std::printf("index.json: %ju KiB\n", static_cast<std::uintmax_t>(std::filesystem::file_size(k_json) / 1024));
+
+    const auto start = Clock::now();
+    std::size_t count = 0;
+    if (mode == "import") {
+      policarpo::TrackIndex index(k_snapshot);
+      if (!index.import_json(k_json)) return 1;
+      index.for_each([&](const policarpo::Song&) { ++count; });
+    } else {
+      std::ifstream in(k_json, std::ios::binary);
+      nlohmann::json data = nlohmann::json::parse(in);
+      std::vector<policarpo::Song> songs;
+      for (auto& [id, value] : data.items()) {
+        policarpo::Song song{id};
+        song.title = value["title"].get<std::string>();
+        song.duration = std::chrono::milliseconds(value["duration_ms"].get<long long>());
+        songs.push_back(std::move(song));
+      }
+      count = songs.size();
+    }
+    report(mode.c_str(), millis_since(start), count);
+    return 0;
+  }
+
+  if (mode == "title-search") {
+    // The last tenth is left out of the build and upserted at the end
+    std::vector<policarpo::Song> songs = title_songs(entries + entries / 10);
+    const std::vector<policarpo::Song> added(songs.begin() + static_cast<std::ptrdiff_t>(entries), songs.end());
+    songs.resize(entries);
+    policarpo::TitleIndex titles;
+    auto start = Clock::now();
+    titles.assign(songs);
+    report("title build", millis_since(start), titles.size());
+
+    // Hits: a title without its artist, as someone would type it, counted
+    // when they find that song. Misses: two words from a vocabulary the
+    // titles never used, counted when they find anything.
+    using Query = std::pair<std::string, std::string>; // text, expected id
+    std::mt19937_64 rng(7);
+    std::vector<Query> hits, misses;
+    for (int i = 0; i < 1000; ++i) {
+      const policarpo::Song& song = songs[rng() % songs.size()];
+      hits.emplace_back(song.title.substr(song.title.find(" - ") + 3), song.id);
+    }
+    const std::vector<std::string> unused = vocabulary(rng, 2000);
+    for (int i = 0; i < 1000; ++i) misses.emplace_back(unused[rng() % unused.size()] + " " + unused[rng() % unused.size()], "");
+
+    for (const auto& [what, queries] : {std::pair{"title hit", &hits}, std::pair{"title miss", &misses}}) {
+      std::size_t found = 0;
+      start = Clock::now();
+      for (const auto& [query, id] : *queries) {
+        auto match = titles.best(query, k_title_min_score);
+        found += match && (id.empty() || match->id == id);
+      }
+      const double ms = millis_since(start);
+      std::printf("%-12s %9.1f us/query  %zu of %zu found\n", what, ms * 1e3 / static_cast<double>(queries->size()), found, queries->size());
+    }
+
+    // Autocomplete: the first few letters of some word of some title, as
+    // many suggestions as Discord shows
+    std::vector<std::string> prefixes;
+    for (int i = 0; i < 10000; ++i) {
+      const std::string folded = policarpo::fold_title(songs[rng() % songs.size()].title);
+      std::vector<std::size_t> starts{0};
+      for (std::size_t at = folded.find(' '); at != std::string::npos; at = folded.find(' ', at + 1)) starts.push_back(at + 1);
+      prefixes.push_back(folded.substr(starts[rng() % starts.size()], 2 + rng() % 4));
+    }
+    std::size_t suggested = 0;
+    start = Clock::now();
+    for (const std::string& prefix : prefixes) suggested += titles.complete(prefix, 25, {}).size();
+    std::printf("%-12s %9.2f us/lookup  %.1f suggestions each\n", "title prefix",
+                millis_since(start) * 1e3 / static_cast<double>(prefixes.size()),
+                static_cast<double>(suggested) / static_cast<double>(prefixes.size()));
+
+    // New titles one at a time, including the tail merges they trigger
+    start = Clock::now();
+    for (const policarpo::Song& song : added) titles.add(song);
+    std::printf("%-12s %9.2f us/upsert  (%zu upserts)\n", "title add",
+                millis_since(start) * 1e3 / static_cast<double>(added.size()), added.size());
+    return 0;
+  }
+
+  policarpo::TrackIndex index(k_snapshot);
+  index.load();
+
+  if (mode == "export") {
+    const auto start = Clock::now();
+    if (!index.export_json(k_dir / "export.json")) return 1;
+    report("export", millis_since(start), entries);
+  } else if (mode == "export-dom") {
+    const auto start = Clock::now();
+    nlohmann::json data = nlohmann::json::object();
+    index.for_each([&](const policarpo::Song& song) {
+      data[song.id] = {{"title", song.title}, {"duration_ms", song.duration.count()}};
+    });
+    std::ofstream(k_dir / "export.json", std::ios::binary | std::ios::trunc) << data.dump(2);
+    report("export-dom", millis_since(start), data.size());
+  } else if (mode == "lookup") {
+    // Ids from the same generator are hits, a different seed gives misses
+    std::mt19937_64 hits(42), misses(7);
+    std::vector<std::string> ids;
+    for (std::size_t i = 0; i < entries; ++i) {
+      ids.push_back(random_id(hits));
+      hits(); hits(); // duration and title draws
+    }
+    for (std::size_t i = 0; i < entries; ++i) ids.push_back(random_id(misses));
+    std::shuffle(ids.begin(), ids.end(), misses);
+
+    std::size_t found = 0;
+    const auto start = Clock::now();
+    for (const std::string& id : ids) found += index.get(id).has_value();
+    const double ms = millis_since(start);
+    std::printf("lookup       %9.1f ns/lookup  %zu of %zu found\n", ms * 1e6 / static_cast<double>(ids.size()), found, ids.size());
+  } else {
+    std::fprintf(stderr, "usage: %s import|export|import-dom|export-dom|lookup|title-search [entries]\n", argv[0]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "policarpo/flat_map.hpp"
+
+namespace policarpo {
+
+struct BitrateSettings {
+  int storage_max{128000}; // bits per second, nothing is stored above it
+  int low_tier{0};         // derivative for channels at or below it, 0 keeps none
+};
+
+// Call at startup (OPUS_BITRATE and LOW_TIER_BITRATE in .env)
+void bitrate_configure(const BitrateSettings& settings);
+
+// A voice channel we play in, from its bitrate field in bits per second.
+// Storage follows the highest one seen.
+void bitrate_observe_channel(int bitrate);
+
+// What new downloads are stored at: the highest channel bitrate seen,
+// capped at storage_max. storage_max until a channel has been seen.
+int storage_bitrate();
+
+// yt-dlp -f for storage_bitrate(): the smallest Opus stream that still
+// carries it, so the download is remuxed instead of encoded again
+std::string storage_format_selector();
+
+/*
+  File to play id from in a channel of channel_bitrate (0 when unknown).
+  Channels at or below the low tier get the low tier copy when the stored
+  file is well above it. The copy is built in the background the first
+  time it is missing, the stored file plays meanwhile.
+*/
+std::filesystem::path playback_path(std::string_view id, std::chrono::milliseconds duration, int channel_bitrate);
+
+// One thread encoding low tier copies on the transcode pool, one at a
+// time so they never take the pool from downloads
+class DerivativeBuilder {
+public:
+  DerivativeBuilder() = default;
+  ~DerivativeBuilder();
+
+  DerivativeBuilder(const DerivativeBuilder&) = delete;
+  DerivativeBuilder& operator=(const DerivativeBuilder&) = delete;
+
+  void submit(const std::string& id, int bitrate);
+
+private:
+  struct Job {
+    std::string id;
+    int bitrate;
+  };
+
+  void worker_loop();
+  void build(const Job& job);
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  std::deque<Job> m_jobs;
+  VideoIdMap<bool> m_queued;
+  bool m_stop{false};
+  std::thread m_worker;
+};
+
+} // namespace policarpo
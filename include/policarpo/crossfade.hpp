@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include "policarpo/dsp_chain.hpp"
+
+struct OpusDecoder;
+struct OpusEncoder;
+
+namespace policarpo {
+
+// Mixes interleaved stereo: tail fades out and head fades in over total
+// frames on an (approximately) equal power curve. start is how far into
+// the fade this call begins. dst may be either input.
+void crossfade_mix(const float* tail, const float* head, float* dst, std::size_t frames,
+                   std::size_t start, std::size_t total, float tail_gain, float head_gain);
+
+/*
+  One transition between two tracks. Only the overlap is decoded, mixed
+  and encoded again, both tracks go out as stored packets around it:
+
+    current  ... sent | warm up | tail  | not read
+    next         not sent | warm up | head | sent from here on ...
+                                    ^ overlap, encoded here
+
+  The encoder is primed with what precedes the overlap, so the encoded
+  packets line up exactly with the 20 ms packets on both sides.
+*/
+class Crossfade {
+public:
+  static std::unique_ptr<Crossfade> create(int bitrate);
+  ~Crossfade();
+
+  Crossfade(const Crossfade&) = delete;
+  Crossfade& operator=(const Crossfade&) = delete;
+
+  // Packets before the tail/head, decoded so the decoders are settled
+  void warm_up_tail(const unsigned char* packet, int size);
+  void warm_up_head(const unsigned char* packet, int size);
+
+  void add_tail(const unsigned char* packet, int size);
+  void add_head(const unsigned char* packet, int size);
+
+  std::size_t tail_frames() const { return m_tail.size() / 2; }
+  std::size_t head_frames() const { return m_head.size() / 2; }
+
+  // Mixes and encodes as many whole packets as both sides have. The
+  // gains are each track's volume and loudness, eq's bands apply to the mix.
+  std::vector<std::vector<unsigned char>> finish(float tail_gain, float head_gain, const DspSettings& eq);
+
+private:
+  Crossfade() = default;
+  void decode(OpusDecoder* decoder, const unsigned char* packet, int size, std::vector<float>& out);
+
+  OpusDecoder* m_tail_decoder{nullptr};
+  OpusDecoder* m_head_decoder{nullptr};
+  OpusEncoder* m_encoder{nullptr};
+  std::vector<float> m_before; // last warm up packet of the tail
+  std::vector<float> m_tail;
+  std::vector<float> m_head;
+  std::vector<float> m_scratch;
+  double m_decode_cpu{0.0};
+};
+
+// Reads packets [first_packet, first_packet + count) of a file in the
+// normalized 20 ms layout into the head, with a few before to warm up.
+// False for any other layout, the packets wouldn't line up.
+bool crossfade_load_head(Crossfade& fade, const std::filesystem::path& file, std::uint32_t first_packet, std::uint32_t count);
+
+} // namespace policarpo
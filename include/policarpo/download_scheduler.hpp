@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "policarpo/flat_map.hpp"
+#include "policarpo/track_table.hpp"
+
+namespace policarpo {
+
+// Higher runs first. Speculative downloads never take the last worker, so
+// something a user is actually waiting on always has one free.
+enum class DownloadPriority : std::uint8_t {
+  Speculative = 0,
+  Background = 1,
+  Interactive = 2,
+};
+
+using DownloadResult = std::shared_future<std::optional<TrackHandle>>;
+
+// Downloads id into the library. Asking for an id that is already queued or
+// running joins that download, raising its priority if needed.
+DownloadResult download_track(const std::string& id, DownloadPriority priority, std::string title = {});
+
+// Drops a download nobody but speculation asked for, if it has not started.
+// Returns true if it was dropped.
+bool download_cancel_speculative(const std::string& id);
+
+bool download_in_flight(const std::string& id);
+
+class DownloadScheduler {
+public:
+  explicit DownloadScheduler(std::size_t workers);
+  ~DownloadScheduler();
+
+  DownloadScheduler(const DownloadScheduler&) = delete;
+  DownloadScheduler& operator=(const DownloadScheduler&) = delete;
+
+  DownloadResult submit(const std::string& id, DownloadPriority priority, std::string title);
+  bool cancel_speculative(const std::string& id);
+  bool in_flight(const std::string& id) const;
+
+private:
+  struct Job {
+    std::string id;
+    std::string title;
+    DownloadPriority priority;
+    std::uint64_t seq;
+    bool running{false};
+    std::promise<std::optional<TrackHandle>> promise;
+    DownloadResult result;
+  };
+
+  void start_locked();
+  void worker_loop();
+  std::shared_ptr<Job> next_job_locked();
+
+  std::size_t m_worker_count;
+  mutable std::mutex m_mu;
+  std::condition_variable m_cv;
+  VideoIdMap<std::shared_ptr<Job>> m_jobs; // queued and running
+  std::uint64_t m_next_seq{0};
+  std::size_t m_running_speculative{0};
+  bool m_stop{false};
+  std::vector<std::thread> m_workers;
+};
+
+} // namespace policarpo
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace policarpo {
+
+// Normalized biquad, a0 divided out. Transposed direct form II.
+struct BiquadCoeffs {
+  float b0{1.0f}, b1{0.0f}, b2{0.0f}, a1{0.0f}, a2{0.0f};
+};
+
+// RBJ cookbook designs at 48 kHz
+BiquadCoeffs biquad_low_shelf(float freq, float gain_db);
+BiquadCoeffs biquad_peaking(float freq, float q, float gain_db);
+BiquadCoeffs biquad_high_shelf(float freq, float gain_db);
+
+inline constexpr std::size_t k_eq_bands = 3;
+
+/*
+  Stereo three band EQ plus gain. The bands are a cascade, so instead of
+  running one filter after another the cascade is pipelined: every step
+  band k works on the sample band k-1 finished the step before. Bands and
+  channels then fill 8 independent lanes (3 bands x 2 channels + a gain
+  stage) that run as one AVX2 vector, two SSE/NEON vectors or plain loops.
+  The price is a fixed delay of 3 samples.
+*/
+class Equalizer {
+public:
+  Equalizer();
+
+  void set(const std::array<BiquadCoeffs, k_eq_bands>& bands, float gain);
+
+  // In place on interleaved stereo floats, output clamped to [-1, 1]
+  void process(float* samples, std::size_t frames);
+
+  void reset();
+
+  // Lanes: [band0 L, band0 R, band1 L, band1 R, band2 L, band2 R, gain L, gain R]
+  struct alignas(32) Lanes {
+    float b0[8], b1[8], b2[8], a1[8], a2[8];
+    float z1[8], z2[8], y[8];
+  };
+
+private:
+  Lanes m_lanes;
+};
+
+// Multiplies interleaved samples by gain, clamped to [-1, 1]
+void apply_gain(float* samples, std::size_t count, float gain);
+
+// Which kernel process() runs here: "avx2", "sse2", "neon" or "scalar"
+std::string_view dsp_kernel_name();
+
+} // namespace policarpo
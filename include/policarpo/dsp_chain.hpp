@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include "policarpo/dsp.hpp"
+
+struct OpusDecoder;
+struct OpusEncoder;
+
+namespace policarpo {
+
+// EQ band centres: bass shelf, mid peak, treble shelf
+inline constexpr std::array<float, k_eq_bands> k_eq_frequencies{120.0f, 1000.0f, 6000.0f};
+
+struct DspSettings {
+  float gain{1.0f};
+  std::array<float, k_eq_bands> eq_db{};
+
+  // Nothing to do, packets can go out exactly as stored
+  bool neutral() const;
+};
+
+// Sets eq to the bands in settings, with settings.gain as its last stage.
+// False when every band is flat and there is nothing for it to do.
+bool equalizer_configure(Equalizer& eq, const DspSettings& settings);
+
+// Decode -> gain/EQ -> encode for one playback. Only built when settings
+// aren't neutral, otherwise the player forwards the stored packets untouched.
+class DspChain {
+public:
+  static std::unique_ptr<DspChain> create(const DspSettings& settings, int bitrate);
+  ~DspChain();
+
+  DspChain(const DspChain&) = delete;
+  DspChain& operator=(const DspChain&) = delete;
+
+  // One stored packet in, one processed packet out. Returns its size, or 0
+  // when there is nothing to send (Ogg header packets, undecodable data).
+  int process(const unsigned char* packet, int size, unsigned char* out, int max_out);
+
+private:
+  DspChain() = default;
+
+  OpusDecoder* m_decoder{nullptr};
+  OpusEncoder* m_encoder{nullptr};
+  Equalizer m_eq;
+  bool m_use_eq{false};
+  float m_gain{1.0f};
+  std::vector<float> m_pcm;
+};
+
+} // namespace policarpo
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "policarpo/video_id.hpp"
+
+namespace policarpo {
+
+// splitmix64 finalizer, spreads packed ids over the low bits we mask with
+inline std::uint64_t mix_key(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Open addressing map for 64-bit keys: linear probing, power of two capacity
+// and backward-shift deletion, so there are no tombstones to clean up.
+template <typename V>
+class FlatMap {
+public:
+  V* find(std::uint64_t key) {
+    if (m_size == 0) return nullptr;
+    for (std::size_t i = slot_of(key);; i = (i + 1) & m_mask) {
+      if (!m_used[i]) return nullptr;
+      if (m_keys[i] == key) return &m_values[i].value;
+    }
+  }
+
+  const V* find(std::uint64_t key) const {
+    return const_cast<FlatMap*>(this)->find(key);
+  }
+
+  bool contains(std::uint64_t key) const { return find(key) != nullptr; }
+
+  V& operator[](std::uint64_t key) {
+    if ((m_size + 1) * 10 > capacity() * 7) grow();
+    std::size_t i = slot_of(key);
+    for (; m_used[i]; i = (i + 1) & m_mask) {
+      if (m_keys[i] == key) return m_values[i].value;
+    }
+    m_used[i] = 1;
+    m_keys[i] = key;
+    m_values[i].value = V{};
+    ++m_size;
+    return m_values[i].value;
+  }
+
+  void insert_or_assign(std::uint64_t key, V value) {
+    (*this)[key] = std::move(value);
+  }
+
+  bool erase(std::uint64_t key) {
+    if (m_size == 0) return false;
+    std::size_t i = slot_of(key);
+    for (;; i = (i + 1) & m_mask) {
+      if (!m_used[i]) return false;
+      if (m_keys[i] == key) break;
+    }
+
+    // Shift following entries back into the hole while it shortens their probe
+    for (std::size_t j = (i + 1) & m_mask; m_used[j]; j = (j + 1) & m_mask) {
+      const std::size_t home = slot_of(m_keys[j]);
+      const bool between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+      if (between) continue;
+      m_keys[i] = m_keys[j];
+      m_values[i] = std::move(m_values[j]);
+      i = j;
+    }
+    m_used[i] = 0;
+    m_values[i].value = V{};
+    --m_size;
+    return true;
+  }
+
+  void reserve(std::size_t n) {
+    while (n * 10 > capacity() * 7) grow();
+  }
+
+  void clear() {
+    m_keys.clear();
+    m_values.clear();
+    m_used.clear();
+    m_size = 0;
+    m_mask = 0;
+  }
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    for (std::size_t i = 0; i < m_used.size(); ++i) {
+      if (m_used[i]) fn(m_keys[i], m_values[i].value);
+    }
+  }
+
+private:
+  std::size_t capacity() const { return m_used.size(); }
+  std::size_t slot_of(std::uint64_t key) const { return mix_key(key) & m_mask; }
+
+  void grow() {
+    const std::size_t new_cap = capacity() ? capacity() * 2 : 16;
+    std::vector<std::uint64_t> keys(new_cap);
+    std::vector<Cell> values(new_cap);
+    std::vector<std::uint8_t> used(new_cap, 0);
+    const std::size_t mask = new_cap - 1;
+
+    for (std::size_t i = 0; i < m_used.size(); ++i) {
+      if (!m_used[i]) continue;
+      std::size_t j = mix_key(m_keys[i]) & mask;
+      while (used[j]) j = (j + 1) & mask;
+      used[j] = 1;
+      keys[j] = m_keys[i];
+      values[j] = std::move(m_values[i]);
+    }
+
+    m_keys = std::move(keys);
+    m_values = std::move(values);
+    m_used = std::move(used);
+    m_mask = mask;
+  }
+
+  // Wrapped so V = bool doesn't end up in a packed std::vector<bool>
+  struct Cell {
+    V value{};
+  };
+
+  std::vector<std::uint64_t> m_keys;
+  std::vector<Cell> m_values;
+  std::vector<std::uint8_t> m_used;
+  std::size_t m_size{0};
+  std::size_t m_mask{0};
+};
+
+// Map keyed by track id. YouTube ids live packed in the flat map, anything
+// else (other sources, malformed ids) goes to a string keyed side table.
+template <typename V>
+class VideoIdMap {
+public:
+  V* find(std::string_view id) {
+    if (auto key = pack_video_id(id)) return m_packed.find(*key);
+    auto it = m_other.find(std::string(id));
+    return it == m_other.end() ? nullptr : &it->second;
+  }
+
+  const V* find(std::string_view id) const {
+    return const_cast<VideoIdMap*>(this)->find(id);
+  }
+
+  bool contains(std::string_view id) const { return find(id) != nullptr; }
+
+  V& operator[](std::string_view id) {
+    if (auto key = pack_video_id(id)) return m_packed[*key];
+    return m_other[std::string(id)];
+  }
+
+  void insert_or_assign(std::string_view id, V value) {
+    (*this)[id] = std::move(value);
+  }
+
+  bool erase(std::string_view id) {
+    if (auto key = pack_video_id(id)) return m_packed.erase(*key);
+    return m_other.erase(std::string(id)) > 0;
+  }
+
+  void clear() {
+    m_packed.clear();
+    m_other.clear();
+  }
+
+  std::size_t size() const { return m_packed.size() + m_other.size(); }
+
+  // fn(std::string id, const V& value)
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    m_packed.for_each([&](std::uint64_t key, const V& value) { fn(unpack_video_id(key), value); });
+    for (const auto& [id, value] : m_other) fn(id, value);
+  }
+
+private:
+  FlatMap<V> m_packed;
+  std::unordered_map<std::string, V> m_other;
+};
+
+} // namespace policarpo
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include "policarpo/dsp_chain.hpp"
+
+namespace policarpo {
+
+inline constexpr int k_max_volume_percent = 200;
+inline constexpr int k_max_eq_db = 12;
+inline constexpr int k_max_crossfade_seconds = 12;
+
+// What a guild asked for with /volume, /eq, /trim and /crossfade
+struct GuildSettings {
+  int volume_percent{100};
+  std::array<int, k_eq_bands> eq_db{}; // bass, mid, treble
+  bool trim_silence{true};             // skip dead air at both ends of a track
+  int crossfade_seconds{0};            // overlap between tracks, 0 is off
+
+  DspSettings dsp() const;
+};
+
+GuildSettings guild_settings_get(std::uint64_t guild_id);
+
+// Changes a guild's settings and saves them. Values are clamped to range.
+GuildSettings guild_settings_update(std::uint64_t guild_id, const std::function<void(GuildSettings&)>& change);
+
+// All guilds' settings, kept in one small JSON file
+class GuildSettingsStore {
+public:
+  explicit GuildSettingsStore(std::filesystem::path path);
+
+  GuildSettings get(std::uint64_t guild_id);
+  GuildSettings update(std::uint64_t guild_id, const std::function<void(GuildSettings&)>& change);
+
+private:
+  void load_locked();
+  void save_locked();
+
+  std::filesystem::path m_path;
+  std::mutex m_mu;
+  bool m_loaded{false};
+  std::unordered_map<std::uint64_t, GuildSettings> m_guilds;
+};
+
+} // namespace policarpo
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "policarpo/flat_map.hpp"
+
+namespace policarpo {
+
+// call once at startup, scans songs/ in the background and starts watching it
+void library_init();
+
+// Is <id>.opus on disk? Memory lookup once the startup scan is done.
+bool library_contains(std::string_view id);
+
+// Our own downloads report here directly instead of waiting for inotify
+void library_add(std::string_view id);
+
+// Same for files we moved away ourselves
+void library_remove(std::string_view id);
+
+class Library {
+public:
+  explicit Library(std::filesystem::path root);
+  ~Library();
+
+  Library(const Library&) = delete;
+  Library& operator=(const Library&) = delete;
+
+  void start();
+  void stop();
+
+  bool contains(std::string_view id) const;
+  void add(std::string_view id);
+  void remove(std::string_view id);
+
+  bool is_ready() const { return m_ready; }
+  std::size_t size() const;
+
+private:
+  std::vector<std::string> scan() const; // ids of every track file on disk
+  void rescan();                         // after lost events, both ways
+  void prune_index();
+  void watch_loop();
+  void watch_tree(const std::filesystem::path& dir, bool catch_up);
+  void on_added(const std::filesystem::path& file);
+  void on_removed(const std::filesystem::path& file);
+
+  std::filesystem::path m_root;
+  mutable std::shared_mutex m_mu;
+  VideoIdMap<bool> m_present;
+  std::atomic<bool> m_ready{false};
+
+  int m_inotify_fd{-1};
+  int m_stop_fd{-1};
+  std::unordered_map<int, std::filesystem::path> m_watches; // only touched by m_worker
+  std::thread m_worker;
+};
+
+} // namespace policarpo
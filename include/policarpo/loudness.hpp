@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace policarpo {
+
+// Anything quieter is silence as far as BS.1770 gating is concerned
+inline constexpr float k_loudness_floor_lufs = -70.0f;
+
+// EBU R128 measurement of a whole track
+struct Loudness {
+  float integrated_lufs{k_loudness_floor_lufs};
+  float true_peak_dbtp{k_loudness_floor_lufs};
+
+  bool operator==(const Loudness&) const = default;
+};
+
+/*
+  ITU-R BS.1770-4 integrated loudness and true peak of 48 kHz stereo.
+
+  Both filters are laid out for 4-wide vectors. The two K-weighting stages
+  of both channels run as 4 lanes of one biquad, pipelined like the EQ:
+  stage 2 filters what stage 1 produced the sample before. True peak is
+  the 4x polyphase upsampler of Annex 2 with the four phases as the lanes.
+  Written with GCC vector extensions, so it is SSE on x86-64 and NEON on
+  ARM without a dispatch.
+*/
+class LoudnessMeter {
+public:
+  LoudnessMeter();
+
+  // Interleaved stereo, any number of frames per call
+  void add(const float* samples, std::size_t frames);
+
+  // nullopt until a full 400 ms block has been seen
+  std::optional<Loudness> result() const;
+
+private:
+  void end_block();
+
+  alignas(16) float m_biquad[7][4]{}; // b0 b1 b2 a1 a2 z1 z2 per lane
+  alignas(16) float m_y[4]{};
+  alignas(16) float m_energy[4]{};
+  alignas(16) float m_history[2][24]{}; // last 12 samples per channel, stored twice
+  std::size_t m_history_pos{0};
+  std::size_t m_block_fill{0};
+  float m_peak{0.0f};
+  std::vector<double> m_blocks; // mean square of every 100 ms
+};
+
+// Playback target in LUFS (LOUDNESS_TARGET in .env), 0 turns it off
+void loudness_configure(int target_lufs);
+
+// dB that bring a track to the target without its true peak going over
+// -1 dBTP. 0 when off, or when the change is too small to be worth
+// re-encoding the stream for.
+float loudness_gain_db(const Loudness& loudness);
+
+} // namespace policarpo
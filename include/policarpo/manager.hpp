@@ -2,9 +2,11 @@
 #include <dpp/dpp.h>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <string>
 #include "policarpo/player.hpp"
+#include "policarpo/reorder_buffer.hpp"
 #include "policarpo/voice_session.hpp"
 
 namespace policarpo {
@@ -26,6 +28,10 @@ public:
   void remove(const dpp::snowflake& guild_id, size_t index, const dpp::slashcommand_t& event);
   void jump(const dpp::snowflake& guild_id, size_t index, const dpp::slashcommand_t& event);
   void set_loop_mode(const dpp::snowflake& guild_id, const std::string& mode, const dpp::slashcommand_t& event);
+  void set_volume(const dpp::snowflake& guild_id, std::optional<int> percent, const dpp::slashcommand_t& event);
+  void set_eq(const dpp::snowflake& guild_id, std::optional<int> bass, std::optional<int> mid, std::optional<int> treble, const dpp::slashcommand_t& event);
+  void set_trim(const dpp::snowflake& guild_id, std::optional<bool> enabled, const dpp::slashcommand_t& event);
+  void set_crossfade(const dpp::snowflake& guild_id, std::optional<int> seconds, const dpp::slashcommand_t& event);
 
   // Events
   void on_voice_track_marker(const dpp::voice_track_marker_t& event);
@@ -37,16 +43,19 @@ private:
   struct track_request_t {
     std::string query;
     std::shared_ptr<policarpo::Player> player;
-    std::function<void(std::optional<policarpo::Song>)> callback;
+    std::function<void(std::optional<policarpo::TrackHandle>)> callback;
   };
 
   dpp::cluster& m_bot;
   std::mutex m_mu;
   std::unordered_map<dpp::snowflake, std::shared_ptr<Player>> m_players;
+  std::unordered_map<dpp::snowflake, std::shared_ptr<ReorderBuffer>> m_reorder; // keeps /play results in command order
 
   std::shared_ptr<Player> get_player(const dpp::snowflake& guild_id);
+  std::shared_ptr<ReorderBuffer> reorder_buffer(const dpp::snowflake& guild_id);
   std::shared_ptr<Player> create_player(dpp::discord_client& shard, const dpp::snowflake& guild_id, const dpp::snowflake& text_channel_id);
-  void enqueue(const std::string_view query, std::shared_ptr<policarpo::Player> player, const dpp::slashcommand_t& event, std::function<void(std::optional<policarpo::Song>)> callback);
+  void enqueue(const std::string_view query, std::shared_ptr<policarpo::Player> player, const dpp::slashcommand_t& event, std::function<void(std::optional<policarpo::TrackHandle>)> callback);
+  void enqueue_playlist(const std::string& playlist_id, std::shared_ptr<policarpo::Player> player, const dpp::slashcommand_t& event);
   void start_next_if_possible(const dpp::snowflake& guild_id);
   void post_update(policarpo::Player const& player, std::string_view content);
   void post_embeded_update(policarpo::Player const& player, const dpp::embed& embed);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include "policarpo/flat_map.hpp"
+
+namespace policarpo {
+
+// Why a video could not be turned into a track
+enum class FailureReason : std::uint8_t {
+  Livestream,     // may become a normal video once the stream ends
+  TooLong,        // over the 2.5 hour limit, not going to change
+  Unavailable,    // private, removed, region or age locked
+  DownloadFailed, // yt-dlp or the network failed, likely transient
+};
+
+std::string_view failure_reason_name(FailureReason reason);
+
+// How long a failure is remembered before trying again
+std::chrono::seconds failure_ttl(FailureReason reason);
+
+// Recent failures by canonical video id
+std::optional<FailureReason> negative_cache_get(std::string_view id);
+void negative_cache_put(std::string_view id, FailureReason reason);
+
+class NegativeCache {
+public:
+  std::optional<FailureReason> get(std::string_view id);
+  void put(std::string_view id, FailureReason reason);
+
+private:
+  struct Entry {
+    FailureReason reason{FailureReason::DownloadFailed};
+    std::chrono::steady_clock::time_point expires_at{};
+  };
+
+  void prune_locked(std::chrono::steady_clock::time_point now);
+
+  std::mutex m_mu;
+  VideoIdMap<Entry> m_entries;
+};
+
+} // namespace policarpo
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace policarpo {
+
+// CRC-32 as used by Ogg pages: polynomial 0x04c11db7, not reflected, zero
+// initial value and no final xor. Pass the previous result to continue.
+// Carry-less multiply folding where the CPU has it, slicing by 8 otherwise.
+std::uint32_t ogg_crc32(const unsigned char* data, std::size_t size, std::uint32_t crc = 0);
+
+// Which kernel ogg_crc32 runs here: "pclmul" or "slice8"
+std::string_view ogg_crc_kernel_name();
+
+} // namespace policarpo
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "policarpo/ogg_writer.hpp"
+
+namespace policarpo {
+
+// Reads a single stream Ogg Opus file packet by packet, checking every page
+// CRC. Anything unexpected (bad checksum, a second stream, missing headers)
+// stops the read and leaves the reason in error().
+class OggOpusReader {
+public:
+  bool open(const std::filesystem::path& path);
+
+  const OpusHead& head() const { return m_head; }
+  const std::vector<std::string>& comments() const { return m_comments; }
+
+  // Next audio packet. granule is the page granule when the packet is the
+  // last one finished on its page, -1 otherwise. False at the end or on error.
+  bool next(std::vector<unsigned char>& packet, std::int64_t& granule);
+
+  const std::string& error() const { return m_error; }
+  bool failed() const { return !m_error.empty(); }
+  bool at_end() const { return m_eos && m_ready.empty(); }
+
+private:
+  bool read_page();
+  bool fail(std::string reason);
+
+  std::ifstream m_in;
+  std::optional<std::uint32_t> m_serial;
+  std::uint32_t m_expected_sequence{0};
+  bool m_eos{false};
+
+  struct Packet {
+    std::vector<unsigned char> data;
+    std::int64_t granule;
+  };
+  std::vector<Packet> m_ready; // finished packets of the current page, in reverse
+  std::vector<unsigned char> m_partial; // continues on the next page
+
+  OpusHead m_head;
+  std::vector<std::string> m_comments;
+  std::string m_error;
+};
+
+} // namespace policarpo
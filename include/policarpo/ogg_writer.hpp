@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace policarpo {
+
+// Identification header fields (RFC 7845), channel mapping family 0
+struct OpusHead {
+  std::uint8_t channels{2};
+  std::uint16_t pre_skip{0};
+  std::uint32_t input_rate{48000};
+  std::int16_t output_gain{0}; // Q7.8 dB
+};
+
+// Writes a single Opus stream as Ogg Opus. Packets are grouped a fixed number
+// per page, the last page gets the end of stream flag on finish().
+class OggOpusWriter {
+public:
+  explicit OggOpusWriter(std::size_t packets_per_page = 50);
+  ~OggOpusWriter();
+
+  OggOpusWriter(const OggOpusWriter&) = delete;
+  OggOpusWriter& operator=(const OggOpusWriter&) = delete;
+
+  // Creates path and writes the OpusHead and OpusTags pages. Comments are
+  // "KEY=value" strings.
+  bool open(const std::filesystem::path& path, const OpusHead& head, std::string_view vendor,
+            const std::vector<std::string>& comments = {});
+
+  // granule: 48 kHz sample position at the end of this packet, pre-skip included
+  bool write_packet(const unsigned char* data, std::size_t size, std::int64_t granule);
+
+  bool finish();
+
+  std::uint64_t packets_written() const { return m_packets_written; }
+
+private:
+  bool write_page(const unsigned char* body, std::size_t body_size, const std::vector<unsigned char>& lacing,
+                  std::int64_t granule, std::uint8_t flags);
+  bool flush(bool eos);
+
+  std::size_t m_packets_per_page;
+  std::ofstream m_out;
+  std::uint32_t m_serial{0};
+  std::uint32_t m_sequence{0};
+
+  // Page being filled
+  std::vector<unsigned char> m_body;
+  std::vector<unsigned char> m_lacing;
+  std::size_t m_page_packets{0};
+  std::int64_t m_granule{0};
+
+  std::uint64_t m_packets_written{0};
+  bool m_finished{false};
+};
+
+} // namespace policarpo
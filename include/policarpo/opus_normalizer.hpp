@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace policarpo {
+
+// Layout of every file ingest writes: 20 ms packets, 50 to a page, so a
+// position maps to a page and a packet on it by arithmetic
+inline constexpr int k_frame_samples = 960;
+inline constexpr std::size_t k_packets_per_page = 50;
+inline constexpr std::string_view k_layout_tag = "POLICARPO_LAYOUT=20ms/50";
+
+enum class NormalizeResult {
+  Normalized,
+  NeedsReencode, // valid, but has frames longer than 20 ms that can't be split
+  Invalid,       // damaged or not something we can play
+};
+
+// Checks an Ogg Opus file (page CRCs, OpusHead, every packet's TOC) and
+// writes it again in the layout above. reason is set when it is Invalid.
+NormalizeResult normalize_ogg_opus(const std::filesystem::path& input, const std::filesystem::path& output,
+                                   std::string* reason = nullptr);
+
+struct SeekPoint {
+  std::uint64_t offset{0};     // first byte of the page holding the position
+  std::uint32_t skip_packets{0}; // packets on that page before the position
+};
+
+// Where to start reading to play from position, for files in the layout
+// above. nullopt for other files or past the end.
+std::optional<SeekPoint> normalized_seek_point(const std::filesystem::path& file, std::chrono::milliseconds position);
+
+} // namespace policarpo
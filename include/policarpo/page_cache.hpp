@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "policarpo/flat_map.hpp"
+
+namespace policarpo {
+
+struct PageCacheSettings {
+  std::size_t prefetch_tracks{2}; // queue entries read ahead per guild, 0 reads none
+  bool drop_behind{true};         // drop played pages of tracks nobody wants next
+};
+
+// Call at startup (PREFETCH_TRACKS and DROP_PLAYED_PAGES in .env)
+void page_cache_configure(const PageCacheSettings& settings);
+
+// How many upcoming queue entries a guild should hand to page_cache_window
+std::size_t page_cache_prefetch_tracks();
+
+struct UpcomingFile {
+  std::string id;
+  std::filesystem::path file;
+};
+
+/*
+  What a guild plays now and the files it plays next, in order. Files new
+  to the window are read into the page cache in the background so the
+  track boundary doesn't wait on the disk. Every id in some guild's window
+  is part of the working set and keeps its pages.
+*/
+void page_cache_window(std::uint64_t guild_id, std::string current, std::vector<UpcomingFile> upcoming);
+void page_cache_forget(std::uint64_t guild_id);
+
+// Whether id is wanted again soon: next in guild_id's window, or playing
+// or next in any other guild's
+bool page_cache_is_hot(std::uint64_t guild_id, std::string_view id);
+
+/*
+  Reads of one track as it is fed. Pages behind the read position are
+  dropped as it moves, and the rest when it's done, unless the track is
+  hot: it went out to DPP's buffer and nobody reads it again soon.
+*/
+class PlayedPages {
+public:
+  PlayedPages(std::uint64_t guild_id, std::string id, const std::filesystem::path& file);
+  ~PlayedPages();
+
+  PlayedPages(const PlayedPages&) = delete;
+  PlayedPages& operator=(const PlayedPages&) = delete;
+
+  // Everything before offset has been read
+  void advance(off_t offset);
+
+private:
+  std::uint64_t m_guild_id;
+  std::string m_id;
+  int m_fd{-1};
+  off_t m_dropped{0};
+};
+
+// One thread issuing read ahead hints, so a slow disk blocks it instead
+// of the player
+class Prefetcher {
+public:
+  Prefetcher() = default;
+  ~Prefetcher();
+
+  Prefetcher(const Prefetcher&) = delete;
+  Prefetcher& operator=(const Prefetcher&) = delete;
+
+  void submit(const UpcomingFile& upcoming);
+
+private:
+  void worker_loop();
+  void prefetch(const UpcomingFile& upcoming);
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  std::deque<UpcomingFile> m_jobs;
+  VideoIdMap<bool> m_queued;
+  bool m_stop{false};
+  std::thread m_worker;
+};
+
+} // namespace policarpo
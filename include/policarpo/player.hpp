@@ -3,18 +3,19 @@
 #include <condition_variable>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <chrono>
 #include <oggz/oggz.h>
+#include "policarpo/crossfade.hpp"
+#include "policarpo/dsp_chain.hpp"
+#include "policarpo/track_table.hpp"
 
 namespace policarpo {
 
-struct Song {
-  std::string id;
-  std::string title;
-  std::chrono::milliseconds duration{0};
-};
+// What DSP playback re-encodes at, or the channel's bitrate when lower
+inline constexpr int k_dsp_bitrate = 128000;
 
 enum loop_mode_t {
   LOOP_OFF,
@@ -35,13 +36,13 @@ enum current_state_t {
   OTHER
 };
 
-class Player {
+class Player : public std::enable_shared_from_this<Player> {
 public:
   Player(dpp::discord_client& shard, const dpp::snowflake& guild_id, const dpp::snowflake& text_channel_id);
 
   ~Player();
 
-  void enqueue(Song s);
+  void enqueue(TrackHandle track);
   bool has_queue() const;
 
   // playback
@@ -51,7 +52,7 @@ public:
   bool resume();
   bool restart();
   bool voice_ready();
-  std::optional<Song> remove_from_queue(size_t index);
+  std::optional<TrackHandle> remove_from_queue(size_t index);
   bool jump_to_queue_index(size_t index);
   void mark_finished();     // called from Manager on marker
   void stop_and_clear();    // stop audio + clear queue
@@ -64,13 +65,16 @@ public:
   void update_text_channel(const dpp::snowflake& text_channel_id);
   void update_loop_mode(loop_mode_t mode);
   dpp::snowflake get_text_channel() const { return m_text_channel_id; }
+
+  // Where in the current track feeding stops, before any trailing silence
+  std::chrono::milliseconds play_end() const { std::lock_guard lk(m_mu); return m_play_end; }
  
 public:
   //std::deque<Song> queue;
   dpp::snowflake m_guild_id;
-  std::optional<Song> m_current;
+  std::optional<TrackHandle> m_current;
   std::size_t m_current_index{0};
-  std::vector<Song> m_queue;
+  std::vector<TrackHandle> m_queue;
   std::atomic<bool> is_finished{false};
   std::atomic<bool> is_stopped{true};
   std::atomic<bool> is_waiting{true};
@@ -81,11 +85,58 @@ private:
 
   void get_next_track();
 
+  // What get_next_track will pick once the current track ends, without
+  // moving anything
+  std::optional<TrackHandle> peek_next_track() const;
+
+  // Up to count tracks in the order get_next_track will pick them
+  std::vector<TrackHandle> upcoming_tracks(std::size_t count) const;
+
+  // Hands the current track and the next downloaded ones to the page cache,
+  // which reads them ahead
+  void update_cache_window();
+
+  // Drops the rest of the current track from DPP's buffer. A crossfade
+  // queued behind its marker is for a transition that won't happen now,
+  // so it goes too. Called with m_mu held.
+  void skip_buffered(dpp::voiceconn* v);
+
+  // Starts song's download and plays it from a waiter thread once it is
+  // on disk, or moves on if it fails
+  void wait_for_download(const Song& song);
+  void download_finished(const std::string& id, bool downloaded);
+
+  // Sends one stored packet, through the DSP chain if this track has one.
+  // False once the trailing silence is reached, nothing more should be read.
+  bool send_packet(const unsigned char* packet, long bytes);
+
   loop_mode_t m_loop_mode{LOOP_OFF};
 
   dpp::discord_client& m_shard;
   dpp::snowflake m_text_channel_id;
   float m_elapsed{0.0f};
+  // Feed state below is set by play() and read while feeding, under m_mu
+  std::unique_ptr<DspChain> m_dsp; // null when volume and EQ are neutral
+  std::chrono::milliseconds m_play_end{0};
+  int m_channel_bitrate{0}; // of the channel the last play() went to, 0 unknown
+  std::int64_t m_feed_left{-1}; // samples until the trailing silence or crossfade, -1 plays to the end
+
+  // Crossfade being prepared by play(): the tail is read once m_feed_left
+  // runs out, until it has m_fade_frames
+  std::unique_ptr<Crossfade> m_fade;
+  std::size_t m_fade_frames{0};
+
+  // Set once a crossfade has gone out after the marker: the next track
+  // picks up from here instead of its start
+  struct CrossfadeInto {
+    std::string id;
+    float seconds;
+  };
+  std::optional<CrossfadeInto> m_crossfade_into;
+
+  // Track play() is waiting on a download for, reset by anything that
+  // moves off it
+  std::optional<std::string> m_awaiting;
 
   std::condition_variable m_cv;
   mutable std::mutex m_mu;
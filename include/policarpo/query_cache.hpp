@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace policarpo {
+
+// call once at startup
+void query_cache_init();
+
+// What a text query resolved to last time, if that is recent enough.
+// Queries are normalized first, see normalize_query.
+std::optional<std::string> query_cache_get(std::string_view query);
+void query_cache_put(std::string_view query, std::string_view id);
+
+// Lowercase, trimmed, runs of whitespace folded into one space
+std::string normalize_query(std::string_view query);
+
+// Normalized search text -> video id. Bounded LRU that is written to disk
+// whole, older entries fall off the end and expire after a TTL.
+class QueryCache {
+public:
+  QueryCache(std::filesystem::path path, std::size_t capacity, std::chrono::seconds ttl);
+
+  void load();
+  void save();
+
+  std::optional<std::string> get(const std::string& key);
+  void put(const std::string& key, std::string id);
+
+private:
+  struct Entry {
+    std::string key;
+    std::string id;
+    std::int64_t resolved_at; // unix seconds
+  };
+
+  bool expired(const Entry& entry, std::int64_t now) const;
+  void insert_locked(Entry entry);
+  void save_locked();
+
+  std::filesystem::path m_path;
+  std::size_t m_capacity;
+  std::chrono::seconds m_ttl;
+
+  std::mutex m_mu;
+  std::list<Entry> m_lru; // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> m_by_key;
+};
+
+} // namespace policarpo
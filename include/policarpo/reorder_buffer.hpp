@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+namespace policarpo {
+
+// Lets requests resolve in parallel while their effects are applied in the
+// order they were made. A slot is reserved when the request arrives; when
+// it resolves, its commit runs once every earlier slot has committed.
+class ReorderBuffer {
+public:
+  std::uint64_t reserve();
+
+  // Runs commit, and any later commits it was holding up, on this thread.
+  // Returns right away if another thread is already draining, that thread
+  // will run it. Every reserved slot must be completed exactly once.
+  void complete(std::uint64_t slot, std::function<void()> commit);
+
+private:
+  std::mutex m_mu;
+  std::uint64_t m_next_slot{0};
+  std::uint64_t m_next_commit{0};
+  std::map<std::uint64_t, std::function<void()>> m_ready;
+  bool m_draining{false};
+};
+
+} // namespace policarpo
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace policarpo {
+
+// Dead air at either end of a track, cut when the guild has /trim on
+struct SilenceTrim {
+  std::chrono::milliseconds start{0};
+  std::chrono::milliseconds end{0};
+
+  bool operator==(const SilenceTrim&) const = default;
+};
+
+// Finds where the audio starts and ends in decoded 48 kHz stereo, fed in
+// playback order. Runs next to the loudness meter on the same samples.
+class SilenceDetector {
+public:
+  // Interleaved stereo, any number of frames per call
+  void add(const float* samples, std::size_t frames);
+
+  // Rounded to whole 20 ms packets with a little margin kept, and only
+  // when there is enough to be worth skipping
+  SilenceTrim result() const;
+
+private:
+  std::int64_t m_frames{0};
+  std::int64_t m_first_sound{-1}; // first frame above the threshold
+  std::int64_t m_last_sound{-1};  // last one
+};
+
+} // namespace policarpo
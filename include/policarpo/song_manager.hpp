@@ -5,9 +5,17 @@
 #include <optional>
 #include <string_view>
 #include <functional>
+#include <vector>
+#include "policarpo/negative_cache.hpp"
 #include "policarpo/player.hpp"
 
 namespace policarpo {
+
+// Longer tracks are refused (2.5 hours)
+inline constexpr std::chrono::milliseconds k_max_track_duration{9000 * 1000};
+
+// Playlists are cut after this many entries
+inline constexpr std::size_t k_max_playlist_entries = 200;
     
 bool is_link(std::string_view query);
 
@@ -19,24 +27,52 @@ std::string get_file_extension(const std::string& filename);
 
 std::string run_command(const std::string& cmd);
 
-bool reencode_to_opus(const std::string& input_file, std::string& output_file);
+// Encodes input_file to Ogg Opus next to it (same name, .opus) in process.
+// output_file is set to the new file, the input is left alone.
+bool reencode_to_opus(std::string_view input_file, std::string& output_file);
+
+// Same, but Opus in WebM is copied into Ogg as is and only other codecs are
+// re-encoded. Either way the result is in the normalized 20 ms layout. A
+// source that fails validation is moved to quarantine under id.
+bool convert_to_opus(std::string_view id, std::string_view input_file, std::string& output_file);
 
 bool is_track_downloaded(std::string_view url);
 
 bool is_track_available(const policarpo::Song& track);
 
-std::string extract_youtube_id_from_watch_url(std::string_view url);
+std::string extract_youtube_id(std::string_view url);
+
+std::string extract_youtube_playlist_id(std::string_view url);
+
+// Entries of a playlist in order, with title and duration but not downloaded.
+// Unavailable and over-length entries are left out.
+std::vector<Song> list_playlist(std::string_view playlist_id);
 
-std::optional<policarpo::Song> load_cached_song_by_id(const std::string& id);
+std::optional<policarpo::TrackHandle> load_cached_song_by_id(const std::string& id);
 
 std::string download_opus_track(std::string_view url);
 
 std::optional<Song> download_url_track(std::string_view url);
 
+// Download id, store it in the library and index it. Blocking, most callers
+// want download_track() which queues and deduplicates this.
+std::optional<policarpo::TrackHandle> fetch_track(const std::string& id, const std::string& title = {});
+
 std::chrono::milliseconds get_audio_duration_ms(std::string_view filepath);
 
-void get_track(const std::string_view search_query, std::function<void(std::optional<policarpo::Song>)> callback);
+FailureReason classify_ytdlp_error(std::string_view error);
+
+std::string sanitize_search_query(std::string_view query);
+
+// Why the last attempt at this query failed, if it is still remembered
+std::optional<FailureReason> track_failure_reason(std::string_view search_query);
+
+void get_track(const std::string_view search_query, std::function<void(std::optional<policarpo::TrackHandle>)> callback);
 
 // void search_track(std::string_view query, std::function<void(std::optional<policarpo::Song>)> callback);
 
+// Network search for a text query, id and title of the top result. Not
+// remembered anywhere, callers decide what goes in the query cache.
+std::optional<Song> resolve_query(std::string_view query);
+
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <dpp/dpp.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "policarpo/suggestions.hpp"
+
+namespace policarpo {
+
+// Opt-in (SPECULATIVE_DOWNLOADS=1 in .env). While someone is still typing
+// a /play query, start downloading what they will most likely submit, at
+// the lowest download priority. Everything below is a no-op until enabled.
+void speculation_enable();
+
+// From /play autocomplete, with the suggestions that were shown
+void speculation_typing(dpp::snowflake guild_id, dpp::snowflake user_id, std::string_view typed,
+                        const std::vector<Suggestion>& suggestions);
+
+// From /play itself, drops the user's speculation unless it is what they asked for
+void speculation_submitted(dpp::snowflake guild_id, dpp::snowflake user_id, std::string_view query);
+
+class Speculator {
+public:
+  ~Speculator();
+
+  void start();
+  void typing(std::uint64_t guild_id, std::uint64_t user_id, std::string_view typed, const std::vector<Suggestion>& suggestions);
+  void submitted(std::uint64_t guild_id, std::uint64_t user_id, std::string_view query);
+
+private:
+  using UserKey = std::pair<std::uint64_t, std::uint64_t>; // guild, user
+
+  struct Pending {
+    std::string query;
+    std::chrono::steady_clock::time_point due;
+  };
+
+  struct Resolved {
+    std::string id;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  void worker_loop();
+  void speculate_locked(const UserKey& user, const std::string& id, std::string title);
+  void drop_target_locked(const UserKey& user);
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  bool m_running{false};
+  bool m_stop{false};
+  std::thread m_worker;
+
+  std::map<UserKey, Pending> m_pending;      // text waiting for typing to pause
+  std::set<UserKey> m_searching;             // text being searched right now
+  std::map<UserKey, std::string> m_targets;  // id being fetched for each user
+  // Searches made for half-typed text. Kept out of the query cache (and so
+  // out of suggestions) until the same query is actually submitted.
+  std::unordered_map<std::string, Resolved> m_resolved;
+  std::unordered_map<std::uint64_t, std::deque<std::chrono::steady_clock::time_point>> m_started; // per guild, last hour
+};
+
+} // namespace policarpo
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace policarpo {
+
+// One autocomplete choice. value is what /play receives if it is picked.
+struct Suggestion {
+  std::string label;
+  std::string value;
+};
+
+// Choices for /play while the user types: matching recent searches in this
+// guild first, then cached tracks whose title has a word starting with what
+// was typed. Memory only so it fits in the autocomplete deadline under any load.
+std::vector<Suggestion> suggest_tracks(std::uint64_t guild_id, std::string_view typed, std::size_t limit);
+
+// A text query submitted to /play in guild_id, offered back to that guild
+// only. Links aren't kept, cached titles already cover them.
+void suggestions_record(std::uint64_t guild_id, std::string_view query);
+
+} // namespace policarpo
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "policarpo/flat_map.hpp"
+#include "policarpo/track_table.hpp"
+
+namespace policarpo {
+
+// call once at startup, after track_cache_init
+void title_search_init();
+
+// Kept in sync by track_cache_upsert/erase
+void title_search_add(const Song& song);
+void title_search_remove(std::string_view id);
+
+struct TitleMatch {
+  std::string id;
+  double score{0}; // share of the query's trigrams found in the title
+};
+
+// Best cached title for a free text query, only when it clearly matches
+std::optional<TitleMatch> title_search_best(std::string_view query);
+
+// Titles with a word starting with prefix (as typed so far), for autocomplete.
+// Memory only, never touches disk.
+std::vector<Song> title_search_complete(std::string_view prefix, std::size_t limit,
+                                        const std::function<bool(std::string_view id)>& keep = {});
+
+// Lowercased, ASCII punctuation turned into single spaces
+std::string fold_title(std::string_view text);
+
+// In-memory indexes over the titles in the track index:
+//  - trigrams -> docs, for fuzzy matching of whole queries. Each word is
+//    padded with a space on both sides so short words and word starts
+//    still produce trigrams.
+//  - every word start of every folded title, sorted, for prefix lookups.
+//    New titles go to a small unsorted tail that is merged in batches.
+class TitleIndex {
+public:
+  void add(const Song& song);
+  void remove(std::string_view id);
+
+  // Replace everything, sorting once instead of merging per title
+  void assign(const std::vector<Song>& songs);
+
+  // Highest scoring title with at least min_score of the query's trigrams
+  std::optional<TitleMatch> best(std::string_view query, double min_score) const;
+
+  std::vector<Song> complete(std::string_view prefix, std::size_t limit,
+                             const std::function<bool(std::string_view id)>& keep) const;
+
+  std::size_t size() const;
+
+private:
+  struct Doc {
+    Song song;
+    std::string folded;
+    std::uint32_t trigrams{0};
+    bool live{false};
+  };
+
+  struct WordStart {
+    std::uint32_t doc;
+    std::uint32_t offset; // into Doc::folded
+  };
+
+  void add_locked(const Song& song);
+  void clear_locked();
+  void compact_locked();
+  void merge_tail_locked();
+  std::string_view text_at(const WordStart& start) const;
+
+  mutable std::shared_mutex m_mu;
+  std::vector<Doc> m_docs;
+  VideoIdMap<std::uint32_t> m_doc_of;
+  FlatMap<std::vector<std::uint32_t>> m_postings; // trigram -> docs, ascending
+  std::vector<WordStart> m_sorted;
+  std::vector<WordStart> m_tail;
+  std::size_t m_dead{0};
+};
+
+} // namespace policarpo
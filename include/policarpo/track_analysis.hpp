@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include "policarpo/flat_map.hpp"
+#include "policarpo/loudness.hpp"
+#include "policarpo/silence.hpp"
+
+namespace policarpo {
+
+// What one decode of a stored track tells us
+struct TrackAnalysis {
+  Loudness loudness;
+  SilenceTrim trim;
+};
+
+// Decodes an Ogg Opus file and measures it, nullopt if it can't be read
+std::optional<TrackAnalysis> analyze_track(const std::filesystem::path& file);
+
+// Queues <id>.opus to be analyzed and stored in the track index. Returns
+// at once, ids already queued are ignored.
+void track_analysis_queue(const std::string& id);
+
+// One low priority thread analyzing stored tracks, so a download is
+// playable before its loudness and silences are known
+class TrackAnalyzer {
+public:
+  TrackAnalyzer() = default;
+  ~TrackAnalyzer();
+
+  TrackAnalyzer(const TrackAnalyzer&) = delete;
+  TrackAnalyzer& operator=(const TrackAnalyzer&) = delete;
+
+  void submit(const std::string& id);
+
+private:
+  void worker_loop();
+  void analyze(const std::string& id);
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  std::deque<std::string> m_ids;
+  VideoIdMap<bool> m_queued;
+  bool m_stop{false};
+  std::thread m_worker;
+};
+
+} // namespace policarpo
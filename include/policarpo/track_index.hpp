@@ -1,46 +1,107 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
+#include <condition_variable>
 #include <filesystem>
+#include <functional>
 #include <mutex>
 #include <optional>
 #include <string>
-#include <unordered_map>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "policarpo/flat_map.hpp"
+#include "policarpo/track_snapshot.hpp"
+#include "policarpo/track_table.hpp"
 
 namespace policarpo {
 
-struct TrackMeta {
-  std::string title;
-  std::chrono::milliseconds duration{0};
-};
-
 // call once at startup
 void track_cache_init();
 
 // lookup/update
-std::optional<TrackMeta> track_cache_get(const std::string& id);
-void track_cache_upsert(const std::string& id, const TrackMeta& meta);
+std::optional<TrackHandle> track_cache_get(const std::string& id);
+TrackHandle track_cache_upsert(const Song& song);
+bool track_cache_erase(const std::string& id);
+std::size_t track_cache_erase_if(const std::function<bool(const std::string&)>& pred);
+void track_cache_for_each(const std::function<void(const Song&)>& fn);
+
+/*
+  Upserts and erases are kept in memory and marked dirty. A flusher thread
+  writes them into a new snapshot every few seconds, and shutdown() writes
+  whatever is left, so a burst of downloads or deletes costs one
+  snapshot write instead of one per track.
 
+  Lookups only wait for the merge of pending changes, not for the write:
+  the file is written and mapped unlocked, then swapped in. Changes made
+  meanwhile stay pending for the next write.
+*/
 class TrackIndex {
 public:
-  explicit TrackIndex(std::filesystem::path json_path);
+  explicit TrackIndex(std::filesystem::path snapshot_path);
+  ~TrackIndex();
 
-  // Load from disk once at startup
+  TrackIndex(const TrackIndex&) = delete;
+  TrackIndex& operator=(const TrackIndex&) = delete;
+
+  // Map the binary snapshot once at startup. The first run imports the
+  // legacy index.json next to it and writes the snapshot.
   void load();
 
-  // Persist current map to disk (atomic write)
-  void save();
+  // Merge pending upserts and erases into a new snapshot and remap it
+  // (atomic write). Runs on its own when something is pending.
+  bool save();
+
+  // Stops the flusher and writes what is still pending
+  void shutdown();
 
   // Lookup by id
-  std::optional<TrackMeta> get(const std::string& id) const;
+  std::optional<TrackHandle> get(const std::string& id) const;
+
+  // Insert/update, returns the handle the index now points at
+  TrackHandle upsert(const Song& song);
 
-  // Insert/update
-  void upsert(const std::string& id, TrackMeta meta);
+  // Drop entries. erase_if returns the ids it removed, pred is called
+  // with the index locked.
+  bool erase(const std::string& id);
+  std::vector<std::string> erase_if(const std::function<bool(const std::string&)>& pred);
+
+  // Every entry, pending upserts included
+  void for_each(const std::function<void(const Song&)>& fn) const;
+
+  // JSON is only an import/export format now. Both stream entry by entry
+  // instead of holding a whole nlohmann DOM in memory.
+  bool import_json(const std::filesystem::path& json_path);
+  bool export_json(const std::filesystem::path& json_path) const;
 
 private:
+  // The pending changes a snapshot write took in, dropped once it is live
+  struct Captured {
+    std::vector<std::pair<std::string, TrackHandle>> upserts;
+    std::vector<std::string> erased;
+    std::uint64_t generation{0};
+  };
+
+  void mark_dirty_locked();
+  void flush_loop();
+  Captured capture_locked() const;
+  bool write_snapshot(std::vector<Song> entries, const Captured& captured);
+  std::vector<Song> merged_entries_locked() const;
+
   std::filesystem::path m_path;
+  std::mutex m_write_mu; // one snapshot write at a time, never taken under m_mu
   mutable std::mutex m_mu;
-  std::unordered_map<std::string, TrackMeta> m_by_id;
+  TrackSnapshot m_snapshot;
+  VideoIdMap<TrackHandle> m_by_id;          // upserts not yet in the snapshot
+  mutable VideoIdMap<TrackHandle> m_interned; // snapshot hits already interned
+  VideoIdMap<bool> m_erased;                 // snapshot entries erased since
+  bool m_dirty{false};
+  std::uint64_t m_generation{0}; // bumped by every change
+
+  std::condition_variable m_cv;
+  bool m_stop{false};
+  std::thread m_flusher;
 };
 
-} // namespace policarpo
\ No newline at end of file
+} // namespace policarpo
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "policarpo/flat_map.hpp"
+
+namespace policarpo {
+
+// What we need to know about a video before deciding to download it
+struct TrackMetadata {
+  std::string id;
+  std::string title;
+  std::chrono::milliseconds duration{0};
+  bool is_live{false};
+};
+
+class MetadataProvider {
+public:
+  virtual ~MetadataProvider() = default;
+
+  // nullopt when this provider can't tell, the next one is asked
+  virtual std::optional<TrackMetadata> lookup(std::string_view id) = 0;
+  virtual std::string_view name() const = 0;
+};
+
+// In process: answers from search results, and otherwise searches for the
+// id itself, which brings the video up as the first result
+class SearchMetadataProvider : public MetadataProvider {
+public:
+  std::optional<TrackMetadata> lookup(std::string_view id) override;
+  std::string_view name() const override { return "search"; }
+
+  // Results we already got from a search, saves asking again
+  void remember(const TrackMetadata& metadata);
+
+private:
+  std::mutex m_mu;
+  VideoIdMap<TrackMetadata> m_recent;
+};
+
+// Spawns yt-dlp, slow but understands everything. Errors it reports are
+// recorded in the negative cache.
+class YtDlpMetadataProvider : public MetadataProvider {
+public:
+  std::optional<TrackMetadata> lookup(std::string_view id) override;
+  std::string_view name() const override { return "yt-dlp"; }
+};
+
+// Canned answers from a JSON file, {"<id>": {"title", "duration_ms", "is_live"}},
+// so the pre-download checks can run offline
+class FixtureMetadataProvider : public MetadataProvider {
+public:
+  explicit FixtureMetadataProvider(const std::filesystem::path& path);
+
+  std::optional<TrackMetadata> lookup(std::string_view id) override;
+  std::string_view name() const override { return "fixture"; }
+
+  std::size_t size() const { return m_entries.size(); }
+
+private:
+  VideoIdMap<TrackMetadata> m_entries;
+};
+
+// Asks the fixture (if any), then the in-process search, then yt-dlp
+std::optional<TrackMetadata> track_metadata(std::string_view id);
+
+// Feed a search result to the in-process provider
+void track_metadata_remember(const TrackMetadata& metadata);
+
+// Put a fixture provider in front of the others (METADATA_FIXTURE in .env)
+bool track_metadata_use_fixture(const std::filesystem::path& path);
+
+// "3:45" / "1:02:03" -> milliseconds, nullopt when it isn't a duration
+std::optional<std::chrono::milliseconds> parse_clock_duration(std::string_view text);
+
+} // namespace policarpo
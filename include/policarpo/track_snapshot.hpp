@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "policarpo/track_table.hpp"
+
+namespace policarpo {
+
+/*
+  Read-only, mmap'd image of the track index (songs/index.bin).
+
+  Layout (native endianness, every section 8-byte aligned):
+    header
+    uint64_t keys[packed_count]                 sorted packed YouTube ids
+    record   records[packed_count]              same order as keys
+    name     names[other_count]                 non-YouTube ids, sorted
+    record   other_records[other_count]         same order as names
+    char     arena[arena_size]                  titles and names
+
+  record_size is stored in the header. New fields are only ever appended to
+  the record, so older snapshots load with the missing fields zeroed.
+*/
+class TrackSnapshot {
+public:
+  static constexpr std::uint32_t k_version = 3;
+
+  TrackSnapshot() = default;
+  ~TrackSnapshot();
+
+  TrackSnapshot(const TrackSnapshot&) = delete;
+  TrackSnapshot& operator=(const TrackSnapshot&) = delete;
+
+  // Maps the file, false if missing or not a valid snapshot
+  bool open(const std::filesystem::path& path);
+  void close();
+
+  // Exchanges mappings, so a new snapshot can be opened before it goes live
+  void swap(TrackSnapshot& other) noexcept;
+
+  bool is_open() const { return m_data != nullptr; }
+  std::size_t size() const;
+
+  std::optional<Song> find(std::string_view id) const;
+  void for_each(const std::function<void(Song)>& fn) const;
+
+  // Writes entries (any order, unique ids) to path
+  static bool write(const std::filesystem::path& path, std::vector<Song> entries);
+
+private:
+  struct Header;
+  struct Record;
+  struct Name;
+
+  Song make_song(std::string id, const std::byte* record) const;
+  std::string_view arena_string(std::uint32_t offset, std::uint32_t length) const;
+  const std::byte* packed_record(std::size_t index) const;
+  const std::byte* other_record(std::size_t index) const;
+  std::optional<std::size_t> find_packed(std::uint64_t key) const;
+  std::optional<std::size_t> find_other(std::string_view id) const;
+
+  const std::byte* m_data{nullptr};
+  std::size_t m_size{0};
+  const Header* m_header{nullptr};
+  const std::uint64_t* m_keys{nullptr};
+};
+
+} // namespace policarpo
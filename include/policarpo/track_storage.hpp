@@ -0,0 +1,54 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace policarpo {
+
+/*
+  On-disk layout of the cache:
+
+    songs/ab/cd/<id>.opus              what everything else opens
+    songs/objects/ef/gh/<sha256>.opus  the audio itself
+    songs/incoming/<id>/               downloads in progress, one dir per job
+    songs/quarantine/                  files that failed validation
+    songs/derived/ab/cd/<id>-<k>k.opus lower bitrate copies, see bitrate_tiers
+
+  ab/cd is a hash of the id so no directory grows past a few entries per
+  thousand tracks. Each id file is a hard link to the object holding its
+  content, so identical audio uploaded under different ids is stored once.
+*/
+
+inline const std::filesystem::path k_songs_dir = "songs";
+inline const std::filesystem::path k_objects_dir = k_songs_dir / "objects";
+inline const std::filesystem::path k_incoming_dir = k_songs_dir / "incoming"; // unfinished downloads
+inline const std::filesystem::path k_quarantine_dir = k_songs_dir / "quarantine";
+inline const std::filesystem::path k_derived_dir = k_songs_dir / "derived";
+
+// Where the .opus for this id lives (whether or not it exists yet)
+std::filesystem::path track_path(std::string_view id);
+
+// Where the copy of id encoded at bitrate (bits per second) lives
+std::filesystem::path track_derived_path(std::string_view id, int bitrate);
+
+// Moves a finished download into the layout under id, deduplicating it
+// against content already stored. The source file is consumed.
+bool track_store(const std::filesystem::path& file, std::string_view id);
+
+// Moves a file that failed validation out of the way, kept for inspection
+// as quarantine/<id>-<unix time><ext>. The file is consumed, and so is the
+// object behind it when it is a stored track.
+void track_quarantine(const std::filesystem::path& file, std::string_view id, std::string_view reason);
+
+// One-time migration of flat songs/<id>.opus files into the layout, plus
+// removal of objects no id links to anymore and of copies of tracks that
+// are gone. Safe to run on every start.
+void track_storage_init();
+
+// Hex SHA-256 of the audio packets: Ogg page bodies past the header
+// packets, so serials, CRCs, paging and encoder tags don't change it
+std::optional<std::string> track_content_hash(const std::filesystem::path& file);
+
+} // namespace policarpo
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include "policarpo/flat_map.hpp"
+#include "policarpo/loudness.hpp"
+#include "policarpo/silence.hpp"
+
+namespace policarpo {
+
+struct Song {
+  std::string id;
+  std::string title;
+  std::chrono::milliseconds duration{0};
+  // Both filled in after download, see track_analysis
+  std::optional<Loudness> loudness;
+  std::optional<SilenceTrim> trim;
+};
+
+// Compact reference to an interned Song. Queues, the current track and the
+// TrackIndex hold these instead of carrying their own copies of the strings.
+using TrackHandle = std::uint32_t;
+
+// Process-wide interning helpers
+TrackHandle track_intern(const Song& song);
+const Song& track_get(TrackHandle handle);
+std::optional<TrackHandle> track_find(const std::string& id);
+
+class TrackTable {
+public:
+  // Returns the existing handle when the id is already interned with the same
+  // metadata. Changed metadata gets a fresh entry so the old one stays immutable.
+  TrackHandle intern(const Song& song);
+
+  // Entries are never removed, so the reference is valid for the whole process
+  const Song& get(TrackHandle handle) const;
+
+  // Latest handle interned for this id
+  std::optional<TrackHandle> find(const std::string& id) const;
+
+  std::size_t size() const;
+
+private:
+  mutable std::shared_mutex m_mu;
+  std::deque<Song> m_entries; // deque: push_back never moves existing entries
+  VideoIdMap<TrackHandle> m_by_id;
+};
+
+} // namespace policarpo
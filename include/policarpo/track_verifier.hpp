@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "policarpo/flat_map.hpp"
+
+namespace policarpo {
+
+struct VerifySettings {
+  int read_mbps{16};      // disk read budget shared by all workers, 0 skips the startup pass
+  std::size_t workers{2}; // files checked at once
+};
+
+// Call before the first verification (VERIFY_READ_MBPS in .env)
+void track_verifier_configure(const VerifySettings& settings);
+
+// Checks every stored track once, in the background. Called when the
+// library's first scan is done.
+void track_verify_library();
+
+// Checks a fresh download ahead of the library pass
+void track_verify_queue(const std::string& id);
+
+// Why file is not a sound Ogg stream (bad page, checksum, cut short before
+// its end of stream page), nullopt when it is. wait_for_budget is called
+// with the size of every read before it is made.
+std::optional<std::string> verify_ogg_file(const std::filesystem::path& file,
+                                           const std::function<void(std::size_t)>& wait_for_budget = {});
+
+/*
+  Low priority workers reading tracks at a fixed rate with idle I/O
+  priority, bypassing the page cache where the filesystem allows, so
+  playback reads neither wait behind them nor lose cached pages to them.
+  Damaged files are quarantined and downloaded again.
+*/
+class TrackVerifier {
+public:
+  TrackVerifier() = default;
+  ~TrackVerifier();
+
+  TrackVerifier(const TrackVerifier&) = delete;
+  TrackVerifier& operator=(const TrackVerifier&) = delete;
+
+  void configure(const VerifySettings& settings);
+  void submit(const std::string& id, bool urgent);
+  void verify_all();
+
+private:
+  void start_locked();
+  void worker_loop();
+  void list_library();
+  bool verify(const std::string& id); // true when it was damaged
+  void wait_for_budget(std::size_t bytes);
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  VerifySettings m_settings;
+  std::deque<std::string> m_ids;
+  VideoIdMap<bool> m_queued; // true for ids queued by the library pass
+  bool m_list_pending{false};
+  bool m_stop{false};
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_budget_mu;
+  std::chrono::steady_clock::time_point m_budget_at{};
+
+  // Library pass progress, reported when it is done
+  std::size_t m_pass_left{0};
+  std::size_t m_pass_damaged{0};
+  std::chrono::steady_clock::time_point m_pass_started{};
+};
+
+} // namespace policarpo
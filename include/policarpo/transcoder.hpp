@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace policarpo {
+
+struct TranscodeSettings {
+  int bitrate{128000};  // bits per second
+  int complexity{10};   // 0-10, libopus encoder effort
+  std::size_t workers{0}; // encodes at once, 0 picks a quarter of the cores
+};
+
+// Call before the first transcode (OPUS_BITRATE, OPUS_COMPLEXITY and
+// TRANSCODE_WORKERS in .env)
+void transcoder_configure(const TranscodeSettings& settings);
+
+// Re-encodes any audio file ffmpeg can read into Ogg Opus at output, on the
+// transcode pool. Blocks until done. bitrate 0 is the configured one.
+bool transcode_to_opus(const std::filesystem::path& input, const std::filesystem::path& output, int bitrate = 0);
+
+// Bounded pool: at most `workers` encodes run at once, each at a lowered
+// scheduling priority so ingest never competes with playback.
+class Transcoder {
+public:
+  Transcoder() = default;
+  ~Transcoder();
+
+  Transcoder(const Transcoder&) = delete;
+  Transcoder& operator=(const Transcoder&) = delete;
+
+  void configure(const TranscodeSettings& settings);
+  std::future<bool> submit(std::filesystem::path input, std::filesystem::path output, int bitrate = 0);
+
+private:
+  struct Job {
+    std::filesystem::path input;
+    std::filesystem::path output;
+    int bitrate;
+    std::promise<bool> done;
+  };
+
+  void start_locked();
+  void worker_loop();
+  bool encode(const std::filesystem::path& input, const std::filesystem::path& output, int bitrate);
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  TranscodeSettings m_settings;
+  std::deque<Job> m_jobs;
+  bool m_stop{false};
+  std::vector<std::thread> m_workers;
+};
+
+} // namespace policarpo
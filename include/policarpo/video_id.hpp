@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace policarpo {
+
+// YouTube ids are 11 base64url characters, the last one only carries 4 bits,
+// so every valid id maps 1:1 onto a 64-bit key.
+using VideoKey = std::uint64_t;
+
+inline constexpr std::size_t k_video_id_length = 11;
+
+// nullopt when the id is not a well formed YouTube id
+std::optional<VideoKey> pack_video_id(std::string_view id);
+
+std::string unpack_video_id(VideoKey key);
+
+inline bool is_youtube_video_id(std::string_view id) {
+  return pack_video_id(id).has_value();
+}
+
+} // namespace policarpo
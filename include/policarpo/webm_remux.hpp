@@ -0,0 +1,18 @@
+#pragma once
+
+#include <filesystem>
+
+namespace policarpo {
+
+enum class RemuxResult {
+  Remuxed,
+  NotOpus,  // a readable file, but the audio would have to be re-encoded
+  Invalid,  // not WebM/Matroska, or damaged
+};
+
+// Copies the Opus track of a WebM/Matroska file into an Ogg Opus file
+// without touching the audio. Granule positions are rebuilt from the packet
+// durations, DiscardPadding on the last block becomes end trimming.
+RemuxResult remux_webm_to_ogg(const std::filesystem::path& input, const std::filesystem::path& output);
+
+} // namespace policarpo
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace policarpo {
+
+// What a YouTube link points at. Either field may be empty, not both.
+struct YoutubeUrl {
+  std::string video_id;
+  std::string playlist_id; // list= parameter
+};
+
+// Understands watch?v= (in any parameter position), youtu.be/<id>,
+// /shorts/, /embed/, /v/, /live/ and /playlist on youtube.com, www., m.,
+// music. and youtube-nocookie.com. nullopt for anything else.
+std::optional<YoutubeUrl> parse_youtube_url(std::string_view url);
+
+// The one URL we hand to yt-dlp for an id, so every link shape downloads the same thing
+std::string youtube_watch_url(std::string_view id);
+
+} // namespace policarpo
@@ -8,10 +8,12 @@
 
 namespace waldo {
   using HandlerFn = std::function<void(Context&)>;
+  using AutocompleteFn = std::function<void(AutocompleteContext&)>;
 
   struct CommandDef {
     dpp::slashcommand spec;
     HandlerFn handler;
+    AutocompleteFn autocomplete{}; // for options with set_auto_complete(true)
   };
 
   class CommandRegistry {
@@ -19,6 +21,7 @@ namespace waldo {
     void add(CommandDef def) {
       std::string name = def.spec.name;
       handlers_[name] = std::move(def.handler);
+      if (def.autocomplete) autocomplete_handlers_[name] = std::move(def.autocomplete);
       defs_.push_back(std::move(def));
     }
 
@@ -50,8 +53,18 @@ namespace waldo {
       it->second(ctx);
     }
 
+    void dispatch_autocomplete(const dpp::autocomplete_t& event, Services& services) const {
+      auto it = autocomplete_handlers_.find(event.name);
+      if (it == autocomplete_handlers_.end()) {
+        return;
+      }
+      AutocompleteContext ctx{event, services};
+      it->second(ctx);
+    }
+
    private:
     std::unordered_map<std::string, HandlerFn> handlers_;
+    std::unordered_map<std::string, AutocompleteFn> autocomplete_handlers_;
     std::vector<CommandDef> defs_;
   };
 }
@@ -8,4 +8,9 @@ namespace waldo {
     const dpp::slashcommand_t& event;
     Services& services;
   };
+
+  struct AutocompleteContext {
+    const dpp::autocomplete_t& event;
+    Services& services;
+  };
 }
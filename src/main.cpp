@@ -1,12 +1,23 @@
 #include <dpp/dpp.h>
 #include "dotenv.hpp"
+#include <cstdlib>
 #include <filesystem>
 #include "waldo/services.hpp"
 #include "waldo/command_registry.hpp"
 #include "waldo/modules/music_module.hpp"
+#include "policarpo/bitrate_tiers.hpp"
 #include "policarpo/track_index.hpp"
+#include "policarpo/library.hpp"
+#include "policarpo/loudness.hpp"
+#include "policarpo/query_cache.hpp"
+#include "policarpo/title_search.hpp"
 #include "policarpo/manager.hpp"
+#include "policarpo/page_cache.hpp"
 #include "policarpo/song_manager.hpp"
+#include "policarpo/speculation.hpp"
+#include "policarpo/track_metadata.hpp"
+#include "policarpo/track_verifier.hpp"
+#include "policarpo/transcoder.hpp"
 
 int main() {
   DotenvError result = Dotenv::load(".env");
@@ -16,6 +27,8 @@ int main() {
   }
 
   policarpo::track_cache_init();
+  policarpo::query_cache_init();
+  policarpo::title_search_init();
 
   const std::string token = Dotenv::get("BOT_TOKEN");
 
@@ -32,6 +45,54 @@ int main() {
 
   std::filesystem::create_directory("songs");
 
+  // Prefetch what people are typing into /play, costs bandwidth on guesses
+  if (Dotenv::get("SPECULATIVE_DOWNLOADS") == "1") {
+    policarpo::speculation_enable();
+  }
+
+  // Ingest encoding. Unset or invalid values keep the defaults.
+  auto env_int = [](const char* name, int fallback) {
+    const std::string value = Dotenv::get(name);
+    char* end = nullptr;
+    long parsed = std::strtol(value.c_str(), &end, 10);
+    return value.empty() || *end != '\0' || parsed < 0 ? fallback : static_cast<int>(parsed);
+  };
+  policarpo::TranscodeSettings transcode;
+  transcode.bitrate = env_int("OPUS_BITRATE", transcode.bitrate);
+  transcode.complexity = env_int("OPUS_COMPLEXITY", transcode.complexity);
+  transcode.workers = static_cast<std::size_t>(env_int("TRANSCODE_WORKERS", 0));
+  policarpo::transcoder_configure(transcode);
+
+  // OPUS_BITRATE is also the most a download is stored at, less when our
+  // voice channels carry less
+  policarpo::BitrateSettings bitrates;
+  bitrates.storage_max = transcode.bitrate;
+  bitrates.low_tier = env_int("LOW_TIER_BITRATE", 0);
+  policarpo::bitrate_configure(bitrates);
+
+  // Stored files are checked page by page once the library scan is done
+  policarpo::VerifySettings verify;
+  verify.read_mbps = env_int("VERIFY_READ_MBPS", verify.read_mbps);
+  policarpo::track_verifier_configure(verify);
+
+  // Upcoming queue entries are read into the page cache ahead of time,
+  // played tracks leave it unless someone plays them again soon
+  policarpo::PageCacheSettings page_cache;
+  page_cache.prefetch_tracks = static_cast<std::size_t>(env_int("PREFETCH_TRACKS", static_cast<int>(page_cache.prefetch_tracks)));
+  page_cache.drop_behind = Dotenv::get("DROP_PLAYED_PAGES") != "0";
+  policarpo::page_cache_configure(page_cache);
+  policarpo::library_init();
+
+  // Playback loudness in LUFS, "-14" and "14" mean the same, 0 turns it off
+  if (const std::string target = Dotenv::get("LOUDNESS_TARGET"); !target.empty()) {
+    policarpo::loudness_configure(-std::abs(std::atoi(target.c_str())));
+  }
+
+  // Canned track info for running the pre-download checks offline
+  if (const std::string fixture = Dotenv::get("METADATA_FIXTURE"); !fixture.empty()) {
+    policarpo::track_metadata_use_fixture(fixture);
+  }
+
   waldo::CommandRegistry reg;
   waldo::modules::register_music(reg);
   bool dev_mode;
@@ -63,6 +124,10 @@ int main() {
     reg.dispatch(/*bot,*/ event, services);
   });
 
+  bot.on_autocomplete([&](const dpp::autocomplete_t& event) {
+    reg.dispatch_autocomplete(event, services);
+  });
+
   bot.on_voice_track_marker([&](const dpp::voice_track_marker_t& event) {
     // ev.voice_client is the voice client that crossed a marker
     services.dj->on_voice_track_marker(event);
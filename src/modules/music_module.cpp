@@ -1,7 +1,10 @@
 #include "waldo/modules/music_module.hpp"
 #include "waldo/command_registry.hpp"
 #include "policarpo/voice_session.hpp"
+#include "policarpo/guild_settings.hpp"
 #include "policarpo/manager.hpp"
+#include "policarpo/speculation.hpp"
+#include "policarpo/suggestions.hpp"
 
 // /play query:string
 void waldo::modules::register_music(waldo::CommandRegistry& reg) {
@@ -21,7 +24,7 @@ void waldo::modules::register_music(waldo::CommandRegistry& reg) {
   dpp::slashcommand play;
   play.set_name("play")
       .set_description("Pone una rola")
-      .add_option(dpp::command_option(dpp::co_string, "query", "Nombre de la canción o URL", false));
+      .add_option(dpp::command_option(dpp::co_string, "query", "Nombre de la canción o URL", false).set_auto_complete(true));
 
   reg.add({
     play,
@@ -32,8 +35,28 @@ void waldo::modules::register_music(waldo::CommandRegistry& reg) {
       if (std::holds_alternative<std::string>(value)) {
         query = std::get<std::string>(value);
       } 
+      policarpo::speculation_submitted(guild_id, ctx.event.command.usr.id, query);
+      policarpo::suggestions_record(guild_id, query);
       // delegate to Policarpo
       ctx.services.dj->play(guild_id, std::move(query), ctx.event);
+    },
+    [](waldo::AutocompleteContext& ctx) {
+      std::string typed;
+      for (const auto& opt : ctx.event.options) {
+        if (opt.focused && std::holds_alternative<std::string>(opt.value)) {
+          typed = std::get<std::string>(opt.value);
+        }
+      }
+
+      // Answered inline from memory, Discord drops it after 3 seconds
+      auto suggestions = policarpo::suggest_tracks(ctx.event.command.guild_id, typed, 25);
+      dpp::interaction_response response(dpp::ir_autocomplete_reply);
+      for (const auto& suggestion : suggestions) {
+        response.add_autocomplete_choice(dpp::command_option_choice(suggestion.label, suggestion.value));
+      }
+      ctx.event.owner->interaction_response_create(ctx.event.command.id, ctx.event.command.token, response);
+
+      policarpo::speculation_typing(ctx.event.command.guild_id, ctx.event.command.usr.id, typed, suggestions);
     }
   });
 
@@ -153,4 +176,91 @@ void waldo::modules::register_music(waldo::CommandRegistry& reg) {
       ctx.services.dj->set_loop_mode(guild_id, mode, ctx.event);
     }
   });
+
+  // volume
+  dpp::slashcommand volume;
+  volume.set_name("volume")
+      .set_description("Muestra o cambia el volumen del servidor.")
+      .add_option(dpp::command_option(dpp::co_integer, "percent", "Volumen en porcentaje (0-200)", false)
+        .set_min_value(0)
+        .set_max_value(policarpo::k_max_volume_percent)
+      );
+
+  reg.add({
+    volume,
+    [](waldo::Context& ctx) {
+      auto guild_id = ctx.event.command.guild_id;
+      auto value = ctx.event.get_parameter("percent");
+      std::optional<int> percent;
+      if (std::holds_alternative<int64_t>(value)) {
+        percent = static_cast<int>(std::get<int64_t>(value));
+      }
+      ctx.services.dj->set_volume(guild_id, percent, ctx.event);
+    }
+  });
+
+  // eq
+  dpp::slashcommand eq;
+  eq.set_name("eq")
+      .set_description("Muestra o cambia el ecualizador del servidor (dB).");
+  for (const auto& [name, description] : {std::pair{"bass", "Graves"}, std::pair{"mid", "Medios"}, std::pair{"treble", "Agudos"}}) {
+    eq.add_option(dpp::command_option(dpp::co_integer, name, description, false)
+      .set_min_value(-policarpo::k_max_eq_db)
+      .set_max_value(policarpo::k_max_eq_db)
+    );
+  }
+
+  reg.add({
+    eq,
+    [](waldo::Context& ctx) {
+      auto guild_id = ctx.event.command.guild_id;
+      auto band = [&](const char* name) -> std::optional<int> {
+        auto value = ctx.event.get_parameter(name);
+        if (!std::holds_alternative<int64_t>(value)) return std::nullopt;
+        return static_cast<int>(std::get<int64_t>(value));
+      };
+      ctx.services.dj->set_eq(guild_id, band("bass"), band("mid"), band("treble"), ctx.event);
+    }
+  });
+
+  // trim
+  dpp::slashcommand trim;
+  trim.set_name("trim")
+      .set_description("Salta los silencios al inicio y al final de las canciones.")
+      .add_option(dpp::command_option(dpp::co_boolean, "enabled", "Activar o desactivar", false));
+
+  reg.add({
+    trim,
+    [](waldo::Context& ctx) {
+      auto guild_id = ctx.event.command.guild_id;
+      auto value = ctx.event.get_parameter("enabled");
+      std::optional<bool> enabled;
+      if (std::holds_alternative<bool>(value)) {
+        enabled = std::get<bool>(value);
+      }
+      ctx.services.dj->set_trim(guild_id, enabled, ctx.event);
+    }
+  });
+
+  // crossfade
+  dpp::slashcommand crossfade;
+  crossfade.set_name("crossfade")
+      .set_description("Mezcla el final de cada canción con el inicio de la siguiente.")
+      .add_option(dpp::command_option(dpp::co_integer, "seconds", "Segundos de mezcla (0 lo desactiva)", false)
+        .set_min_value(0)
+        .set_max_value(policarpo::k_max_crossfade_seconds)
+      );
+
+  reg.add({
+    crossfade,
+    [](waldo::Context& ctx) {
+      auto guild_id = ctx.event.command.guild_id;
+      auto value = ctx.event.get_parameter("seconds");
+      std::optional<int> seconds;
+      if (std::holds_alternative<int64_t>(value)) {
+        seconds = static_cast<int>(std::get<int64_t>(value));
+      }
+      ctx.services.dj->set_crossfade(guild_id, seconds, ctx.event);
+    }
+  });
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "policarpo/bitrate_tiers.hpp"
+#include "policarpo/track_storage.hpp"
+#include "policarpo/transcoder.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace policarpo {
+
+namespace {
+  DerivativeBuilder g_builder;
+
+  std::atomic<int> g_storage_max{128000};
+  std::atomic<int> g_low_tier{0};
+  std::atomic<int> g_channel_max{0}; // highest channel bitrate seen, 0 none yet
+
+  // Lowest bitrate Discord lets a voice channel have
+  constexpr int k_min_bitrate = 8000;
+}
+
+void bitrate_configure(const BitrateSettings& settings) {
+  const int storage_max = std::clamp(settings.storage_max, k_min_bitrate, 510000);
+  g_storage_max = storage_max;
+  g_low_tier = settings.low_tier > 0 ? std::clamp(settings.low_tier, k_min_bitrate, storage_max) : 0;
+}
+
+void bitrate_observe_channel(int bitrate) {
+  int seen = g_channel_max.load(std::memory_order_relaxed);
+  while (bitrate > seen && !g_channel_max.compare_exchange_weak(seen, bitrate, std::memory_order_relaxed)) {}
+  if (bitrate > seen) {
+    std::cout << "[Bitrate] Highest voice channel is now " << bitrate / 1000 << " kbps, storing at "
+              << storage_bitrate() / 1000 << " kbps\n";
+  }
+}
+
+int storage_bitrate() {
+  const int storage_max = g_storage_max.load(std::memory_order_relaxed);
+  const int channel_max = g_channel_max.load(std::memory_order_relaxed);
+  return channel_max > 0 ? std::clamp(channel_max, k_min_bitrate, storage_max) : storage_max;
+}
+
+std::string storage_format_selector() {
+  // YouTube's Opus streams sit around 50, 70 and 130-160 kbps and abr is
+  // approximate, hence the 10% of slack
+  const int kbps = storage_bitrate() * 9 / 10000;
+  return "worstaudio[acodec=opus][abr>=" + std::to_string(kbps) + "]/bestaudio[acodec=opus]/bestaudio";
+}
+
+std::filesystem::path playback_path(std::string_view id, std::chrono::milliseconds duration, int channel_bitrate) {
+  std::filesystem::path stored = track_path(id);
+  const int low_tier = g_low_tier.load(std::memory_order_relaxed);
+  if (low_tier == 0 || channel_bitrate <= 0 || channel_bitrate > low_tier || duration.count() <= 0) return stored;
+
+  // Not worth a copy when the stored file is already close to the tier
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(stored, ec);
+  if (ec) return stored;
+  const auto stored_bitrate = static_cast<long long>(size) * 8000 / duration.count();
+  if (stored_bitrate <= static_cast<long long>(low_tier) * 5 / 4) return stored;
+
+  std::filesystem::path derived = track_derived_path(id, low_tier);
+  if (std::filesystem::exists(derived, ec)) return derived;
+  g_builder.submit(std::string(id), low_tier);
+  return stored;
+}
+
+DerivativeBuilder::~DerivativeBuilder() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_worker.joinable()) m_worker.join();
+}
+
+void DerivativeBuilder::submit(const std::string& id, int bitrate) {
+  std::lock_guard lk(m_mu);
+  if (m_queued.contains(id)) return;
+  m_queued.insert_or_assign(id, true);
+  m_jobs.push_back(Job{id, bitrate});
+
+  if (!m_worker.joinable()) m_worker = std::thread([this] { worker_loop(); });
+  m_cv.notify_one();
+}
+
+void DerivativeBuilder::worker_loop() {
+  // The encode itself runs on the transcode pool, this only waits on it
+  setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), 10);
+
+  while (true) {
+    Job job;
+    {
+      std::unique_lock lk(m_mu);
+      m_cv.wait(lk, [&] { return m_stop || !m_jobs.empty(); });
+      if (m_stop) return;
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    build(job);
+
+    std::lock_guard lk(m_mu);
+    m_queued.erase(job.id);
+  }
+}
+
+void DerivativeBuilder::build(const Job& job) {
+  const std::filesystem::path source = track_path(job.id);
+  const std::filesystem::path target = track_derived_path(job.id, job.bitrate);
+  std::filesystem::path partial = target;
+  partial += ".part";
+
+  std::error_code ec;
+  if (std::filesystem::exists(target, ec)) return;
+  std::filesystem::create_directories(target.parent_path(), ec);
+
+  // Same 20 ms layout as ingest writes, seeking and crossfades work on it
+  if (!transcode_to_opus(source, partial, job.bitrate)) {
+    std::cerr << "[Bitrate] Warning: could not make the " << job.bitrate / 1000 << " kbps copy of " << job.id << "\n";
+    std::filesystem::remove(partial, ec);
+    return;
+  }
+  std::filesystem::rename(partial, target, ec);
+  if (ec) {
+    std::cerr << "[Bitrate] Error moving " << target << " into place: " << ec.message() << "\n";
+    std::filesystem::remove(partial, ec);
+    return;
+  }
+  std::cout << "[Bitrate] " << job.id << ": " << std::filesystem::file_size(source, ec) / 1024 << " KiB stored, "
+            << std::filesystem::file_size(target, ec) / 1024 << " KiB at " << job.bitrate / 1000 << " kbps\n";
+}
+
+} // namespace policarpo
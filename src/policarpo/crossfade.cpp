@@ -0,0 +1,207 @@
+#include "policarpo/crossfade.hpp"
+#include "policarpo/ogg_reader.hpp"
+#include "policarpo/opus_normalizer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <opus/opus.h>
+
+namespace policarpo {
+
+namespace {
+  typedef float v4f __attribute__((vector_size(16)));
+
+  constexpr int k_channels = 2;
+  constexpr int k_max_frame_samples = 5760; // 120 ms, the longest Opus packet
+  constexpr int k_max_packet_bytes = 4000;
+  constexpr std::uint32_t k_warm_up_packets = 4;
+
+  // Same footing as DspChain, this runs on the playback thread
+  constexpr int k_playback_complexity = 5;
+
+  v4f load(const float* p) {
+    v4f v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  void store(float* p, v4f v) {
+    std::memcpy(p, &v, sizeof(v));
+  }
+
+  // sin(t * pi / 2) to within 3%, and g(t)^2 + g(1 - t)^2 stays within
+  // 0.5 dB of 1 across the fade
+  float fade_in(float t) {
+    return t * (1.5f - 0.5f * t * t);
+  }
+
+  double thread_cpu_seconds() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+  }
+}
+
+void crossfade_mix(const float* tail, const float* head, float* dst, std::size_t frames,
+                   std::size_t start, std::size_t total, float tail_gain, float head_gain) {
+  if (total == 0) return;
+  const float step = 1.0f / static_cast<float>(total);
+  const v4f one{1.0f, 1.0f, 1.0f, 1.0f};
+  const v4f lane{0.0f, 0.0f, 1.0f, 1.0f}; // two stereo frames per vector
+
+  std::size_t i = 0;
+  for (; i + 2 <= frames; i += 2) {
+    const v4f t = (static_cast<float>(start + i) + lane) * step;
+    const v4f r = one - t;
+    const v4f in = t * (1.5f - 0.5f * t * t) * head_gain;
+    const v4f out = r * (1.5f - 0.5f * r * r) * tail_gain;
+    v4f mixed = load(tail + 2 * i) * out + load(head + 2 * i) * in;
+    mixed = mixed > one ? one : mixed;
+    mixed = mixed < -one ? -one : mixed;
+    store(dst + 2 * i, mixed);
+  }
+  for (; i < frames; ++i) {
+    const float t = static_cast<float>(start + i) * step;
+    const float in = fade_in(t) * head_gain;
+    const float out = fade_in(1.0f - t) * tail_gain;
+    for (std::size_t c = 0; c < 2; ++c) {
+      dst[2 * i + c] = std::clamp(tail[2 * i + c] * out + head[2 * i + c] * in, -1.0f, 1.0f);
+    }
+  }
+}
+
+std::unique_ptr<Crossfade> Crossfade::create(int bitrate) {
+  std::unique_ptr<Crossfade> fade(new Crossfade());
+
+  int error = OPUS_OK;
+  fade->m_tail_decoder = opus_decoder_create(48000, k_channels, &error);
+  if (error == OPUS_OK) fade->m_head_decoder = opus_decoder_create(48000, k_channels, &error);
+  if (error != OPUS_OK) {
+    std::cerr << "[Crossfade] Error creating decoder: " << opus_strerror(error) << "\n";
+    return nullptr;
+  }
+  fade->m_encoder = opus_encoder_create(48000, k_channels, OPUS_APPLICATION_AUDIO, &error);
+  if (error != OPUS_OK) {
+    std::cerr << "[Crossfade] Error creating encoder: " << opus_strerror(error) << "\n";
+    return nullptr;
+  }
+  opus_encoder_ctl(fade->m_encoder, OPUS_SET_BITRATE(bitrate));
+  opus_encoder_ctl(fade->m_encoder, OPUS_SET_COMPLEXITY(k_playback_complexity));
+  opus_encoder_ctl(fade->m_encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+  fade->m_scratch.resize(k_max_frame_samples * k_channels);
+  return fade;
+}
+
+Crossfade::~Crossfade() {
+  if (m_tail_decoder) opus_decoder_destroy(m_tail_decoder);
+  if (m_head_decoder) opus_decoder_destroy(m_head_decoder);
+  if (m_encoder) opus_encoder_destroy(m_encoder);
+}
+
+void Crossfade::decode(OpusDecoder* decoder, const unsigned char* packet, int size, std::vector<float>& out) {
+  const double started = thread_cpu_seconds();
+  // A packet that doesn't decode becomes 20 ms of silence, the overlap
+  // has to stay packet aligned
+  int frames = opus_decode_float(decoder, packet, size, m_scratch.data(), k_max_frame_samples, 0);
+  if (frames <= 0) {
+    frames = k_frame_samples;
+    std::fill_n(m_scratch.begin(), frames * k_channels, 0.0f);
+  }
+  out.insert(out.end(), m_scratch.begin(), m_scratch.begin() + frames * k_channels);
+  m_decode_cpu += thread_cpu_seconds() - started;
+}
+
+void Crossfade::warm_up_tail(const unsigned char* packet, int size) {
+  m_before.clear();
+  decode(m_tail_decoder, packet, size, m_before);
+}
+
+void Crossfade::warm_up_head(const unsigned char* packet, int size) {
+  const double started = thread_cpu_seconds();
+  opus_decode_float(m_head_decoder, packet, size, m_scratch.data(), k_max_frame_samples, 0);
+  m_decode_cpu += thread_cpu_seconds() - started;
+}
+
+void Crossfade::add_tail(const unsigned char* packet, int size) {
+  decode(m_tail_decoder, packet, size, m_tail);
+}
+
+void Crossfade::add_head(const unsigned char* packet, int size) {
+  decode(m_head_decoder, packet, size, m_head);
+}
+
+std::vector<std::vector<unsigned char>> Crossfade::finish(float tail_gain, float head_gain, const DspSettings& eq) {
+  const std::size_t packets = std::min(tail_frames(), head_frames()) / k_frame_samples;
+  if (packets == 0) return {};
+  const std::size_t frames = packets * k_frame_samples;
+
+  // The encoder delays its output by its lookahead. Feeding it the end of
+  // the packet before the overlap first, and one packet more than is
+  // kept, makes every kept packet cover exactly one stored packet.
+  opus_int32 lookahead = 0;
+  opus_encoder_ctl(m_encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+  const std::size_t lead = static_cast<std::size_t>(k_frame_samples - std::clamp(lookahead, 0, k_frame_samples - 1));
+
+  const double mix_started = thread_cpu_seconds();
+  std::vector<float> pcm((frames + k_frame_samples) * k_channels, 0.0f);
+  if (m_before.size() >= lead * k_channels) {
+    const float* before = m_before.data() + m_before.size() - lead * k_channels;
+    for (std::size_t i = 0; i < lead * k_channels; ++i) pcm[i] = before[i] * tail_gain;
+  }
+  float* overlap = pcm.data() + lead * k_channels;
+  crossfade_mix(m_tail.data(), m_head.data(), overlap, frames, 0, frames, tail_gain, head_gain);
+
+  // Volume is already in the gains, only the bands are left
+  Equalizer equalizer;
+  DspSettings bands = eq;
+  bands.gain = 1.0f;
+  if (equalizer_configure(equalizer, bands)) equalizer.process(pcm.data(), lead + frames);
+  const double mix_cpu = thread_cpu_seconds() - mix_started;
+
+  const double encode_started = thread_cpu_seconds();
+  std::vector<std::vector<unsigned char>> encoded;
+  encoded.reserve(packets);
+  for (std::size_t p = 0; p <= packets; ++p) {
+    std::vector<unsigned char> out(k_max_packet_bytes);
+    const opus_int32 bytes = opus_encode_float(m_encoder, pcm.data() + p * k_frame_samples * k_channels,
+                                               k_frame_samples, out.data(), static_cast<opus_int32>(out.size()));
+    if (bytes <= 0) {
+      std::cerr << "[Crossfade] Error encoding: " << opus_strerror(bytes) << "\n";
+      return {};
+    }
+    // The first one is mostly the primer, already sent as stored
+    if (p == 0) continue;
+    out.resize(static_cast<std::size_t>(bytes));
+    encoded.push_back(std::move(out));
+  }
+  const double encode_cpu = thread_cpu_seconds() - encode_started;
+
+  std::cout << "[Crossfade] " << static_cast<double>(frames) / 48000.0 << " s overlap, CPU: decode "
+            << m_decode_cpu * 1000.0 << " ms, mix " << mix_cpu * 1000.0 << " ms, encode "
+            << encode_cpu * 1000.0 << " ms\n";
+  return encoded;
+}
+
+bool crossfade_load_head(Crossfade& fade, const std::filesystem::path& file, std::uint32_t first_packet, std::uint32_t count) {
+  OggOpusReader reader;
+  if (!reader.open(file)) return false;
+  const auto& comments = reader.comments();
+  if (std::find(comments.begin(), comments.end(), k_layout_tag) == comments.end()) return false;
+
+  const std::uint32_t warm_up = first_packet - std::min(first_packet, k_warm_up_packets);
+  std::vector<unsigned char> packet;
+  std::int64_t granule = -1;
+  for (std::uint32_t index = 0; index < first_packet + count; ++index) {
+    if (!reader.next(packet, granule)) return false;
+    if (index < warm_up) continue;
+    if (index < first_packet) {
+      fade.warm_up_head(packet.data(), static_cast<int>(packet.size()));
+    } else {
+      fade.add_head(packet.data(), static_cast<int>(packet.size()));
+    }
+  }
+  return true;
+}
+
+} // namespace policarpo
@@ -0,0 +1,136 @@
+#include "policarpo/download_scheduler.hpp"
+#include "policarpo/song_manager.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace policarpo {
+
+namespace {
+  // yt-dlp is mostly waiting on the network, a few at once is fine
+  DownloadScheduler g_downloads{3};
+}
+
+DownloadResult download_track(const std::string& id, DownloadPriority priority, std::string title) {
+  return g_downloads.submit(id, priority, std::move(title));
+}
+
+bool download_cancel_speculative(const std::string& id) {
+  return g_downloads.cancel_speculative(id);
+}
+
+bool download_in_flight(const std::string& id) {
+  return g_downloads.in_flight(id);
+}
+
+DownloadScheduler::DownloadScheduler(std::size_t workers)
+  : m_worker_count(std::max<std::size_t>(workers, 2)) {}
+
+DownloadScheduler::~DownloadScheduler() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto& worker : m_workers) worker.join();
+}
+
+void DownloadScheduler::start_locked() {
+  // Lazily, so nothing is spawned during static initialisation
+  if (!m_workers.empty()) return;
+  for (std::size_t i = 0; i < m_worker_count; ++i) {
+    m_workers.emplace_back([this] { worker_loop(); });
+  }
+}
+
+DownloadResult DownloadScheduler::submit(const std::string& id, DownloadPriority priority, std::string title) {
+  std::lock_guard lk(m_mu);
+  start_locked();
+
+  if (std::shared_ptr<Job>* existing = m_jobs.find(id)) {
+    Job& job = **existing;
+    if (priority > job.priority && !job.running) job.priority = priority;
+    if (job.title.empty()) job.title = std::move(title);
+    return job.result;
+  }
+
+  auto job = std::make_shared<Job>();
+  job->id = id;
+  job->title = std::move(title);
+  job->priority = priority;
+  job->seq = m_next_seq++;
+  job->result = job->promise.get_future().share();
+  m_jobs.insert_or_assign(id, job);
+
+  m_cv.notify_one();
+  return job->result;
+}
+
+bool DownloadScheduler::cancel_speculative(const std::string& id) {
+  std::shared_ptr<Job> job;
+  {
+    std::lock_guard lk(m_mu);
+    std::shared_ptr<Job>* found = m_jobs.find(id);
+    if (!found || (*found)->running || (*found)->priority != DownloadPriority::Speculative) return false;
+    job = *found;
+    m_jobs.erase(id);
+  }
+  job->promise.set_value(std::nullopt);
+  std::cout << "[Downloads] Cancelled speculative download of " << id << "\n";
+  return true;
+}
+
+bool DownloadScheduler::in_flight(const std::string& id) const {
+  std::lock_guard lk(m_mu);
+  return m_jobs.contains(id);
+}
+
+std::shared_ptr<DownloadScheduler::Job> DownloadScheduler::next_job_locked() {
+  // Speculation may use every worker but one
+  const bool speculative_allowed = m_running_speculative + 1 < m_worker_count;
+
+  std::shared_ptr<Job> best;
+  m_jobs.for_each([&](const std::string&, const std::shared_ptr<Job>& job) {
+    if (job->running) return;
+    if (job->priority == DownloadPriority::Speculative && !speculative_allowed) return;
+    if (!best || job->priority > best->priority || (job->priority == best->priority && job->seq < best->seq)) {
+      best = job;
+    }
+  });
+  return best;
+}
+
+void DownloadScheduler::worker_loop() {
+  while (true) {
+    std::shared_ptr<Job> job;
+    bool speculative = false;
+    {
+      std::unique_lock lk(m_mu);
+      m_cv.wait(lk, [&] { return m_stop || (job = next_job_locked()) != nullptr; });
+      if (m_stop) return;
+
+      job->running = true;
+      speculative = job->priority == DownloadPriority::Speculative;
+      if (speculative) ++m_running_speculative;
+    }
+
+    // Waiters take nullopt as a failed download, an exception would need
+    // handling at every get()
+    std::optional<TrackHandle> track;
+    try {
+      track = fetch_track(job->id, job->title);
+    } catch (const std::exception& e) {
+      std::cerr << "[Downloads] Error downloading " << job->id << ": " << e.what() << "\n";
+    }
+
+    {
+      std::lock_guard lk(m_mu);
+      m_jobs.erase(job->id);
+      if (speculative) --m_running_speculative;
+    }
+    // A speculative slot may have freed up for someone waiting
+    m_cv.notify_all();
+    job->promise.set_value(track);
+  }
+}
+
+} // namespace policarpo
@@ -0,0 +1,229 @@
+#include "policarpo/dsp.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define POLICARPO_DSP_X86 1
+#elif defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define POLICARPO_DSP_NEON 1
+#endif
+
+namespace policarpo {
+
+namespace {
+  constexpr float k_rate = 48000.0f;
+
+  using Kernel = void (*)(Equalizer::Lanes&, float*, std::size_t);
+
+  // Reference version, also what non x86/ARM builds run
+  void process_scalar(Equalizer::Lanes& l, float* samples, std::size_t frames) {
+    float x[8];
+    for (std::size_t t = 0; t < frames; ++t) {
+      float* io = samples + 2 * t;
+      x[0] = io[0];
+      x[1] = io[1];
+      for (int i = 2; i < 8; ++i) x[i] = l.y[i - 2];
+
+      for (int i = 0; i < 8; ++i) {
+        const float y = l.b0[i] * x[i] + l.z1[i];
+        l.z1[i] = l.b1[i] * x[i] - l.a1[i] * y + l.z2[i];
+        l.z2[i] = l.b2[i] * x[i] - l.a2[i] * y;
+        l.y[i] = y;
+      }
+      io[0] = std::clamp(l.y[6], -1.0f, 1.0f);
+      io[1] = std::clamp(l.y[7], -1.0f, 1.0f);
+    }
+  }
+
+#if defined(POLICARPO_DSP_X86)
+  __attribute__((target("sse2")))
+  void process_sse2(Equalizer::Lanes& l, float* samples, std::size_t frames) {
+    const __m128 b0_lo = _mm_load_ps(l.b0), b0_hi = _mm_load_ps(l.b0 + 4);
+    const __m128 b1_lo = _mm_load_ps(l.b1), b1_hi = _mm_load_ps(l.b1 + 4);
+    const __m128 b2_lo = _mm_load_ps(l.b2), b2_hi = _mm_load_ps(l.b2 + 4);
+    const __m128 a1_lo = _mm_load_ps(l.a1), a1_hi = _mm_load_ps(l.a1 + 4);
+    const __m128 a2_lo = _mm_load_ps(l.a2), a2_hi = _mm_load_ps(l.a2 + 4);
+    __m128 z1_lo = _mm_load_ps(l.z1), z1_hi = _mm_load_ps(l.z1 + 4);
+    __m128 z2_lo = _mm_load_ps(l.z2), z2_hi = _mm_load_ps(l.z2 + 4);
+    __m128 y_lo = _mm_load_ps(l.y), y_hi = _mm_load_ps(l.y + 4);
+    const __m128 lo_limit = _mm_set1_ps(-1.0f), hi_limit = _mm_set1_ps(1.0f);
+
+    for (std::size_t t = 0; t < frames; ++t) {
+      double* io = reinterpret_cast<double*>(samples + 2 * t);
+      // [in L, in R, y0 L, y0 R] and [y1 L, y1 R, y2 L, y2 R]
+      const __m128 in = _mm_castpd_ps(_mm_load_sd(io));
+      const __m128 x_lo = _mm_movelh_ps(in, y_lo);
+      const __m128 x_hi = _mm_shuffle_ps(y_lo, y_hi, _MM_SHUFFLE(1, 0, 3, 2));
+
+      y_lo = _mm_add_ps(_mm_mul_ps(b0_lo, x_lo), z1_lo);
+      y_hi = _mm_add_ps(_mm_mul_ps(b0_hi, x_hi), z1_hi);
+      z1_lo = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1_lo, x_lo), _mm_mul_ps(a1_lo, y_lo)), z2_lo);
+      z1_hi = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1_hi, x_hi), _mm_mul_ps(a1_hi, y_hi)), z2_hi);
+      z2_lo = _mm_sub_ps(_mm_mul_ps(b2_lo, x_lo), _mm_mul_ps(a2_lo, y_lo));
+      z2_hi = _mm_sub_ps(_mm_mul_ps(b2_hi, x_hi), _mm_mul_ps(a2_hi, y_hi));
+
+      const __m128 out = _mm_min_ps(_mm_max_ps(y_hi, lo_limit), hi_limit);
+      _mm_storeh_pd(io, _mm_castps_pd(out));
+    }
+
+    _mm_store_ps(l.z1, z1_lo); _mm_store_ps(l.z1 + 4, z1_hi);
+    _mm_store_ps(l.z2, z2_lo); _mm_store_ps(l.z2 + 4, z2_hi);
+    _mm_store_ps(l.y, y_lo); _mm_store_ps(l.y + 4, y_hi);
+  }
+
+  __attribute__((target("avx2,fma")))
+  void process_avx2(Equalizer::Lanes& l, float* samples, std::size_t frames) {
+    const __m256 b0 = _mm256_load_ps(l.b0), b1 = _mm256_load_ps(l.b1), b2 = _mm256_load_ps(l.b2);
+    const __m256 a1 = _mm256_load_ps(l.a1), a2 = _mm256_load_ps(l.a2);
+    __m256 z1 = _mm256_load_ps(l.z1), z2 = _mm256_load_ps(l.z2), y = _mm256_load_ps(l.y);
+    const __m256i shift = _mm256_setr_epi32(0, 1, 0, 1, 2, 3, 4, 5);
+    const __m128 lo_limit = _mm_set1_ps(-1.0f), hi_limit = _mm_set1_ps(1.0f);
+
+    for (std::size_t t = 0; t < frames; ++t) {
+      double* io = reinterpret_cast<double*>(samples + 2 * t);
+      // Every band moves up one lane pair, the new sample enters at the bottom
+      const __m256 in = _mm256_castpd_ps(_mm256_broadcast_sd(io));
+      const __m256 x = _mm256_blend_ps(_mm256_permutevar8x32_ps(y, shift), in, 0b00000011);
+
+      y = _mm256_fmadd_ps(b0, x, z1);
+      z1 = _mm256_add_ps(_mm256_fnmadd_ps(a1, y, _mm256_mul_ps(b1, x)), z2);
+      z2 = _mm256_fnmadd_ps(a2, y, _mm256_mul_ps(b2, x));
+
+      const __m128 out = _mm_min_ps(_mm_max_ps(_mm256_extractf128_ps(y, 1), lo_limit), hi_limit);
+      _mm_storeh_pd(io, _mm_castps_pd(out));
+    }
+
+    _mm256_store_ps(l.z1, z1);
+    _mm256_store_ps(l.z2, z2);
+    _mm256_store_ps(l.y, y);
+  }
+#elif defined(POLICARPO_DSP_NEON)
+  void process_neon(Equalizer::Lanes& l, float* samples, std::size_t frames) {
+    const float32x4_t b0_lo = vld1q_f32(l.b0), b0_hi = vld1q_f32(l.b0 + 4);
+    const float32x4_t b1_lo = vld1q_f32(l.b1), b1_hi = vld1q_f32(l.b1 + 4);
+    const float32x4_t b2_lo = vld1q_f32(l.b2), b2_hi = vld1q_f32(l.b2 + 4);
+    const float32x4_t a1_lo = vld1q_f32(l.a1), a1_hi = vld1q_f32(l.a1 + 4);
+    const float32x4_t a2_lo = vld1q_f32(l.a2), a2_hi = vld1q_f32(l.a2 + 4);
+    float32x4_t z1_lo = vld1q_f32(l.z1), z1_hi = vld1q_f32(l.z1 + 4);
+    float32x4_t z2_lo = vld1q_f32(l.z2), z2_hi = vld1q_f32(l.z2 + 4);
+    float32x4_t y_lo = vld1q_f32(l.y), y_hi = vld1q_f32(l.y + 4);
+    const float32x2_t lo_limit = vdup_n_f32(-1.0f), hi_limit = vdup_n_f32(1.0f);
+
+    for (std::size_t t = 0; t < frames; ++t) {
+      float* io = samples + 2 * t;
+      const float32x4_t x_lo = vcombine_f32(vld1_f32(io), vget_low_f32(y_lo));
+      const float32x4_t x_hi = vcombine_f32(vget_high_f32(y_lo), vget_low_f32(y_hi));
+
+      y_lo = vmlaq_f32(z1_lo, b0_lo, x_lo);
+      y_hi = vmlaq_f32(z1_hi, b0_hi, x_hi);
+      z1_lo = vaddq_f32(vmlsq_f32(vmulq_f32(b1_lo, x_lo), a1_lo, y_lo), z2_lo);
+      z1_hi = vaddq_f32(vmlsq_f32(vmulq_f32(b1_hi, x_hi), a1_hi, y_hi), z2_hi);
+      z2_lo = vmlsq_f32(vmulq_f32(b2_lo, x_lo), a2_lo, y_lo);
+      z2_hi = vmlsq_f32(vmulq_f32(b2_hi, x_hi), a2_hi, y_hi);
+
+      vst1_f32(io, vmin_f32(vmax_f32(vget_high_f32(y_hi), lo_limit), hi_limit));
+    }
+
+    vst1q_f32(l.z1, z1_lo); vst1q_f32(l.z1 + 4, z1_hi);
+    vst1q_f32(l.z2, z2_lo); vst1q_f32(l.z2 + 4, z2_hi);
+    vst1q_f32(l.y, y_lo); vst1q_f32(l.y + 4, y_hi);
+  }
+#endif
+
+  struct Dispatch {
+    Kernel kernel;
+    std::string_view name;
+  };
+
+  Dispatch pick_kernel() {
+#if defined(POLICARPO_DSP_X86)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return {process_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return {process_sse2, "sse2"};
+#elif defined(POLICARPO_DSP_NEON)
+    return {process_neon, "neon"};
+#endif
+    return {process_scalar, "scalar"};
+  }
+
+  const Dispatch& dispatch() {
+    static const Dispatch d = pick_kernel();
+    return d;
+  }
+
+  BiquadCoeffs normalize(double b0, double b1, double b2, double a0, double a1, double a2) {
+    return {static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0),
+            static_cast<float>(a1 / a0), static_cast<float>(a2 / a0)};
+  }
+}
+
+BiquadCoeffs biquad_low_shelf(float freq, float gain_db) {
+  const double a = std::pow(10.0, gain_db / 40.0);
+  const double w = 2.0 * std::numbers::pi * freq / k_rate;
+  const double cosw = std::cos(w);
+  const double alpha = std::sin(w) / 2.0 * std::sqrt(2.0); // shelf slope 1
+  const double sq = 2.0 * std::sqrt(a) * alpha;
+  return normalize(a * ((a + 1) - (a - 1) * cosw + sq), 2 * a * ((a - 1) - (a + 1) * cosw), a * ((a + 1) - (a - 1) * cosw - sq),
+                   (a + 1) + (a - 1) * cosw + sq, -2 * ((a - 1) + (a + 1) * cosw), (a + 1) + (a - 1) * cosw - sq);
+}
+
+BiquadCoeffs biquad_peaking(float freq, float q, float gain_db) {
+  const double a = std::pow(10.0, gain_db / 40.0);
+  const double w = 2.0 * std::numbers::pi * freq / k_rate;
+  const double alpha = std::sin(w) / (2.0 * q);
+  const double cosw = std::cos(w);
+  return normalize(1 + alpha * a, -2 * cosw, 1 - alpha * a, 1 + alpha / a, -2 * cosw, 1 - alpha / a);
+}
+
+BiquadCoeffs biquad_high_shelf(float freq, float gain_db) {
+  const double a = std::pow(10.0, gain_db / 40.0);
+  const double w = 2.0 * std::numbers::pi * freq / k_rate;
+  const double cosw = std::cos(w);
+  const double alpha = std::sin(w) / 2.0 * std::sqrt(2.0);
+  const double sq = 2.0 * std::sqrt(a) * alpha;
+  return normalize(a * ((a + 1) + (a - 1) * cosw + sq), -2 * a * ((a - 1) + (a + 1) * cosw), a * ((a + 1) + (a - 1) * cosw - sq),
+                   (a + 1) - (a - 1) * cosw + sq, 2 * ((a - 1) - (a + 1) * cosw), (a + 1) - (a - 1) * cosw - sq);
+}
+
+Equalizer::Equalizer() {
+  set({}, 1.0f);
+}
+
+void Equalizer::set(const std::array<BiquadCoeffs, k_eq_bands>& bands, float gain) {
+  for (std::size_t band = 0; band < 4; ++band) {
+    // The last lane pair is a plain gain stage
+    const BiquadCoeffs c = band < k_eq_bands ? bands[band] : BiquadCoeffs{gain, 0.0f, 0.0f, 0.0f, 0.0f};
+    for (std::size_t ch = 0; ch < 2; ++ch) {
+      const std::size_t i = band * 2 + ch;
+      m_lanes.b0[i] = c.b0;
+      m_lanes.b1[i] = c.b1;
+      m_lanes.b2[i] = c.b2;
+      m_lanes.a1[i] = c.a1;
+      m_lanes.a2[i] = c.a2;
+    }
+  }
+  reset();
+}
+
+void Equalizer::reset() {
+  std::fill(std::begin(m_lanes.z1), std::end(m_lanes.z1), 0.0f);
+  std::fill(std::begin(m_lanes.z2), std::end(m_lanes.z2), 0.0f);
+  std::fill(std::begin(m_lanes.y), std::end(m_lanes.y), 0.0f);
+}
+
+void Equalizer::process(float* samples, std::size_t frames) {
+  dispatch().kernel(m_lanes, samples, frames);
+}
+
+void apply_gain(float* samples, std::size_t count, float gain) {
+  // Simple enough for the compiler to vectorize on its own
+  for (std::size_t i = 0; i < count; ++i) samples[i] = std::clamp(samples[i] * gain, -1.0f, 1.0f);
+}
+
+std::string_view dsp_kernel_name() {
+  return dispatch().name;
+}
+
+} // namespace policarpo
@@ -0,0 +1,83 @@
+#include "policarpo/dsp_chain.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <opus/opus.h>
+
+namespace policarpo {
+
+namespace {
+  constexpr int k_channels = 2;
+  constexpr int k_max_frame_samples = 5760; // 120 ms, the longest Opus packet
+
+  // Playback encodes in real time for every guild with DSP on, trade a
+  // little quality for a lot of CPU compared to ingest
+  constexpr int k_playback_complexity = 5;
+
+  bool is_header_packet(const unsigned char* packet, int size) {
+    return size >= 8 && (std::memcmp(packet, "OpusHead", 8) == 0 || std::memcmp(packet, "OpusTags", 8) == 0);
+  }
+}
+
+bool equalizer_configure(Equalizer& eq, const DspSettings& settings) {
+  if (std::none_of(settings.eq_db.begin(), settings.eq_db.end(), [](float db) { return std::abs(db) >= 0.05f; })) return false;
+  eq.set({
+    biquad_low_shelf(k_eq_frequencies[0], settings.eq_db[0]),
+    biquad_peaking(k_eq_frequencies[1], 0.7f, settings.eq_db[1]),
+    biquad_high_shelf(k_eq_frequencies[2], settings.eq_db[2]),
+  }, settings.gain);
+  return true;
+}
+
+bool DspSettings::neutral() const {
+  return std::abs(gain - 1.0f) < 1e-3f && std::all_of(eq_db.begin(), eq_db.end(), [](float db) { return std::abs(db) < 0.05f; });
+}
+
+std::unique_ptr<DspChain> DspChain::create(const DspSettings& settings, int bitrate) {
+  std::unique_ptr<DspChain> chain(new DspChain());
+
+  int error = OPUS_OK;
+  chain->m_decoder = opus_decoder_create(48000, k_channels, &error);
+  if (error != OPUS_OK) {
+    std::cerr << "[DSP] Error creating decoder: " << opus_strerror(error) << "\n";
+    return nullptr;
+  }
+  chain->m_encoder = opus_encoder_create(48000, k_channels, OPUS_APPLICATION_AUDIO, &error);
+  if (error != OPUS_OK) {
+    std::cerr << "[DSP] Error creating encoder: " << opus_strerror(error) << "\n";
+    return nullptr;
+  }
+  opus_encoder_ctl(chain->m_encoder, OPUS_SET_BITRATE(bitrate));
+  opus_encoder_ctl(chain->m_encoder, OPUS_SET_COMPLEXITY(k_playback_complexity));
+  opus_encoder_ctl(chain->m_encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+
+  chain->m_gain = settings.gain;
+  chain->m_use_eq = equalizer_configure(chain->m_eq, settings);
+  chain->m_pcm.resize(k_max_frame_samples * k_channels);
+  return chain;
+}
+
+DspChain::~DspChain() {
+  if (m_decoder) opus_decoder_destroy(m_decoder);
+  if (m_encoder) opus_encoder_destroy(m_encoder);
+}
+
+int DspChain::process(const unsigned char* packet, int size, unsigned char* out, int max_out) {
+  if (is_header_packet(packet, size)) return 0;
+
+  const int frames = opus_decode_float(m_decoder, packet, size, m_pcm.data(), k_max_frame_samples, 0);
+  if (frames <= 0) return 0;
+
+  // The EQ carries the gain as its last stage, gain alone skips the filters
+  if (m_use_eq) {
+    m_eq.process(m_pcm.data(), static_cast<std::size_t>(frames));
+  } else {
+    apply_gain(m_pcm.data(), static_cast<std::size_t>(frames) * k_channels, m_gain);
+  }
+
+  const opus_int32 bytes = opus_encode_float(m_encoder, m_pcm.data(), frames, out, max_out);
+  return bytes > 0 ? bytes : 0;
+}
+
+} // namespace policarpo
@@ -0,0 +1,124 @@
+#include "policarpo/guild_settings.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <nlohmann/json.hpp>
+
+namespace policarpo {
+
+namespace {
+  GuildSettingsStore g_settings{"songs/guilds.json"};
+
+  void clamp_settings(GuildSettings& settings) {
+    settings.volume_percent = std::clamp(settings.volume_percent, 0, k_max_volume_percent);
+    for (int& db : settings.eq_db) db = std::clamp(db, -k_max_eq_db, k_max_eq_db);
+    settings.crossfade_seconds = std::clamp(settings.crossfade_seconds, 0, k_max_crossfade_seconds);
+  }
+
+  bool is_default(const GuildSettings& settings) {
+    return settings.volume_percent == 100 && settings.trim_silence && settings.crossfade_seconds == 0 &&
+           std::all_of(settings.eq_db.begin(), settings.eq_db.end(), [](int db) { return db == 0; });
+  }
+}
+
+DspSettings GuildSettings::dsp() const {
+  DspSettings out;
+  out.gain = static_cast<float>(volume_percent) / 100.0f;
+  for (std::size_t i = 0; i < k_eq_bands; ++i) out.eq_db[i] = static_cast<float>(eq_db[i]);
+  return out;
+}
+
+GuildSettings guild_settings_get(std::uint64_t guild_id) {
+  return g_settings.get(guild_id);
+}
+
+GuildSettings guild_settings_update(std::uint64_t guild_id, const std::function<void(GuildSettings&)>& change) {
+  return g_settings.update(guild_id, change);
+}
+
+GuildSettingsStore::GuildSettingsStore(std::filesystem::path path)
+  : m_path(std::move(path)) {}
+
+GuildSettings GuildSettingsStore::get(std::uint64_t guild_id) {
+  std::lock_guard lk(m_mu);
+  load_locked();
+  auto it = m_guilds.find(guild_id);
+  return it == m_guilds.end() ? GuildSettings{} : it->second;
+}
+
+GuildSettings GuildSettingsStore::update(std::uint64_t guild_id, const std::function<void(GuildSettings&)>& change) {
+  std::lock_guard lk(m_mu);
+  load_locked();
+
+  GuildSettings settings = m_guilds.contains(guild_id) ? m_guilds[guild_id] : GuildSettings{};
+  change(settings);
+  clamp_settings(settings);
+
+  // Guilds back on the defaults don't need an entry
+  if (is_default(settings)) {
+    m_guilds.erase(guild_id);
+  } else {
+    m_guilds[guild_id] = settings;
+  }
+  save_locked();
+  return settings;
+}
+
+void GuildSettingsStore::load_locked() {
+  if (m_loaded) return;
+  m_loaded = true;
+
+  std::ifstream in(m_path, std::ios::binary);
+  if (!in) return;
+
+  // {"<guild id>": {"volume": 100, "eq": [bass, mid, treble], "trim": true, "crossfade": 0}, ...}
+  nlohmann::json data = nlohmann::json::parse(in, nullptr, false);
+  if (!data.is_object()) {
+    std::cerr << "[Guild Settings] Warning: " << m_path << " is not valid, starting from defaults\n";
+    return;
+  }
+
+  for (const auto& [key, value] : data.items()) {
+    if (!value.is_object()) continue;
+    GuildSettings settings;
+    settings.volume_percent = value.value("volume", 100);
+    settings.trim_silence = value.value("trim", true);
+    settings.crossfade_seconds = value.value("crossfade", 0);
+    if (auto eq = value.find("eq"); eq != value.end() && eq->is_array()) {
+      for (std::size_t i = 0; i < k_eq_bands && i < eq->size(); ++i) {
+        if ((*eq)[i].is_number_integer()) settings.eq_db[i] = (*eq)[i].get<int>();
+      }
+    }
+    clamp_settings(settings);
+    try {
+      m_guilds[std::stoull(key)] = settings;
+    } catch (const std::exception&) {
+      // not a guild id, skip it
+    }
+  }
+}
+
+void GuildSettingsStore::save_locked() {
+  nlohmann::json data = nlohmann::json::object();
+  for (const auto& [guild_id, settings] : m_guilds) {
+    data[std::to_string(guild_id)] = {{"volume", settings.volume_percent}, {"eq", settings.eq_db}, {"trim", settings.trim_silence},
+                                         {"crossfade", settings.crossfade_seconds}};
+  }
+
+  auto tmp = m_path;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      std::cerr << "[Guild Settings] Error: could not write " << tmp << "\n";
+      return;
+    }
+    out << data.dump();
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, m_path, ec);
+  if (ec) std::cerr << "[Guild Settings] Error: could not replace " << m_path << ": " << ec.message() << "\n";
+}
+
+} // namespace policarpo
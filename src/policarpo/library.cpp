@@ -0,0 +1,298 @@
+#include "policarpo/library.hpp"
+#include "policarpo/song_manager.hpp"
+#include "policarpo/track_index.hpp"
+#include "policarpo/track_storage.hpp"
+#include "policarpo/track_verifier.hpp"
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace policarpo {
+
+namespace {
+  Library g_library{k_songs_dir};
+  std::once_flag g_once;
+
+  constexpr std::uint32_t k_watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_CREATE;
+
+  bool is_track_file(const std::filesystem::path& file) {
+    return file.extension() == ".opus";
+  }
+
+  // Storage internals, never contain <id>.opus names
+  bool is_internal_dir(const std::filesystem::path& dir) {
+    return dir == k_objects_dir || dir == k_incoming_dir || dir == k_quarantine_dir || dir == k_derived_dir;
+  }
+}
+
+void library_init() {
+  std::call_once(g_once, [] { g_library.start(); });
+}
+
+bool library_contains(std::string_view id) {
+  return g_library.contains(id);
+}
+
+void library_add(std::string_view id) {
+  g_library.add(id);
+}
+
+void library_remove(std::string_view id) {
+  g_library.remove(id);
+}
+
+Library::Library(std::filesystem::path root)
+  : m_root(std::move(root)) {}
+
+Library::~Library() {
+  stop();
+}
+
+void Library::start() {
+  if (m_worker.joinable()) return;
+
+  m_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  m_inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (m_inotify_fd < 0) {
+    std::cerr << "[Library] Warning: inotify unavailable, changes made outside the bot won't be noticed\n";
+  }
+
+  m_worker = std::thread([this] {
+    track_storage_init();
+
+    // Watch before scanning so nothing that happens during the scan is lost
+    if (m_inotify_fd >= 0) watch_tree(m_root, false);
+
+    const std::vector<std::string> found = scan();
+    {
+      std::unique_lock lk(m_mu);
+      for (const auto& id : found) m_present.insert_or_assign(id, true);
+    }
+    prune_index();
+    m_ready = true;
+    std::cout << "[Library] " << size() << " tracks on disk\n";
+    track_verify_library();
+
+    if (m_inotify_fd >= 0) watch_loop();
+  });
+}
+
+void Library::stop() {
+  if (m_stop_fd >= 0) {
+    std::uint64_t one = 1;
+    [[maybe_unused]] auto n = write(m_stop_fd, &one, sizeof(one));
+  }
+  if (m_worker.joinable()) m_worker.join();
+  if (m_inotify_fd >= 0) close(m_inotify_fd);
+  if (m_stop_fd >= 0) close(m_stop_fd);
+  m_inotify_fd = -1;
+  m_stop_fd = -1;
+}
+
+bool Library::contains(std::string_view id) const {
+  // Until the first scan is done fall back to asking the filesystem
+  if (!m_ready) return file_exists(track_path(id).string());
+
+  std::shared_lock lk(m_mu);
+  return m_present.contains(id);
+}
+
+void Library::add(std::string_view id) {
+  std::unique_lock lk(m_mu);
+  m_present.insert_or_assign(id, true);
+}
+
+void Library::remove(std::string_view id) {
+  std::unique_lock lk(m_mu);
+  m_present.erase(id);
+}
+
+std::size_t Library::size() const {
+  std::shared_lock lk(m_mu);
+  return m_present.size();
+}
+
+std::vector<std::string> Library::scan() const {
+  std::vector<std::filesystem::path> shards;
+  std::error_code ec;
+  for (auto it = std::filesystem::directory_iterator(m_root, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    if (it->is_directory() && !is_internal_dir(it->path())) shards.push_back(it->path());
+  }
+
+  // Walk the top level shards in parallel, stat() dominates on slow mounts
+  const std::size_t workers = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, 8);
+  std::vector<std::future<std::vector<std::string>>> parts;
+  for (std::size_t w = 0; w < workers; ++w) {
+    parts.push_back(std::async(std::launch::async, [&shards, w, workers] {
+      std::vector<std::string> ids;
+      for (std::size_t i = w; i < shards.size(); i += workers) {
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(shards[i], ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+          std::error_code file_ec;
+          if (is_track_file(it->path()) && it->is_regular_file(file_ec) && it->file_size(file_ec) > 0 && !file_ec) {
+            ids.push_back(it->path().stem().string());
+          }
+        }
+      }
+      return ids;
+    }));
+  }
+
+  std::vector<std::string> found;
+  for (auto& part : parts) {
+    std::vector<std::string> ids = part.get();
+    found.insert(found.end(), std::make_move_iterator(ids.begin()), std::make_move_iterator(ids.end()));
+  }
+  return found;
+}
+
+void Library::rescan() {
+  // Directories created meanwhile may be among the lost events
+  watch_tree(m_root, false);
+
+  const std::vector<std::string> found = scan();
+  VideoIdMap<bool> on_disk;
+  for (const auto& id : found) on_disk.insert_or_assign(id, true);
+
+  std::vector<std::string> missing;
+  std::size_t added = 0;
+  {
+    std::unique_lock lk(m_mu);
+    for (const auto& id : found) {
+      if (!m_present.contains(id)) ++added;
+      m_present.insert_or_assign(id, true);
+    }
+    m_present.for_each([&](const std::string& id, bool) {
+      if (!on_disk.contains(id)) missing.push_back(id);
+    });
+  }
+
+  // Deletions were lost too. A download may have landed after its shard
+  // was walked, so only what is still not there goes.
+  std::size_t removed = 0;
+  for (const auto& id : missing) {
+    std::error_code ec;
+    if (std::filesystem::exists(track_path(id), ec) || ec) continue;
+    remove(id);
+    track_cache_erase(id);
+    ++removed;
+  }
+  std::cout << "[Library] Rescan: " << added << " tracks added, " << removed << " gone\n";
+}
+
+void Library::prune_index() {
+  // An empty scan most likely means songs/ is not mounted, keep the index
+  if (size() == 0) return;
+
+  std::size_t removed = track_cache_erase_if([this](const std::string& id) {
+    std::shared_lock lk(m_mu);
+    return !m_present.contains(id);
+  });
+  if (removed > 0) {
+    std::cout << "[Library] Dropped " << removed << " index entries without a file\n";
+  }
+}
+
+void Library::watch_loop() {
+  alignas(struct inotify_event) char buffer[16 * 1024];
+
+  pollfd fds[2] = {
+    {m_inotify_fd, POLLIN, 0},
+    {m_stop_fd, POLLIN, 0},
+  };
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "[Library] Error: poll failed, stopped watching " << m_root << "\n";
+      return;
+    }
+    if (fds[1].revents & POLLIN) return;
+    if (!(fds[0].revents & POLLIN)) continue;
+
+    ssize_t len = read(m_inotify_fd, buffer, sizeof(buffer));
+    if (len <= 0) continue;
+
+    for (char* p = buffer; p < buffer + len;) {
+      auto* event = reinterpret_cast<struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        std::cerr << "[Library] Warning: inotify queue overflowed, rescanning\n";
+        rescan();
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        m_watches.erase(event->wd);
+        continue;
+      }
+      if (event->len == 0) continue;
+
+      auto dir = m_watches.find(event->wd);
+      if (dir == m_watches.end()) continue;
+      const std::filesystem::path file = dir->second / event->name;
+
+      if (event->mask & IN_ISDIR) {
+        // New shard directory, watch it and pick up anything already in it
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) watch_tree(file, true);
+        continue;
+      }
+
+      if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        on_added(file);
+      } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        on_removed(file);
+      }
+    }
+  }
+}
+
+void Library::watch_tree(const std::filesystem::path& dir, bool catch_up) {
+  if (is_internal_dir(dir)) return;
+
+  int wd = inotify_add_watch(m_inotify_fd, dir.c_str(), k_watch_mask);
+  if (wd < 0) {
+    std::cerr << "[Library] Warning: could not watch " << dir << " (raise fs.inotify.max_user_watches?)\n";
+    return;
+  }
+  m_watches[wd] = dir;
+
+  std::error_code ec;
+  for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    if (it->is_directory()) {
+      watch_tree(it->path(), catch_up);
+    } else if (catch_up) {
+      // Written before the watch existed, no event is coming for it
+      on_added(it->path());
+    }
+  }
+}
+
+void Library::on_added(const std::filesystem::path& file) {
+  if (!is_track_file(file)) return;
+
+  // Dropped straight into songs/ by hand, move it into the sharded layout.
+  // The resulting link shows up as its own event.
+  if (file.parent_path() == m_root) {
+    track_store(file, file.stem().string());
+    return;
+  }
+  add(file.stem().string());
+}
+
+void Library::on_removed(const std::filesystem::path& file) {
+  if (!is_track_file(file) || file.parent_path() == m_root) return;
+
+  const std::string id = file.stem().string();
+  remove(id);
+  if (track_cache_erase(id)) {
+    std::cout << "[Library] " << id << " was deleted, dropped it from the index\n";
+  }
+}
+
+} // namespace policarpo
@@ -0,0 +1,177 @@
+#include "policarpo/loudness.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace policarpo {
+
+namespace {
+  typedef float v4f __attribute__((vector_size(16)));
+
+  constexpr std::size_t k_block_frames = 4800; // 100 ms at 48 kHz
+  constexpr std::size_t k_taps = 12;
+
+  // Never boost a track into clipping, and leave small differences alone
+  constexpr float k_peak_ceiling_dbtp = -1.0f;
+  constexpr float k_min_gain_db = 1.0f;
+
+  std::atomic<int> g_target_lufs{-14};
+
+  // BS.1770-4 K-weighting at 48 kHz: high shelf, then RLB high pass
+  constexpr double k_shelf[5] = {1.53512485958697, -2.69169618940638, 1.19839281085285, -1.69065929318241, 0.73248077421585};
+  constexpr double k_highpass[5] = {1.0, -2.0, 1.0, -1.99004745483398, 0.99007225036621};
+
+  // BS.1770-4 Annex 2, 4x oversampling, one row per phase
+  constexpr float k_upsample[4][k_taps] = {
+    { 0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f, -0.0594482421875f,  0.1373291015625f,
+      0.9721679687500f, -0.1022949218750f,  0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f},
+    {-0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f, -0.1665039062500f,  0.4650878906250f,
+      0.7797851562500f, -0.2003173828125f,  0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f},
+    {-0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f, -0.2003173828125f,  0.7797851562500f,
+      0.4650878906250f, -0.1665039062500f,  0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f},
+    {-0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f, -0.1022949218750f,  0.9721679687500f,
+      0.1373291015625f, -0.0594482421875f,  0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f},
+  };
+
+  // Same table by tap, the four phases of a tap side by side
+  struct UpsampleTaps {
+    v4f tap[k_taps];
+    UpsampleTaps() {
+      for (std::size_t k = 0; k < k_taps; ++k) {
+        tap[k] = v4f{k_upsample[0][k], k_upsample[1][k], k_upsample[2][k], k_upsample[3][k]};
+      }
+    }
+  };
+  const UpsampleTaps g_taps;
+
+  v4f load(const float* p) {
+    v4f v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  void store(float* p, v4f v) {
+    std::memcpy(p, &v, sizeof(v));
+  }
+
+  v4f vmax(v4f a, v4f b) {
+    return a > b ? a : b;
+  }
+
+  double block_loudness(double mean_square) {
+    return -0.691 + 10.0 * std::log10(mean_square);
+  }
+}
+
+LoudnessMeter::LoudnessMeter() {
+  // Lanes: [shelf L, shelf R, high pass L, high pass R]
+  for (int c = 0; c < 5; ++c) {
+    m_biquad[c][0] = m_biquad[c][1] = static_cast<float>(k_shelf[c]);
+    m_biquad[c][2] = m_biquad[c][3] = static_cast<float>(k_highpass[c]);
+  }
+}
+
+void LoudnessMeter::add(const float* samples, std::size_t frames) {
+  const v4f b0 = load(m_biquad[0]), b1 = load(m_biquad[1]), b2 = load(m_biquad[2]);
+  const v4f a1 = load(m_biquad[3]), a2 = load(m_biquad[4]);
+  v4f z1 = load(m_biquad[5]), z2 = load(m_biquad[6]);
+  v4f y = load(m_y);
+  v4f energy = load(m_energy);
+  v4f peak = v4f{m_peak, m_peak, m_peak, m_peak};
+  std::size_t pos = m_history_pos;
+
+  for (std::size_t t = 0; t < frames; ++t) {
+    const float left = samples[2 * t];
+    const float right = samples[2 * t + 1];
+
+    // K-weighting. The high pass lanes are one sample behind, which only
+    // shifts where the 100 ms blocks start.
+    const v4f x = v4f{left, right, y[0], y[1]};
+    y = b0 * x + z1;
+    z1 = b1 * x - a1 * y + z2;
+    z2 = b2 * x - a2 * y;
+    energy += y * y;
+
+    // True peak. History is written twice so the 12 newest samples are
+    // always contiguous, newest first.
+    pos = (pos + k_taps - 1) % k_taps;
+    m_history[0][pos] = m_history[0][pos + k_taps] = left;
+    m_history[1][pos] = m_history[1][pos + k_taps] = right;
+    v4f up_left{}, up_right{};
+    for (std::size_t k = 0; k < k_taps; ++k) {
+      up_left += g_taps.tap[k] * m_history[0][pos + k];
+      up_right += g_taps.tap[k] * m_history[1][pos + k];
+    }
+    peak = vmax(peak, vmax(vmax(up_left, -up_left), vmax(up_right, -up_right)));
+
+    if (++m_block_fill == k_block_frames) {
+      store(m_energy, energy);
+      end_block();
+      energy = v4f{};
+    }
+  }
+
+  store(m_biquad[5], z1);
+  store(m_biquad[6], z2);
+  store(m_y, y);
+  store(m_energy, energy);
+  m_peak = std::max({peak[0], peak[1], peak[2], peak[3]});
+  m_history_pos = pos;
+}
+
+void LoudnessMeter::end_block() {
+  // Left and right both weigh 1.0
+  m_blocks.push_back((static_cast<double>(m_energy[2]) + m_energy[3]) / k_block_frames);
+  m_block_fill = 0;
+}
+
+std::optional<Loudness> LoudnessMeter::result() const {
+  // Gating blocks are 400 ms long and start every 100 ms
+  if (m_blocks.size() < 4) return std::nullopt;
+  std::vector<double> gated;
+  gated.reserve(m_blocks.size() - 3);
+  for (std::size_t i = 0; i + 4 <= m_blocks.size(); ++i) {
+    const double mean_square = (m_blocks[i] + m_blocks[i + 1] + m_blocks[i + 2] + m_blocks[i + 3]) / 4.0;
+    if (mean_square > 0.0 && block_loudness(mean_square) > k_loudness_floor_lufs) gated.push_back(mean_square);
+  }
+
+  Loudness loudness;
+  if (m_peak > 0.0f) {
+    loudness.true_peak_dbtp = std::max(k_loudness_floor_lufs, 20.0f * std::log10(m_peak));
+  }
+  if (gated.empty()) return loudness;
+
+  // Relative gate, 10 LU under the loudness of what passed the absolute one
+  double sum = 0.0;
+  for (double ms : gated) sum += ms;
+  const double relative = sum / static_cast<double>(gated.size()) * 0.1;
+
+  double kept = 0.0;
+  std::size_t count = 0;
+  for (double ms : gated) {
+    if (ms > relative) {
+      kept += ms;
+      ++count;
+    }
+  }
+  if (count > 0) {
+    loudness.integrated_lufs = static_cast<float>(block_loudness(kept / static_cast<double>(count)));
+  }
+  return loudness;
+}
+
+void loudness_configure(int target_lufs) {
+  g_target_lufs = target_lufs;
+}
+
+float loudness_gain_db(const Loudness& loudness) {
+  const int target = g_target_lufs.load(std::memory_order_relaxed);
+  if (target == 0 || loudness.integrated_lufs <= k_loudness_floor_lufs) return 0.0f;
+
+  const float gain = std::min(static_cast<float>(target) - loudness.integrated_lufs,
+                              k_peak_ceiling_dbtp - loudness.true_peak_dbtp);
+  return std::abs(gain) < k_min_gain_db ? 0.0f : gain;
+}
+
+} // namespace policarpo
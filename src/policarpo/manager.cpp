@@ -2,6 +2,30 @@
 #include "policarpo/manager.hpp"
 #include "policarpo/player.hpp"
 #include "policarpo/song_manager.hpp"
+#include "policarpo/bitrate_tiers.hpp"
+#include "policarpo/download_scheduler.hpp"
+#include "policarpo/guild_settings.hpp"
+#include "policarpo/library.hpp"
+
+namespace {
+    // Tell the user why, when we remember why
+    std::string not_found_message(std::string_view query) {
+        auto failure = policarpo::track_failure_reason(query);
+        if (!failure) return "❌ No pude encontrar la canción.";
+
+        switch (*failure) {
+            case policarpo::FailureReason::Livestream:
+                return "❌ No puedo poner transmisiones en vivo.";
+            case policarpo::FailureReason::TooLong:
+                return "❌ Esa canción dura más de 2 horas y media.";
+            case policarpo::FailureReason::Unavailable:
+                return "❌ Ese video no está disponible.";
+            case policarpo::FailureReason::DownloadFailed:
+                return "❌ No pude descargar la canción, intenta de nuevo en un rato.";
+        }
+        return "❌ No pude encontrar la canción.";
+    }
+}
 
 void policarpo::Manager::join(const dpp::snowflake& guild_id, const dpp::slashcommand_t& event) {
     dpp::guild* g = dpp::find_guild(guild_id);
@@ -55,12 +79,17 @@ void policarpo::Manager::play(const dpp::snowflake& guild_id, std::string_view q
             player = create_player(*event.from(), guild_id, event.command.channel_id);
             auto join_result = policarpo::join_voice(m_bot, guild_id, event.command.usr.id, event.from()->shard_id);
             std::cout << "[Manager] Join voice result: " << static_cast<int>(join_result) << " for guild " << guild_id << "\n";
-            enqueue(query, player, event, [event, guild_id, this](std::optional<policarpo::Song> track) {
+            if (std::string playlist_id = policarpo::extract_youtube_playlist_id(query); !playlist_id.empty()) {
+                enqueue_playlist(playlist_id, player, event);
+                return;
+            }
+            enqueue(query, player, event, [event, guild_id, this, query = std::string(query)](std::optional<policarpo::TrackHandle> track) {
                 if (track) {
-                    std::cout << "[Manager] Playing: " << track.value().title << " on guild " << guild_id << "\n";
-                    event.edit_response("🎶 Poniendo " + track.value().title + " " + format_duration(track.value().duration));
+                    const policarpo::Song& song = policarpo::track_get(*track);
+                    std::cout << "[Manager] Playing: " << song.title << " on guild " << guild_id << "\n";
+                    event.edit_response("🎶 Poniendo " + song.title + " " + format_duration(song.duration));
                 } else {
-                    event.edit_response("❌ No pude encontrar la canción.");
+                    event.edit_response(not_found_message(query));
                 }
             });
         } else {
@@ -88,7 +117,8 @@ void policarpo::Manager::play(const dpp::snowflake& guild_id, std::string_view q
             case policarpo::current_state_t::FINISHED_QUEUE_NOT_EMPTY:
                 std::cout << "[Manager] State: CAN_RESTART for " << guild_id << "\n";
                 if (player->restart()) {
-                    event.edit_response(dpp::message(std::string("Reiniciando con ") + player->m_current.value().title + ". " + format_duration(player->m_current.value().duration)));
+                    const policarpo::Song& song = policarpo::track_get(player->m_current.value());
+                    event.edit_response(dpp::message(std::string("Reiniciando con ") + song.title + ". " + format_duration(song.duration)));
                 } else {
                     event.edit_response(dpp::message("❌ Nada que hacer."));
                 }
@@ -98,13 +128,16 @@ void policarpo::Manager::play(const dpp::snowflake& guild_id, std::string_view q
                 event.edit_response(dpp::message("❌ Ya estoy reproduciendo algo."));
                 break;
         }
+    } else if (std::string playlist_id = policarpo::extract_youtube_playlist_id(query); !playlist_id.empty()) {
+        enqueue_playlist(playlist_id, player, event);
     } else {
-        enqueue(query, player, event, [event, guild_id, this](std::optional<policarpo::Song> track) {
+        enqueue(query, player, event, [event, guild_id, this, query = std::string(query)](std::optional<policarpo::TrackHandle> track) {
             if (track) {
-                std::cout << "[Manager] Enqueued: " << track.value().title << " on  guild " << guild_id << "\n";
-                event.edit_response("🎶 " + track.value().title + " añadida a la cola. " + format_duration(track.value().duration));
+                const policarpo::Song& song = policarpo::track_get(*track);
+                std::cout << "[Manager] Enqueued: " << song.title << " on  guild " << guild_id << "\n";
+                event.edit_response("🎶 " + song.title + " añadida a la cola. " + format_duration(song.duration));
             } else {
-                event.edit_response("❌ No pude encontrar la canción.");
+                event.edit_response(not_found_message(query));
             }
         });
     }
@@ -120,7 +153,8 @@ void policarpo::Manager::skip(const dpp::snowflake& guild_id, const dpp::slashco
 
     // skip to next marker (end of current track marker)
     if (player->skip()) {
-        event.reply("⏭️ Saltando a " + player->m_current.value().title + ". " + format_duration(player->m_current.value().duration));
+        const policarpo::Song& song = policarpo::track_get(player->m_current.value());
+        event.reply("⏭️ Saltando a " + song.title + ". " + format_duration(song.duration));
         //start_next_if_possible(guild_id);
     } else {
         event.reply("❌ Ahora no queda nah.");
@@ -170,16 +204,17 @@ void policarpo::Manager::queue(const dpp::snowflake& guild_id, const dpp::slashc
     dpp::embed queue_embed = dpp::embed().set_color(dpp::colors::sti_blue).set_title("Lista");
     /*Locura total de calculo*/
     if (player->m_current.has_value()) {
+        const policarpo::Song& current = policarpo::track_get(player->m_current.value());
         queue_embed.add_field("🎵 **Rola actual:** ", 
-            player->m_current.value().title + " " + 
-            format_duration(player->m_current.value().duration - std::chrono::milliseconds(static_cast<int64_t>(player->voice()->voiceclient->get_secs_remaining() * 1000))) + " - " + 
-            format_duration(player->m_current.value().duration));
+            current.title + " " + 
+            format_duration(player->play_end() - std::chrono::milliseconds(static_cast<int64_t>(player->voice()->voiceclient->get_secs_remaining() * 1000))) + " - " + 
+            format_duration(current.duration));
     
     }
     
     queue_embed.add_field("📜 **Lista:**","",false);
     for (size_t i{0}; i < player->m_queue.size(); i++) {
-        policarpo::Song song = player->m_queue[i];
+        const policarpo::Song& song = policarpo::track_get(player->m_queue[i]);
         queue_embed.add_field(
             std::to_string(i + 1) + ". " + song.title + " " + format_duration(song.duration),
             "",
@@ -203,6 +238,7 @@ void policarpo::Manager::leave(const dpp::snowflake& guild_id, const dpp::slashc
         player->stop_and_clear();
         policarpo::leave_voice(*event.from(), guild_id);
         m_players.erase(guild_id);
+        m_reorder.erase(guild_id);
     }
     event.reply(dpp::message("Noh Vimoh!"));
 }
@@ -218,10 +254,9 @@ void policarpo::Manager::remove(const dpp::snowflake& guild_id, size_t index, co
         event.reply(dpp::message("❌ Índice inválido."));
         return;
     }
-    policarpo::Song removed_song = player->m_queue[index - 1];
-    std::optional<Song> removed = player->remove_from_queue(index);
+    std::optional<policarpo::TrackHandle> removed = player->remove_from_queue(index);
     if (removed.has_value()) {
-        event.reply(dpp::message("🗑️ Removida de la cola: " + removed->title));
+        event.reply(dpp::message("🗑️ Removida de la cola: " + policarpo::track_get(*removed).title));
         return;
     } else {
         event.reply(dpp::message("❌ No puedo remover la actual."));
@@ -245,31 +280,99 @@ void policarpo::Manager::jump(const dpp::snowflake& guild_id, size_t index, cons
         return;
     }
     if (player->jump_to_queue_index(index)) {
-        event.reply(dpp::message("⏩ Saltando a la pista " + std::to_string(index) + " - " + player->m_current->title + ". " + format_duration(player->m_current->duration)));
+        const policarpo::Song& song = policarpo::track_get(player->m_current.value());
+        event.reply(dpp::message("⏩ Saltando a la pista " + std::to_string(index) + " - " + song.title + ". " + format_duration(song.duration)));
         //start_next_if_possible(guild_id);
     } else {
         event.reply(dpp::message("❌ No pude saltar a esa pista."));
     }
 }
 
-void policarpo::Manager::enqueue(std::string_view query, std::shared_ptr<policarpo::Player> player, const dpp::slashcommand_t& event, std::function<void(std::optional<policarpo::Song>)> callback) {
-    // Heavy work off-thread:
-    std::async(std::launch::async, [this, query, player, callback, guild_id = player->m_guild_id]() {
-        policarpo::get_track(query, [this, player, guild_id, callback](std::optional<policarpo::Song> track) {
-            if (track) {
-                auto track_copy = *track;
-                player->enqueue(std::move(*track));
-                start_next_if_possible(guild_id);
-                // Use the copy for callback
-                if (callback) {
-                    callback(track_copy);
-                    return; // Early return to avoid duplicate callback
-                }
-            } else if (callback) {
-                callback(track); // nullptr
+void policarpo::Manager::enqueue(std::string_view query, std::shared_ptr<policarpo::Player> player, const dpp::slashcommand_t& event, std::function<void(std::optional<policarpo::TrackHandle>)> callback) {
+    // The queue position is taken now, in command order, but resolving runs
+    // in parallel. A quick cached hit waits for slower requests made before it.
+    auto buffer = reorder_buffer(player->m_guild_id);
+    const std::uint64_t slot = buffer->reserve();
+
+    std::thread([this, query = std::string(query), player, event, callback, buffer, slot, guild_id = player->m_guild_id]() {
+        // The slot must complete whatever happens, later /play commands in
+        // this guild wait behind it
+        bool completed = false;
+        try {
+            policarpo::get_track(query, [player, callback, buffer, slot, &completed](std::optional<policarpo::TrackHandle> track) {
+                completed = true;
+                buffer->complete(slot, [player, callback, track]() {
+                    if (track) player->enqueue(*track);
+                    if (callback) callback(track);
+                });
+            });
+            start_next_if_possible(guild_id);
+        } catch (const std::exception& e) {
+            std::cerr << "[Manager] Error resolving \"" << query << "\" for guild " << guild_id << ": " << e.what() << "\n";
+            if (!completed) {
+                buffer->complete(slot, [event]() { event.edit_response("❌ Algo falló buscando esa canción."); });
             }
+        }
+    }).detach();
+}
+
+void policarpo::Manager::enqueue_playlist(const std::string& playlist_id, std::shared_ptr<policarpo::Player> player, const dpp::slashcommand_t& event) {
+    auto buffer = reorder_buffer(player->m_guild_id);
+    const std::uint64_t slot = buffer->reserve();
+
+    std::thread([this, playlist_id, player, event, buffer, slot, guild_id = player->m_guild_id]() {
+        std::vector<policarpo::Song> entries;
+        try {
+            entries = policarpo::list_playlist(playlist_id);
+        } catch (const std::exception& e) {
+            std::cerr << "[Manager] Error listing playlist " << playlist_id << " for guild " << guild_id << ": " << e.what() << "\n";
+        }
+        if (entries.empty()) {
+            buffer->complete(slot, [event]() { event.edit_response("❌ No pude leer la playlist."); });
+            return;
+        }
+        std::cout << "[Manager] Playlist " << playlist_id << " has " << entries.size() << " entries for guild " << guild_id << "\n";
+
+        // Every entry goes in the queue in one go and in order. What isn't
+        // on disk yet downloads in parallel, the first entry ahead of the rest.
+        std::vector<policarpo::TrackHandle> tracks;
+        std::vector<policarpo::DownloadResult> downloads;
+        for (const policarpo::Song& entry : entries) {
+            std::optional<policarpo::TrackHandle> track;
+            if (policarpo::library_contains(entry.id)) track = policarpo::load_cached_song_by_id(entry.id);
+            if (!track) {
+                track = policarpo::track_intern(entry);
+                auto priority = downloads.empty() ? policarpo::DownloadPriority::Interactive : policarpo::DownloadPriority::Background;
+                downloads.push_back(policarpo::download_track(entry.id, priority, entry.title));
+            }
+            tracks.push_back(*track);
+        }
+
+        const std::size_t total = entries.size();
+        const std::size_t cached = total - downloads.size();
+        auto progress = [total](std::size_t ready) {
+            return "📃 " + std::to_string(total) + " canciones añadidas a la cola. Listas: " + std::to_string(ready) + "/" + std::to_string(total);
+        };
+        buffer->complete(slot, [player, tracks, event, message = progress(cached)]() {
+            for (policarpo::TrackHandle track : tracks) player->enqueue(track);
+            event.edit_response(message);
         });
-    });
+
+        // Plays as soon as its first entry is ready
+        start_next_if_possible(guild_id);
+
+        // Edits are rate limited, don't send one per track
+        std::size_t ready = cached;
+        auto last_edit = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < downloads.size(); ++i) {
+            if (downloads[i].get()) ++ready;
+            const auto now = std::chrono::steady_clock::now();
+            if (i + 1 == downloads.size() || now - last_edit > std::chrono::seconds(3)) {
+                event.edit_response(progress(ready));
+                last_edit = now;
+            }
+        }
+    }).detach();
 }
 
 void policarpo::Manager::set_loop_mode(const dpp::snowflake& guild_id, const std::string& mode, const dpp::slashcommand_t& event) {
@@ -297,6 +400,63 @@ void policarpo::Manager::set_loop_mode(const dpp::snowflake& guild_id, const std
     }
 }
 
+void policarpo::Manager::set_volume(const dpp::snowflake& guild_id, std::optional<int> percent, const dpp::slashcommand_t& event) {
+    if (!percent) {
+        event.reply(dpp::message("🔊 Volumen: " + std::to_string(policarpo::guild_settings_get(guild_id).volume_percent) + "%"));
+        return;
+    }
+
+    std::cout << "[Manager] Setting volume in guild: " << guild_id << " to " << *percent << "%\n";
+    auto settings = policarpo::guild_settings_update(guild_id, [&](policarpo::GuildSettings& s) { s.volume_percent = *percent; });
+    // The current track is already buffered in DPP as it was encoded
+    event.reply(dpp::message("🔊 Volumen: " + std::to_string(settings.volume_percent) + "%. Se aplica desde la siguiente canción."));
+}
+
+void policarpo::Manager::set_eq(const dpp::snowflake& guild_id, std::optional<int> bass, std::optional<int> mid, std::optional<int> treble, const dpp::slashcommand_t& event) {
+    policarpo::GuildSettings settings = policarpo::guild_settings_get(guild_id);
+    const bool changed = bass || mid || treble;
+    if (changed) {
+        std::cout << "[Manager] Setting EQ in guild: " << guild_id << "\n";
+        settings = policarpo::guild_settings_update(guild_id, [&](policarpo::GuildSettings& s) {
+            if (bass) s.eq_db[0] = *bass;
+            if (mid) s.eq_db[1] = *mid;
+            if (treble) s.eq_db[2] = *treble;
+        });
+    }
+
+    auto db = [](int value) { return (value > 0 ? "+" : "") + std::to_string(value) + " dB"; };
+    std::string content = "🎚️ Graves " + db(settings.eq_db[0]) + ", medios " + db(settings.eq_db[1]) + ", agudos " + db(settings.eq_db[2]);
+    if (changed) content += ". Se aplica desde la siguiente canción.";
+    event.reply(dpp::message(content));
+}
+
+void policarpo::Manager::set_trim(const dpp::snowflake& guild_id, std::optional<bool> enabled, const dpp::slashcommand_t& event) {
+    if (!enabled) {
+        const bool current = policarpo::guild_settings_get(guild_id).trim_silence;
+        event.reply(dpp::message(current ? "✂️ Se saltan los silencios al inicio y al final de las canciones." : "✂️ Las canciones se ponen completas, con silencios."));
+        return;
+    }
+
+    std::cout << "[Manager] Setting silence trimming in guild: " << guild_id << " to " << *enabled << "\n";
+    policarpo::guild_settings_update(guild_id, [&](policarpo::GuildSettings& s) { s.trim_silence = *enabled; });
+    event.reply(dpp::message(std::string(*enabled ? "✂️ Se saltarán los silencios al inicio y al final." : "✂️ Las canciones se pondrán completas.") + " Se aplica desde la siguiente canción."));
+}
+
+void policarpo::Manager::set_crossfade(const dpp::snowflake& guild_id, std::optional<int> seconds, const dpp::slashcommand_t& event) {
+    if (!seconds) {
+        const int current = policarpo::guild_settings_get(guild_id).crossfade_seconds;
+        event.reply(dpp::message(current > 0 ? "🔀 Crossfade: " + std::to_string(current) + " s." : "🔀 Crossfade desactivado."));
+        return;
+    }
+
+    std::cout << "[Manager] Setting crossfade in guild: " << guild_id << " to " << *seconds << " s\n";
+    auto settings = policarpo::guild_settings_update(guild_id, [&](policarpo::GuildSettings& s) { s.crossfade_seconds = *seconds; });
+    // Only downloaded tracks in the 20 ms layout can be mixed without a gap
+    event.reply(dpp::message(settings.crossfade_seconds > 0
+        ? "🔀 Crossfade: " + std::to_string(settings.crossfade_seconds) + " s entre canciones ya descargadas."
+        : "🔀 Crossfade desactivado."));
+}
+
 std::shared_ptr<policarpo::Player> policarpo::Manager::create_player(dpp::discord_client& shard, const dpp::snowflake& guild_id, const dpp::snowflake& text_channel_id) {
     if (!m_players.contains(guild_id)) {
         auto player = std::make_shared<policarpo::Player>(shard, guild_id, text_channel_id);
@@ -306,6 +466,13 @@ std::shared_ptr<policarpo::Player> policarpo::Manager::create_player(dpp::discor
     return m_players[guild_id];
 }
 
+std::shared_ptr<policarpo::ReorderBuffer> policarpo::Manager::reorder_buffer(const dpp::snowflake& guild_id) {
+    std::lock_guard lk(m_mu);
+    auto& buffer = m_reorder[guild_id];
+    if (!buffer) buffer = std::make_shared<policarpo::ReorderBuffer>();
+    return buffer;
+}
+
 std::shared_ptr<policarpo::Player> policarpo::Manager::get_player(const dpp::snowflake& guild_id) {
     if (m_players.contains(guild_id)) {
         return m_players[guild_id];
@@ -325,7 +492,8 @@ void policarpo::Manager::on_voice_track_marker(const dpp::voice_track_marker_t&
     player->mark_finished();
     if (player->m_current) {
         if (player->play()) {
-            post_update(*player, "🎶 Poniendo: " + player->m_current->title + " " + format_duration(player->m_current->duration));
+            const policarpo::Song& song = policarpo::track_get(*player->m_current);
+            post_update(*player, "🎶 Poniendo: " + song.title + " " + format_duration(song.duration));
         } else {
             std::cout << "[Manager] Could not start playback for guild: " << guild_id << "On voice track marker\n";
         }
@@ -356,6 +524,7 @@ void policarpo::Manager::on_voice_client_disconnect(const dpp::voice_client_disc
                 std::lock_guard<std::mutex> lock(m_mu);
                 player->stop_and_clear();  // Stop playback and clear queue
                 m_players.erase(guild_id); // Remove from active players
+                m_reorder.erase(guild_id);
             }
             
             std::cout << "[Manager] Player destroyed for guild: " << guild_id << "\n";
@@ -388,6 +557,11 @@ void policarpo::Manager::on_voice_state_update(const dpp::voice_state_update_t&
         const dpp::snowflake guild_id = event.state.guild_id;
         
         std::cout << "[Manager] Bot voice state update in guild: " << guild_id << ", channel: " << event.state.channel_id << "\n";
+
+        // Known before the first download of this session starts
+        if (const dpp::channel* channel = dpp::find_channel(event.state.channel_id)) {
+            policarpo::bitrate_observe_channel(channel->bitrate * 1000);
+        }
         
         // If channel_id is 0, the bot has left the voice channel
         if (event.state.channel_id == 0) {
@@ -403,6 +577,7 @@ void policarpo::Manager::on_voice_state_update(const dpp::voice_state_update_t&
                     std::lock_guard<std::mutex> lock(m_mu);
                     player->stop_and_clear();  // Stop playback and clear queue
                     m_players.erase(guild_id); // Remove from active players
+                    m_reorder.erase(guild_id);
                 }
                 
                 std::cout << "[Manager] Player destroyed for guild: " << guild_id << "\n";
@@ -422,7 +597,7 @@ void policarpo::Manager::start_next_if_possible(const dpp::snowflake& guild_id)
     // If there's something queued, start it
     if (player->m_current.has_value()) {
         if (player->play()) {
-            std::cout << "[Manager] Started playback for guild: " << guild_id << " - " << player->m_current->title << "In start_next_if_possible\n";
+            std::cout << "[Manager] Started playback for guild: " << guild_id << " - " << policarpo::track_get(*player->m_current).title << "In start_next_if_possible\n";
         // post_update(*player, "🎶 Poniendo: " + player->m_current->title + " " + format_duration(player->m_current->duration));
         } else {
             std::cout << "[Manager] Could not start playback for guild: " << guild_id << "In start_next_if_possible\n";
@@ -434,7 +609,7 @@ void policarpo::Manager::start_next_if_possible(const dpp::snowflake& guild_id)
             case policarpo::current_state_t::FINISHED_QUEUE_NOT_EMPTY:
                 // There's something in the queue, try to play it
                 if (player->resume()) {
-                    std::cout << "[Manager] Resumed playback for guild: " << guild_id << " - " << player->m_current->title << "In start_next_if_possible (resume)\n";
+                    std::cout << "[Manager] Resumed playback for guild: " << guild_id << " - " << policarpo::track_get(*player->m_current).title << "In start_next_if_possible (resume)\n";
                 }
                 break;
             default:
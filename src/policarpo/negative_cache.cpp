@@ -0,0 +1,73 @@
+#include "policarpo/negative_cache.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace policarpo {
+
+namespace {
+  NegativeCache g_failures;
+
+  // Expired entries are only swept once the map gets this big
+  constexpr std::size_t k_prune_threshold = 4096;
+}
+
+std::string_view failure_reason_name(FailureReason reason) {
+  switch (reason) {
+    case FailureReason::Livestream: return "livestream";
+    case FailureReason::TooLong: return "too long";
+    case FailureReason::Unavailable: return "unavailable";
+    case FailureReason::DownloadFailed: return "download failed";
+  }
+  return "unknown";
+}
+
+std::chrono::seconds failure_ttl(FailureReason reason) {
+  using namespace std::chrono;
+  switch (reason) {
+    case FailureReason::Livestream: return minutes(15);
+    case FailureReason::TooLong: return hours(24);
+    case FailureReason::Unavailable: return hours(1);
+    case FailureReason::DownloadFailed: return minutes(2);
+  }
+  return minutes(2);
+}
+
+std::optional<FailureReason> negative_cache_get(std::string_view id) {
+  return g_failures.get(id);
+}
+
+void negative_cache_put(std::string_view id, FailureReason reason) {
+  if (id.empty()) return;
+  std::cout << "[Negative Cache] " << id << ": " << failure_reason_name(reason) << "\n";
+  g_failures.put(id, reason);
+}
+
+std::optional<FailureReason> NegativeCache::get(std::string_view id) {
+  std::lock_guard lk(m_mu);
+  Entry* entry = m_entries.find(id);
+  if (!entry) return std::nullopt;
+
+  if (std::chrono::steady_clock::now() >= entry->expires_at) {
+    m_entries.erase(id);
+    return std::nullopt;
+  }
+  return entry->reason;
+}
+
+void NegativeCache::put(std::string_view id, FailureReason reason) {
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard lk(m_mu);
+  if (m_entries.size() >= k_prune_threshold) prune_locked(now);
+  m_entries.insert_or_assign(id, Entry{reason, now + failure_ttl(reason)});
+}
+
+void NegativeCache::prune_locked(std::chrono::steady_clock::time_point now) {
+  std::vector<std::string> expired;
+  m_entries.for_each([&](const std::string& id, const Entry& entry) {
+    if (now >= entry.expires_at) expired.push_back(id);
+  });
+  for (const auto& id : expired) m_entries.erase(id);
+}
+
+} // namespace policarpo
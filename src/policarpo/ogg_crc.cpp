@@ -0,0 +1,152 @@
+#include "policarpo/ogg_crc.hpp"
+#include <array>
+
+#if defined(__x86_64__)
+  #include <immintrin.h>
+  #define POLICARPO_CRC_X86 1
+#endif
+
+namespace policarpo {
+
+namespace {
+  constexpr std::uint32_t k_poly = 0x04c11db7u;
+
+  // k_tables[n][b]: byte b followed by n zero bytes, for slicing by 8
+  constexpr std::array<std::array<std::uint32_t, 256>, 8> make_tables() {
+    std::array<std::array<std::uint32_t, 256>, 8> tables{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      std::uint32_t r = i << 24;
+      for (int bit = 0; bit < 8; ++bit) {
+        r = (r & 0x80000000u) ? (r << 1) ^ k_poly : r << 1;
+      }
+      tables[0][i] = r;
+    }
+    for (std::size_t n = 1; n < 8; ++n) {
+      for (std::uint32_t i = 0; i < 256; ++i) {
+        const std::uint32_t prev = tables[n - 1][i];
+        tables[n][i] = (prev << 8) ^ tables[0][prev >> 24];
+      }
+    }
+    return tables;
+  }
+
+  constexpr auto k_tables = make_tables();
+
+  using Kernel = std::uint32_t (*)(const unsigned char*, std::size_t, std::uint32_t);
+
+  std::uint32_t crc_bytes(const unsigned char* data, std::size_t size, std::uint32_t crc) {
+    for (std::size_t i = 0; i < size; ++i) {
+      crc = (crc << 8) ^ k_tables[0][((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+  }
+
+  // Reference version for short runs and CPUs without carry-less multiply
+  std::uint32_t crc_slice8(const unsigned char* data, std::size_t size, std::uint32_t crc) {
+    for (; size >= 8; data += 8, size -= 8) {
+      crc ^= static_cast<std::uint32_t>(data[0]) << 24 | static_cast<std::uint32_t>(data[1]) << 16 |
+             static_cast<std::uint32_t>(data[2]) << 8 | data[3];
+      crc = k_tables[7][crc >> 24] ^ k_tables[6][(crc >> 16) & 0xFF] ^ k_tables[5][(crc >> 8) & 0xFF] ^
+            k_tables[4][crc & 0xFF] ^ k_tables[3][data[4]] ^ k_tables[2][data[5]] ^ k_tables[1][data[6]] ^
+            k_tables[0][data[7]];
+    }
+    return crc_bytes(data, size, crc);
+  }
+
+#if defined(POLICARPO_CRC_X86)
+  // x^n mod P, the fold constants
+  constexpr std::uint64_t x_pow_mod(unsigned n) {
+    std::uint64_t r = 1;
+    for (unsigned i = 0; i < n; ++i) {
+      r <<= 1;
+      if (r & 0x100000000ull) r ^= 0x100000000ull | k_poly;
+    }
+    return r;
+  }
+
+  /*
+    Folding with carry-less multiplies. A 16 byte block is a 128 bit
+    polynomial once its bytes are reversed (first bit on top). Moving it D
+    bits further down the message is multiplying by x^D, and modulo P that
+    is hi * (x^(D+64) mod P) + lo * (x^D mod P), which fits in 96 bits and
+    is xored into the block there. Four blocks are folded in flight, then
+    into one, and what is left goes through the tables: the folded block
+    stands in for everything before it.
+  */
+  __attribute__((target("pclmul,ssse3")))
+  __m128i reversed(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  }
+
+  __attribute__((target("pclmul,ssse3")))
+  __m128i load(const unsigned char* p) {
+    return reversed(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  }
+
+  __attribute__((target("pclmul,ssse3")))
+  __m128i fold(__m128i v, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(v, k, 0x11), _mm_clmulepi64_si128(v, k, 0x00));
+  }
+
+  __attribute__((target("pclmul,ssse3")))
+  std::uint32_t crc_pclmul(const unsigned char* data, std::size_t size, std::uint32_t crc) {
+    if (size < 64) return crc_slice8(data, size, crc);
+
+    const __m128i fold_512 = _mm_set_epi64x(static_cast<long long>(x_pow_mod(512 + 64)), static_cast<long long>(x_pow_mod(512)));
+    const __m128i fold_128 = _mm_set_epi64x(static_cast<long long>(x_pow_mod(128 + 64)), static_cast<long long>(x_pow_mod(128)));
+
+    // The running crc continues into the first 32 bits of the message
+    __m128i x0 = _mm_xor_si128(load(data), _mm_set_epi32(static_cast<int>(crc), 0, 0, 0));
+    __m128i x1 = load(data + 16);
+    __m128i x2 = load(data + 32);
+    __m128i x3 = load(data + 48);
+    data += 64;
+    size -= 64;
+
+    for (; size >= 64; data += 64, size -= 64) {
+      x0 = _mm_xor_si128(fold(x0, fold_512), load(data));
+      x1 = _mm_xor_si128(fold(x1, fold_512), load(data + 16));
+      x2 = _mm_xor_si128(fold(x2, fold_512), load(data + 32));
+      x3 = _mm_xor_si128(fold(x3, fold_512), load(data + 48));
+    }
+
+    x1 = _mm_xor_si128(fold(x0, fold_128), x1);
+    x2 = _mm_xor_si128(fold(x1, fold_128), x2);
+    x3 = _mm_xor_si128(fold(x2, fold_128), x3);
+    for (; size >= 16; data += 16, size -= 16) {
+      x3 = _mm_xor_si128(fold(x3, fold_128), load(data));
+    }
+
+    alignas(16) unsigned char folded[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(folded), reversed(x3));
+    return crc_slice8(data, size, crc_slice8(folded, sizeof(folded), 0));
+  }
+#endif
+
+  struct Dispatch {
+    Kernel kernel;
+    std::string_view name;
+  };
+
+  Dispatch pick_kernel() {
+#if defined(POLICARPO_CRC_X86)
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) return {crc_pclmul, "pclmul"};
+#endif
+    return {crc_slice8, "slice8"};
+  }
+
+  const Dispatch& dispatch() {
+    static const Dispatch d = pick_kernel();
+    return d;
+  }
+}
+
+std::uint32_t ogg_crc32(const unsigned char* data, std::size_t size, std::uint32_t crc) {
+  return dispatch().kernel(data, size, crc);
+}
+
+std::string_view ogg_crc_kernel_name() {
+  return dispatch().name;
+}
+
+} // namespace policarpo
@@ -0,0 +1,140 @@
+#include "policarpo/ogg_reader.hpp"
+#include "policarpo/ogg_crc.hpp"
+#include <algorithm>
+#include <array>
+
+namespace policarpo {
+
+namespace {
+  constexpr std::uint8_t k_flag_continued = 0x01;
+  constexpr std::uint8_t k_flag_bos = 0x02;
+  constexpr std::uint8_t k_flag_eos = 0x04;
+
+  std::uint64_t get_le(const unsigned char* p, int bytes) {
+    std::uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+  }
+}
+
+bool OggOpusReader::fail(std::string reason) {
+  if (m_error.empty()) m_error = std::move(reason);
+  m_ready.clear();
+  return false;
+}
+
+bool OggOpusReader::open(const std::filesystem::path& path) {
+  m_in.open(path, std::ios::binary);
+  if (!m_in) return fail("can't open file");
+
+  std::vector<unsigned char> packet;
+  std::int64_t granule = 0;
+
+  if (!next(packet, granule)) return fail("no OpusHead");
+  if (packet.size() < 19 || !std::equal(packet.begin(), packet.begin() + 8, "OpusHead")) return fail("no OpusHead");
+  // Only the major version (upper nibble) is about compatibility
+  if ((packet[8] & 0xF0) != 0) return fail("unsupported OpusHead version");
+  if (packet[18] != 0) return fail("channel mapping family " + std::to_string(packet[18]));
+  m_head.channels = packet[9];
+  if (m_head.channels < 1 || m_head.channels > 2) return fail("bad channel count " + std::to_string(m_head.channels));
+  m_head.pre_skip = static_cast<std::uint16_t>(get_le(packet.data() + 10, 2));
+  m_head.input_rate = static_cast<std::uint32_t>(get_le(packet.data() + 12, 4));
+  m_head.output_gain = static_cast<std::int16_t>(get_le(packet.data() + 16, 2));
+
+  if (!next(packet, granule)) return fail("no OpusTags");
+  if (packet.size() < 16 || !std::equal(packet.begin(), packet.begin() + 8, "OpusTags")) return fail("no OpusTags");
+  std::size_t at = 8;
+  auto read_string = [&](std::string& out) {
+    if (at + 4 > packet.size()) return false;
+    const std::size_t length = get_le(packet.data() + at, 4);
+    at += 4;
+    if (length > packet.size() - at) return false;
+    out.assign(packet.begin() + static_cast<std::ptrdiff_t>(at), packet.begin() + static_cast<std::ptrdiff_t>(at + length));
+    at += length;
+    return true;
+  };
+  std::string vendor;
+  if (!read_string(vendor) || at + 4 > packet.size()) return fail("damaged OpusTags");
+  const std::size_t count = get_le(packet.data() + at, 4);
+  at += 4;
+  for (std::size_t i = 0; i < count; ++i) {
+    std::string comment;
+    if (!read_string(comment)) return fail("damaged OpusTags");
+    m_comments.push_back(std::move(comment));
+  }
+  return true;
+}
+
+bool OggOpusReader::next(std::vector<unsigned char>& packet, std::int64_t& granule) {
+  while (m_ready.empty()) {
+    if (failed() || m_eos || !read_page()) return false;
+  }
+  packet = std::move(m_ready.back().data);
+  granule = m_ready.back().granule;
+  m_ready.pop_back();
+  return true;
+}
+
+bool OggOpusReader::read_page() {
+  std::array<unsigned char, 27> header{};
+  m_in.read(reinterpret_cast<char*>(header.data()), header.size());
+  if (m_in.gcount() == 0 && m_in.eof()) {
+    // Files cut short never got their end of stream page
+    if (!m_partial.empty()) return fail("truncated packet at end of file");
+    m_eos = true;
+    return false;
+  }
+  if (!m_in || !std::equal(header.begin(), header.begin() + 4, "OggS") || header[4] != 0) {
+    return fail("bad page header");
+  }
+
+  const std::uint8_t flags = header[5];
+  const auto granule = static_cast<std::int64_t>(get_le(&header[6], 8));
+  const auto serial = static_cast<std::uint32_t>(get_le(&header[14], 4));
+  const auto sequence = static_cast<std::uint32_t>(get_le(&header[18], 4));
+  const auto crc = static_cast<std::uint32_t>(get_le(&header[22], 4));
+
+  std::vector<unsigned char> lacing(header[26]);
+  m_in.read(reinterpret_cast<char*>(lacing.data()), static_cast<std::streamsize>(lacing.size()));
+  std::size_t body_size = 0;
+  for (unsigned char l : lacing) body_size += l;
+  std::vector<unsigned char> body(body_size);
+  m_in.read(reinterpret_cast<char*>(body.data()), static_cast<std::streamsize>(body_size));
+  if (!m_in) return fail("truncated page");
+
+  // The stored checksum is computed with its own field zeroed
+  header[22] = header[23] = header[24] = header[25] = 0;
+  std::uint32_t computed = ogg_crc32(header.data(), header.size());
+  computed = ogg_crc32(lacing.data(), lacing.size(), computed);
+  computed = ogg_crc32(body.data(), body.size(), computed);
+  if (computed != crc) return fail("page " + std::to_string(sequence) + " checksum mismatch");
+
+  if (!m_serial) {
+    if (!(flags & k_flag_bos)) return fail("first page is not a stream start");
+    m_serial = serial;
+  } else if (serial != *m_serial || (flags & k_flag_bos)) {
+    return fail("more than one logical stream");
+  }
+  if (sequence != m_expected_sequence) return fail("missing page before " + std::to_string(sequence));
+  ++m_expected_sequence;
+
+  if (!(flags & k_flag_continued)) m_partial.clear();
+
+  std::vector<Packet> finished;
+  std::size_t at = 0;
+  for (unsigned char l : lacing) {
+    m_partial.insert(m_partial.end(), body.begin() + static_cast<std::ptrdiff_t>(at), body.begin() + static_cast<std::ptrdiff_t>(at + l));
+    at += l;
+    if (l < 255) {
+      finished.push_back({std::move(m_partial), -1});
+      m_partial.clear();
+    }
+  }
+  if (!finished.empty()) finished.back().granule = granule;
+  if (flags & k_flag_eos) m_eos = true;
+
+  m_ready.assign(std::make_move_iterator(finished.rbegin()), std::make_move_iterator(finished.rend()));
+  return true;
+}
+
+} // namespace policarpo
@@ -0,0 +1,128 @@
+#include "policarpo/ogg_writer.hpp"
+#include "policarpo/ogg_crc.hpp"
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+namespace policarpo {
+
+namespace {
+  constexpr std::uint8_t k_flag_bos = 0x02;
+  constexpr std::uint8_t k_flag_eos = 0x04;
+  constexpr std::size_t k_max_segments = 255;
+
+  void put_le(std::vector<unsigned char>& out, std::uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+  }
+
+  // 255 for every full 255 bytes, then the remainder (0 when it divides evenly)
+  void append_lacing(std::vector<unsigned char>& lacing, std::size_t size) {
+    lacing.insert(lacing.end(), size / 255, 255);
+    lacing.push_back(static_cast<unsigned char>(size % 255));
+  }
+}
+
+OggOpusWriter::OggOpusWriter(std::size_t packets_per_page)
+  : m_packets_per_page(std::max<std::size_t>(packets_per_page, 1)) {}
+
+OggOpusWriter::~OggOpusWriter() {
+  if (m_out.is_open() && !m_finished) {
+    std::cerr << "[Ogg Writer] Warning: stream closed without finish(), file is truncated\n";
+  }
+}
+
+bool OggOpusWriter::open(const std::filesystem::path& path, const OpusHead& head, std::string_view vendor,
+                         const std::vector<std::string>& comments) {
+  m_out.open(path, std::ios::binary | std::ios::trunc);
+  if (!m_out) {
+    std::cerr << "[Ogg Writer] Error: could not create " << path << "\n";
+    return false;
+  }
+  m_serial = std::random_device{}();
+
+  std::vector<unsigned char> id_header{'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, head.channels};
+  put_le(id_header, head.pre_skip, 2);
+  put_le(id_header, head.input_rate, 4);
+  put_le(id_header, static_cast<std::uint16_t>(head.output_gain), 2);
+  id_header.push_back(0); // mapping family 0: mono or stereo, no table
+
+  std::vector<unsigned char> tags{'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+  put_le(tags, vendor.size(), 4);
+  tags.insert(tags.end(), vendor.begin(), vendor.end());
+  put_le(tags, comments.size(), 4);
+  for (const auto& comment : comments) {
+    put_le(tags, comment.size(), 4);
+    tags.insert(tags.end(), comment.begin(), comment.end());
+  }
+
+  // Each header gets a page of its own, the first one opens the stream
+  std::vector<unsigned char> lacing;
+  append_lacing(lacing, id_header.size());
+  if (!write_page(id_header.data(), id_header.size(), lacing, 0, k_flag_bos)) return false;
+
+  lacing.clear();
+  append_lacing(lacing, tags.size());
+  return write_page(tags.data(), tags.size(), lacing, 0, 0);
+}
+
+bool OggOpusWriter::write_packet(const unsigned char* data, std::size_t size, std::int64_t granule) {
+  const std::size_t segments = size / 255 + 1;
+  if (segments > k_max_segments) {
+    std::cerr << "[Ogg Writer] Error: packet of " << size << " bytes doesn't fit a page\n";
+    return false;
+  }
+
+  // Keep the newest packet buffered so finish() always has a page to mark
+  if (m_page_packets == m_packets_per_page || m_lacing.size() + segments > k_max_segments) {
+    if (!flush(false)) return false;
+  }
+
+  append_lacing(m_lacing, size);
+  m_body.insert(m_body.end(), data, data + size);
+  m_granule = granule;
+  ++m_page_packets;
+  ++m_packets_written;
+  return true;
+}
+
+bool OggOpusWriter::finish() {
+  if (m_finished) return true;
+  m_finished = true;
+
+  bool ok = flush(true);
+  m_out.close();
+  return ok && !m_out.fail();
+}
+
+bool OggOpusWriter::flush(bool eos) {
+  if (m_page_packets == 0 && !eos) return true;
+
+  bool ok = write_page(m_body.data(), m_body.size(), m_lacing, m_granule, eos ? k_flag_eos : 0);
+  m_body.clear();
+  m_lacing.clear();
+  m_page_packets = 0;
+  return ok;
+}
+
+bool OggOpusWriter::write_page(const unsigned char* body, std::size_t body_size, const std::vector<unsigned char>& lacing,
+                               std::int64_t granule, std::uint8_t flags) {
+  std::vector<unsigned char> header{'O', 'g', 'g', 'S', 0, flags};
+  header.reserve(27 + lacing.size());
+  put_le(header, static_cast<std::uint64_t>(granule), 8);
+  put_le(header, m_serial, 4);
+  put_le(header, m_sequence++, 4);
+  put_le(header, 0, 4); // CRC, filled in below
+  header.push_back(static_cast<unsigned char>(lacing.size()));
+  header.insert(header.end(), lacing.begin(), lacing.end());
+
+  // The checksum covers the header (with a zero CRC field) and the body
+  std::uint32_t crc = ogg_crc32(header.data(), header.size());
+  crc = ogg_crc32(body, body_size, crc);
+  for (int i = 0; i < 4; ++i) header[22 + i] = static_cast<unsigned char>(crc >> (8 * i));
+
+  m_out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+  m_out.write(reinterpret_cast<const char*>(body), static_cast<std::streamsize>(body_size));
+  return static_cast<bool>(m_out);
+}
+
+} // namespace policarpo
@@ -0,0 +1,187 @@
+#include "policarpo/opus_normalizer.hpp"
+#include "policarpo/ogg_reader.hpp"
+#include "policarpo/ogg_writer.hpp"
+#include <algorithm>
+#include <array>
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+#include <opus/opus.h>
+
+namespace policarpo {
+
+namespace {
+  constexpr opus_int32 k_max_packet = 1275 * 3;
+
+  // Regroups Opus frames into packets of exactly 20 ms. Longer frames can't
+  // be split without decoding, shorter ones are merged while their TOC
+  // configuration stays the same.
+  class Repacketizer {
+  public:
+    Repacketizer() : m_rp(opus_repacketizer_create(), opus_repacketizer_destroy) {}
+
+    enum class Status { Ok, TooLong, Broken };
+
+    template <typename Emit>
+    Status push(std::vector<unsigned char> packet, Emit&& emit) {
+      const auto size = static_cast<opus_int32>(packet.size());
+      const int frames = opus_packet_get_nb_frames(packet.data(), size);
+      const int per_frame = opus_packet_get_samples_per_frame(packet.data(), 48000);
+      if (frames <= 0 || per_frame <= 0) return Status::Broken;
+      if (per_frame > k_frame_samples || k_frame_samples % per_frame != 0) return Status::TooLong;
+
+      if (m_frames > 0 && per_frame != m_per_frame) return Status::TooLong;
+      if (m_frames == 0) opus_repacketizer_init(m_rp.get());
+
+      // The repacketizer only keeps pointers, the data has to outlive it
+      m_held.push_back(std::move(packet));
+      if (opus_repacketizer_cat(m_rp.get(), m_held.back().data(), size) != OPUS_OK) return Status::TooLong;
+      m_frames += frames;
+      m_per_frame = per_frame;
+
+      const int per_packet = k_frame_samples / per_frame;
+      int start = 0;
+      for (; start + per_packet <= m_frames; start += per_packet) {
+        if (!out(start, start + per_packet, k_frame_samples, emit)) return Status::Broken;
+      }
+      if (start == 0) return Status::Ok;
+
+      // Carry the leftover frames into a fresh repacketizer
+      std::vector<unsigned char> rest;
+      if (start < m_frames) {
+        rest.resize(k_max_packet);
+        opus_int32 bytes = opus_repacketizer_out_range(m_rp.get(), start, m_frames, rest.data(), k_max_packet);
+        if (bytes < 0) return Status::Broken;
+        rest.resize(static_cast<std::size_t>(bytes));
+      }
+      m_held.clear();
+      m_frames -= start;
+      opus_repacketizer_init(m_rp.get());
+      if (m_frames > 0) {
+        m_held.push_back(std::move(rest));
+        opus_repacketizer_cat(m_rp.get(), m_held.back().data(), static_cast<opus_int32>(m_held.back().size()));
+      }
+      return Status::Ok;
+    }
+
+    // Whatever is left at the end goes out as one short packet
+    template <typename Emit>
+    bool flush(Emit&& emit) {
+      if (m_frames == 0) return true;
+      bool ok = out(0, m_frames, m_frames * m_per_frame, emit);
+      m_frames = 0;
+      m_held.clear();
+      return ok;
+    }
+
+  private:
+    template <typename Emit>
+    bool out(int begin, int end, int samples, Emit& emit) {
+      std::array<unsigned char, k_max_packet> buffer;
+      opus_int32 bytes = opus_repacketizer_out_range(m_rp.get(), begin, end, buffer.data(), k_max_packet);
+      return bytes > 0 && emit(buffer.data(), static_cast<std::size_t>(bytes), samples);
+    }
+
+    std::unique_ptr<OpusRepacketizer, decltype(&opus_repacketizer_destroy)> m_rp;
+    std::vector<std::vector<unsigned char>> m_held;
+    int m_frames{0};
+    int m_per_frame{0};
+  };
+}
+
+NormalizeResult normalize_ogg_opus(const std::filesystem::path& input, const std::filesystem::path& output, std::string* reason) {
+  auto invalid = [&](std::string why) {
+    if (reason) *reason = std::move(why);
+    return NormalizeResult::Invalid;
+  };
+
+  OggOpusReader reader;
+  if (!reader.open(input)) return invalid(reader.error());
+
+  // input_rate in OpusHead is informational only, Opus always decodes at 48 kHz
+  OggOpusWriter writer(k_packets_per_page);
+  if (!writer.open(output, reader.head(), opus_get_version_string(), {std::string(k_layout_tag)})) {
+    return invalid("can't write output");
+  }
+
+  Repacketizer repacketizer;
+  std::vector<unsigned char> packet;
+  std::int64_t page_granule = -1;
+  std::int64_t last_granule = -1;
+  std::int64_t samples = 0;
+
+  // Packets are written one behind, so the last one can take the final granule
+  std::vector<unsigned char> held;
+  std::int64_t held_end = 0;
+  bool have_held = false;
+  bool write_ok = true;
+
+  auto emit = [&](const unsigned char* data, std::size_t size, int count) {
+    if (have_held) write_ok = write_ok && writer.write_packet(held.data(), held.size(), held_end);
+    held.assign(data, data + size);
+    samples += count;
+    held_end = samples;
+    have_held = true;
+    return write_ok;
+  };
+
+  while (reader.next(packet, page_granule)) {
+    if (page_granule >= 0) last_granule = page_granule;
+    if (packet.empty()) continue; // zero length packets carry nothing (DTX)
+
+    switch (repacketizer.push(std::move(packet), emit)) {
+      case Repacketizer::Status::Ok: break;
+      case Repacketizer::Status::TooLong: return NormalizeResult::NeedsReencode;
+      case Repacketizer::Status::Broken: return invalid("malformed Opus packet");
+    }
+  }
+  if (reader.failed()) return invalid(reader.error());
+  if (!repacketizer.flush(emit) || !have_held) return invalid("no audio");
+  if (samples <= reader.head().pre_skip) return invalid("shorter than its pre-skip");
+
+  // End trimming from the source survives, anything past the audio doesn't
+  if (last_granule > held_end - k_frame_samples && last_granule < held_end) held_end = last_granule;
+  if (!writer.write_packet(held.data(), held.size(), held_end) || !write_ok || !writer.finish()) {
+    return invalid("can't write output");
+  }
+  return NormalizeResult::Normalized;
+}
+
+std::optional<SeekPoint> normalized_seek_point(const std::filesystem::path& file, std::chrono::milliseconds position) {
+  {
+    OggOpusReader reader;
+    if (!reader.open(file)) return std::nullopt;
+    const auto& comments = reader.comments();
+    if (std::find(comments.begin(), comments.end(), k_layout_tag) == comments.end()) return std::nullopt;
+  }
+
+  const std::uint64_t packet = static_cast<std::uint64_t>(position.count()) / 20;
+  const std::uint64_t target_page = 2 + packet / k_packets_per_page; // after OpusHead and OpusTags
+
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return std::nullopt;
+
+  // Only page headers are read, bodies are stepped over
+  std::array<unsigned char, 27 + 255> header{};
+  std::uint64_t offset = 0;
+  std::optional<SeekPoint> point;
+  for (std::uint64_t page = 0;; ++page) {
+    ssize_t n = pread(fd, header.data(), header.size(), static_cast<off_t>(offset));
+    if (n < 27 || !std::equal(header.begin(), header.begin() + 4, "OggS")) break;
+    const std::size_t segments = header[26];
+    if (static_cast<std::size_t>(n) < 27 + segments) break;
+
+    if (page == target_page) {
+      point = SeekPoint{offset, static_cast<std::uint32_t>(packet % k_packets_per_page)};
+      break;
+    }
+    std::uint64_t body = 0;
+    for (std::size_t i = 0; i < segments; ++i) body += header[27 + i];
+    offset += 27 + segments + body;
+  }
+  close(fd);
+  return point;
+}
+
+} // namespace policarpo
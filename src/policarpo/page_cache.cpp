@@ -0,0 +1,140 @@
+#include "policarpo/page_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace policarpo {
+
+namespace {
+  Prefetcher g_prefetcher;
+
+  std::atomic<std::size_t> g_prefetch_tracks{2};
+  std::atomic<bool> g_drop_behind{true};
+
+  struct Window {
+    std::string current;
+    std::vector<UpcomingFile> upcoming;
+  };
+
+  std::mutex g_mu;
+  std::unordered_map<std::uint64_t, Window> g_windows;
+
+  // Played pages are dropped in steps this big, not after every read
+  constexpr off_t k_drop_step = 1 << 20;
+
+  // Hard cap, a long queue shouldn't read half the library in
+  constexpr std::size_t k_max_prefetch_tracks = 8;
+}
+
+void page_cache_configure(const PageCacheSettings& settings) {
+  g_prefetch_tracks = std::min(settings.prefetch_tracks, k_max_prefetch_tracks);
+  g_drop_behind = settings.drop_behind;
+}
+
+std::size_t page_cache_prefetch_tracks() {
+  return g_prefetch_tracks.load(std::memory_order_relaxed);
+}
+
+void page_cache_window(std::uint64_t guild_id, std::string current, std::vector<UpcomingFile> upcoming) {
+  std::vector<UpcomingFile> fresh;
+  {
+    std::lock_guard lk(g_mu);
+    Window& window = g_windows[guild_id];
+    for (const auto& next : upcoming) {
+      const bool known = std::any_of(window.upcoming.begin(), window.upcoming.end(),
+                                     [&](const UpcomingFile& old) { return old.file == next.file; });
+      if (!known) fresh.push_back(next);
+    }
+    window.current = std::move(current);
+    window.upcoming = std::move(upcoming);
+  }
+  for (const auto& next : fresh) g_prefetcher.submit(next);
+}
+
+void page_cache_forget(std::uint64_t guild_id) {
+  std::lock_guard lk(g_mu);
+  g_windows.erase(guild_id);
+}
+
+bool page_cache_is_hot(std::uint64_t guild_id, std::string_view id) {
+  std::lock_guard lk(g_mu);
+  for (const auto& [guild, window] : g_windows) {
+    if (guild != guild_id && window.current == id) return true;
+    for (const auto& next : window.upcoming) {
+      if (next.id == id) return true;
+    }
+  }
+  return false;
+}
+
+PlayedPages::PlayedPages(std::uint64_t guild_id, std::string id, const std::filesystem::path& file)
+  : m_guild_id(guild_id), m_id(std::move(id)) {
+  // Any descriptor will do, the pages belong to the file
+  if (g_drop_behind.load(std::memory_order_relaxed)) m_fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+PlayedPages::~PlayedPages() {
+  if (m_fd < 0) return;
+  if (!page_cache_is_hot(m_guild_id, m_id)) posix_fadvise(m_fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(m_fd);
+}
+
+void PlayedPages::advance(off_t offset) {
+  if (m_fd < 0 || offset - m_dropped < k_drop_step) return;
+  if (!page_cache_is_hot(m_guild_id, m_id)) posix_fadvise(m_fd, 0, offset, POSIX_FADV_DONTNEED);
+  m_dropped = offset;
+}
+
+Prefetcher::~Prefetcher() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_worker.joinable()) m_worker.join();
+}
+
+void Prefetcher::submit(const UpcomingFile& upcoming) {
+  std::lock_guard lk(m_mu);
+  if (m_queued.contains(upcoming.id)) return;
+  m_queued.insert_or_assign(upcoming.id, true);
+  m_jobs.push_back(upcoming);
+
+  if (!m_worker.joinable()) m_worker = std::thread([this] { worker_loop(); });
+  m_cv.notify_one();
+}
+
+void Prefetcher::worker_loop() {
+  while (true) {
+    UpcomingFile upcoming;
+    {
+      std::unique_lock lk(m_mu);
+      m_cv.wait(lk, [&] { return m_stop || !m_jobs.empty(); });
+      if (m_stop) return;
+      upcoming = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    prefetch(upcoming);
+
+    std::lock_guard lk(m_mu);
+    m_queued.erase(upcoming.id);
+  }
+}
+
+void Prefetcher::prefetch(const UpcomingFile& upcoming) {
+  const int fd = ::open(upcoming.file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return; // gone since it was queued
+
+  // Starts the reads and returns once they're queued, the pages come in
+  // while the current track plays. Cached pages cost nothing.
+  if (const int err = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED); err != 0) {
+    std::cerr << "[Page Cache] Warning: could not read ahead " << upcoming.id << ": " << std::strerror(err) << "\n";
+  }
+  close(fd);
+}
+
+} // namespace policarpo
@@ -1,4 +1,30 @@
 #include "policarpo/player.hpp"
+#include "policarpo/bitrate_tiers.hpp"
+#include "policarpo/download_scheduler.hpp"
+#include "policarpo/guild_settings.hpp"
+#include "policarpo/library.hpp"
+#include "policarpo/opus_normalizer.hpp"
+#include "policarpo/page_cache.hpp"
+#include "policarpo/track_index.hpp"
+#include "policarpo/track_analysis.hpp"
+#include "policarpo/track_storage.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <opus/opus.h>
+
+namespace {
+  // Stored packets decoded ahead of the tail so the crossfade's decoder
+  // is settled when the tail starts
+  constexpr std::int64_t k_fade_warm_up_samples = 3 * policarpo::k_frame_samples;
+
+  // Shorter overlaps aren't worth a re-encode
+  constexpr std::chrono::milliseconds k_min_crossfade{1000};
+
+  bool is_header_packet(const unsigned char* packet, long bytes) {
+    return bytes >= 8 && (std::memcmp(packet, "OpusHead", 8) == 0 || std::memcmp(packet, "OpusTags", 8) == 0);
+  }
+}
 
 policarpo::Player::Player(dpp::discord_client& shard, const dpp::snowflake& guild_id, const dpp::snowflake& text_channel_id)
     : m_shard(shard), m_guild_id(guild_id), m_text_channel_id(text_channel_id) {
@@ -6,7 +32,9 @@ policarpo::Player::Player(dpp::discord_client& shard, const dpp::snowflake& guil
       m_queue.reserve(4);
     }
 
-policarpo::Player::~Player() {}
+policarpo::Player::~Player() {
+  page_cache_forget(m_guild_id);
+}
 
 dpp::voiceconn* policarpo::Player::voice() const {
   dpp::voiceconn* v = m_shard.get_voice(m_guild_id);
@@ -14,14 +42,14 @@ dpp::voiceconn* policarpo::Player::voice() const {
   return v;
 }
 
-void policarpo::Player::enqueue(Song s) {
+void policarpo::Player::enqueue(TrackHandle track) {
   std::unique_lock lk(m_mu);
-  std::cout << "[Player] Enqueue called for guild " << m_guild_id << " - " << s.title << "\n";
-  m_queue.push_back(std::move(s));
-  if (m_queue.size() == 1 && !m_current.has_value()) {
-    lk.unlock();
-    get_next_track();
-  }
+  std::cout << "[Player] Enqueue called for guild " << m_guild_id << " - " << track_get(track).title << "\n";
+  m_queue.push_back(track);
+  const bool first = m_queue.size() == 1 && !m_current.has_value();
+  lk.unlock();
+  if (first) get_next_track();
+  update_cache_window();
 }
 
 bool policarpo::Player::skip() {
@@ -38,7 +66,7 @@ bool policarpo::Player::skip() {
   
       is_playing = false;
 
-      v->voiceclient->skip_to_next_marker();
+      skip_buffered(v);
       lk.unlock();
       get_next_track();
       return play();
@@ -61,10 +89,10 @@ bool policarpo::Player::pause() {
   if (is_paused || is_stopped || is_finished) return false;
   
   if (dpp::voiceconn* v = voice(); v && v->voiceclient && v->voiceclient->is_ready()) {
-    m_elapsed = static_cast<float>(m_current.value().duration.count() / 1000) - v->voiceclient->get_secs_remaining();
+    m_elapsed = static_cast<float>(m_play_end.count()) / 1000.0f - v->voiceclient->get_secs_remaining();
    // v->voiceclient->pause_audio(true);  // :contentReference[oaicite:0]{index=0}
    // v->voiceclient->stop_audio();   // DAVE doesn't support pause, so we stop and will resume with the remaining time
-    v->voiceclient->skip_to_next_marker();
+    skip_buffered(v);
     is_paused = true;
     is_playing = false;
     #ifdef DEBUG_MODE 
@@ -244,7 +272,7 @@ bool policarpo::Player::restart() {
   return false;
 }
 
-std::optional<policarpo::Song> policarpo::Player::remove_from_queue(size_t index) {
+std::optional<policarpo::TrackHandle> policarpo::Player::remove_from_queue(size_t index) {
   std::lock_guard lk(m_mu);
   std::cout << "[Player] Remove from queue called for guild " << m_guild_id << " index " << index << "\n";
 
@@ -254,7 +282,7 @@ std::optional<policarpo::Song> policarpo::Player::remove_from_queue(size_t index
     return std::nullopt;
   }
 
-  Song s = m_queue[index];
+  TrackHandle s = m_queue[index];
   m_queue.erase(m_queue.begin() + index);
   if (index < m_current_index && m_current_index > 0) {
     m_current_index--;
@@ -271,7 +299,7 @@ bool policarpo::Player::jump_to_queue_index(size_t index) {
     is_waiting = false;
     is_stopped = true;
     is_playing = false;
-    v->voiceclient->skip_to_next_marker();
+    skip_buffered(v);
     lk.unlock();
     get_next_track();
     return play();
@@ -309,6 +337,9 @@ void policarpo::Player::stop_and_clear() {
   m_queue.clear();
   m_current.reset();
   m_current_index = 0;
+  m_awaiting.reset();
+  m_crossfade_into.reset();
+  page_cache_forget(m_guild_id);
 }
 
 void policarpo::Player::update_loop_mode(loop_mode_t mode) {
@@ -317,6 +348,45 @@ void policarpo::Player::update_loop_mode(loop_mode_t mode) {
   m_loop_mode = mode;
 }
 
+void policarpo::Player::skip_buffered(dpp::voiceconn* v) {
+  v->voiceclient->skip_to_next_marker();
+  if (m_crossfade_into) {
+    // Nothing of the next track has been fed yet, only the overlap is left
+    v->voiceclient->stop_audio();
+    m_crossfade_into.reset();
+  }
+}
+
+bool policarpo::Player::send_packet(const unsigned char* packet, long bytes) {
+  std::lock_guard lk(m_mu);
+  const bool header = is_header_packet(packet, bytes);
+  if (m_feed_left == 0) {
+    // Past what goes out as stored: the rest is the crossfade's tail
+    if (!m_fade || m_fade->tail_frames() >= m_fade_frames) return false;
+    if (!header) m_fade->add_tail(packet, static_cast<int>(bytes));
+    return true;
+  }
+  if (m_feed_left > 0 && !header) {
+    const int samples = opus_packet_get_nb_samples(packet, static_cast<opus_int32>(bytes), 48000);
+    if (m_fade && m_feed_left <= k_fade_warm_up_samples) m_fade->warm_up_tail(packet, static_cast<int>(bytes));
+    if (samples > 0) m_feed_left = std::max<std::int64_t>(0, m_feed_left - samples);
+  }
+
+  // Snapshot vc pointer each packet (no global lock held during send)
+  dpp::voiceconn* v = voice();
+  if (!v || !v->voiceclient) return true;
+
+  if (!m_dsp) {
+    v->voiceclient->send_audio_opus(const_cast<unsigned char*>(packet), bytes);
+    return true;
+  }
+
+  std::array<unsigned char, 4000> out;
+  int size = m_dsp->process(packet, static_cast<int>(bytes), out.data(), static_cast<int>(out.size()));
+  if (size > 0) v->voiceclient->send_audio_opus(out.data(), size);
+  return true;
+}
+
 bool policarpo::Player::play(float seconds = 0.0f) {
   std::cout << "[Player] Play called for guild " << m_guild_id << " seconds " << seconds << "\n";
   if (is_playing) return false;
@@ -355,12 +425,40 @@ bool policarpo::Player::play(float seconds = 0.0f) {
   is_stopped = false;
   is_finished = false;
 
-  OGGZ* og = oggz_open(("songs/" + m_current->id + ".opus").c_str(), OGGZ_READ);
+  const Song& current = track_get(*m_current);
+
+  // Playlist entries are queued before they are downloaded. This one jumps
+  // the download queue and playback starts when it lands; play() runs on
+  // DPP's event thread, so it never waits for it here.
+  if (!library_contains(current.id)) {
+    wait_for_download(current);
+    return true;
+  }
+  {
+    std::lock_guard lk(m_mu);
+    m_awaiting.reset();
+  }
+
+  // Channels capped low play a lower bitrate copy when there is one, and
+  // whatever is encoded live needn't carry more than the channel does
+  int channel_bitrate = 0;
+  if (const dpp::channel* channel = dpp::find_channel(v->channel_id)) channel_bitrate = channel->bitrate * 1000;
+  if (channel_bitrate > 0) bitrate_observe_channel(channel_bitrate);
+  const int send_bitrate = channel_bitrate > 0 ? std::min(k_dsp_bitrate, channel_bitrate) : k_dsp_bitrate;
+  const std::filesystem::path file = playback_path(current.id, current.duration, channel_bitrate);
+  {
+    std::lock_guard lk(m_mu);
+    m_channel_bitrate = channel_bitrate;
+  }
+  update_cache_window();
+
+  OGGZ* og = oggz_open(file.c_str(), OGGZ_READ);
   if (!og) {
-    std::cerr << "Error opening: " << m_current->id << "\n";
+    std::cerr << "Error opening: " << current.id << "\n";
     is_playing = false;
-    std::cout << "[Player] Error opening file for guild " << m_guild_id << " track " << m_current->id << "\n";
+    std::cout << "[Player] Error opening file for guild " << m_guild_id << " track " << current.id << "\n";
   }
+  PlayedPages played(m_guild_id, current.id, file);
 
   /*
     Due to a bug in DPP, pausing using DAVE makes it unrecoverable while trying to resume (some encryption stuff)
@@ -368,10 +466,123 @@ bool policarpo::Player::play(float seconds = 0.0f) {
     TO DO: Refactor this mess when DPP fixes the pause/resume bug with DAVE
     */
 
+  // Loudness and silences are measured after download, the index may know
+  // them even if our handle predates that
+  const GuildSettings settings = guild_settings_get(m_guild_id);
+  auto indexed = track_cache_get(current.id);
+  const Song& analyzed = indexed ? track_get(*indexed) : current;
+  if (!analyzed.loudness || !analyzed.trim) track_analysis_queue(current.id);
+
+  // Volume/EQ/loudness: decode and re-encode only when something asks for
+  // it, otherwise the stored packets go out untouched. Discord gets bare
+  // packets, so the OpusHead output gain never reaches a decoder.
+  DspSettings dsp = settings.dsp();
+  if (analyzed.loudness) dsp.gain *= std::pow(10.0f, loudness_gain_db(*analyzed.loudness) / 20.0f);
+  auto dsp_chain = dsp.neutral() ? nullptr : DspChain::create(dsp, send_bitrate);
+
+  // Picking up after a crossfade: the overlap already played our start
+  {
+    std::lock_guard lk(m_mu);
+    m_dsp = std::move(dsp_chain);
+    if (m_crossfade_into) {
+      if (seconds < 0.5f && m_crossfade_into->id == current.id) seconds = m_crossfade_into->seconds;
+      m_crossfade_into.reset();
+    }
+  }
+
+  // Dead air: start where the audio does and stop reading where it ends.
+  // Starting late is just a seek.
+  // Worked out locally, send_packet() and pause() read them under m_mu.
+  std::chrono::milliseconds play_end = analyzed.duration;
+  std::int64_t feed_left = -1;
+  if (settings.trim_silence && analyzed.trim) {
+    seconds = std::max(seconds, static_cast<float>(analyzed.trim->start.count()) / 1000.0f);
+    if (analyzed.trim->end.count() > 0) {
+      play_end = analyzed.duration - analyzed.trim->end;
+      const auto left = play_end - std::chrono::milliseconds(static_cast<long long>(seconds * 1000));
+      if (left.count() > 0) feed_left = left.count() * 48;
+    }
+  }
+
+  // Crossfade: stored packets stop one window early, that window is mixed
+  // with the start of the next track and goes out after the marker. Only
+  // for a next track already on disk in the 20 ms layout, so the mix ends
+  // exactly on one of its packets.
+  std::unique_ptr<Crossfade> fade;
+  std::size_t fade_frames = 0;
+  std::string fade_into;
+  std::uint32_t fade_first_packet = 0;
+  float fade_head_gain = 1.0f;
+  if (settings.crossfade_seconds > 0) {
+    auto next = peek_next_track();
+    if (next && library_contains(track_get(*next).id)) {
+      auto next_indexed = track_cache_get(track_get(*next).id);
+      const Song& upcoming = next_indexed ? track_get(*next_indexed) : track_get(*next);
+      const std::chrono::milliseconds head_start = settings.trim_silence && upcoming.trim ? upcoming.trim->start : std::chrono::milliseconds(0);
+      const auto position = std::chrono::milliseconds(static_cast<long long>(seconds * 1000));
+
+      // Never more than half of either track
+      auto window = std::min({std::chrono::milliseconds(settings.crossfade_seconds * 1000),
+                              (play_end - position) / 2, (upcoming.duration - head_start) / 2});
+      window -= window % 20;
+      if (window >= k_min_crossfade) {
+        const auto packets = static_cast<std::uint32_t>(window.count() / 20);
+        fade_first_packet = static_cast<std::uint32_t>(head_start.count() / 20);
+        fade = Crossfade::create(send_bitrate);
+        if (fade && crossfade_load_head(*fade, playback_path(upcoming.id, upcoming.duration, channel_bitrate), fade_first_packet, packets)) {
+          fade_frames = static_cast<std::size_t>(packets) * k_frame_samples;
+          feed_left = (play_end - window - position).count() * 48;
+          fade_into = upcoming.id;
+          DspSettings next_dsp = settings.dsp();
+          if (upcoming.loudness) next_dsp.gain *= std::pow(10.0f, loudness_gain_db(*upcoming.loudness) / 20.0f);
+          fade_head_gain = next_dsp.gain;
+        } else {
+          fade.reset();
+        }
+      }
+    }
+  }
+  {
+    std::lock_guard lk(m_mu);
+    m_play_end = play_end;
+    m_feed_left = feed_left;
+    m_fade = std::move(fade);
+    m_fade_frames = fade_frames;
+  }
+
+  // Packets to drop after a page seek, before the position is reached
+  struct SkipData {
+    Player* self;
+    std::uint32_t skip;
+  } skip_data{this, 0};
+
+  std::optional<SeekPoint> seek_point;
   if (seconds > 0.5f) {
+    seek_point = normalized_seek_point(file, std::chrono::milliseconds(static_cast<long long>(seconds * 1000)));
+    if (seek_point && oggz_seek(og, static_cast<oggz_off_t>(seek_point->offset), SEEK_SET) < 0) seek_point.reset();
+  }
+
+  if (seek_point) {
+    // Normalized file: the page was found by arithmetic, only the packets
+    // before the position on that page are left to skip
+    std::cout << "[Player] Seeking to " << seconds << " seconds (page at byte " << seek_point->offset << ") for guild " << m_guild_id << "\n";
+    skip_data.skip = seek_point->skip_packets;
+    oggz_set_read_callback(
+      og, -1,
+      [](OGGZ*, oggz_packet* packet, long, void* user_data) -> int {
+        auto* data = static_cast<SkipData*>(user_data);
+        if (data->skip > 0) {
+          --data->skip;
+          return 0;
+        }
+        return data->self->send_packet(packet->op.packet, packet->op.bytes) ? 0 : OGGZ_STOP_OK;
+      },
+      &skip_data
+    );
+  } else if (seconds > 0.5f) {
     std::cout << "[Player] Seeking to " << seconds << " seconds for guild " << m_guild_id << "\n";
     
-    // Manually skip packets by reading and discarding until target position
+    // Older files with irregular packets: skip by reading and discarding until target position
     oggz_off_t target_units = static_cast<oggz_off_t>(seconds * 48000);
     
     // Track position via callback
@@ -407,12 +618,7 @@ bool policarpo::Player::play(float seconds = 0.0f) {
     oggz_set_read_callback(
       og, -1,
       [](OGGZ*, oggz_packet* packet, long, void* user_data) -> int {
-        auto* self = static_cast<Player*>(user_data);
-        dpp::voiceconn* v = self->voice();
-        if (v && v->voiceclient) {
-          v->voiceclient->send_audio_opus(packet->op.packet, packet->op.bytes);
-        }
-        return 0;
+        return static_cast<Player*>(user_data)->send_packet(packet->op.packet, packet->op.bytes) ? 0 : OGGZ_STOP_OK;
       },
       this
     );
@@ -420,14 +626,7 @@ bool policarpo::Player::play(float seconds = 0.0f) {
     oggz_set_read_callback(
       og, -1,
       [](OGGZ*, oggz_packet* packet, long, void* user_data) -> int {
-        auto* self = static_cast<Player*>(user_data);
-
-        // Snapshot vc pointer each packet (no global lock held during send)
-        dpp::voiceconn* v = self->voice();
-        if (v && v->voiceclient) {
-          v->voiceclient->send_audio_opus(packet->op.packet, packet->op.bytes);
-        }
-        return 0;
+        return static_cast<Player*>(user_data)->send_packet(packet->op.packet, packet->op.bytes) ? 0 : OGGZ_STOP_OK;
       },
       this
     );
@@ -437,24 +636,81 @@ bool policarpo::Player::play(float seconds = 0.0f) {
   while (v && v->voiceclient && !v->voiceclient->terminating) {
     static constexpr long CHUNK_READ = BUFSIZ * 2;
     long read_bytes = oggz_read(og, CHUNK_READ);
-    if (!read_bytes) break; // EOF
+    if (read_bytes <= 0) break; // EOF, error, or stopped at the trailing silence
+    played.advance(static_cast<off_t>(oggz_tell(og)));
   }
 
   oggz_close(og);
 
+  {
+    std::lock_guard lk(m_mu);
+    fade = std::move(m_fade);
+  }
+  std::vector<std::vector<unsigned char>> overlap;
+  if (fade) overlap = fade->finish(dsp.gain, fade_head_gain, settings.dsp());
+  if (!overlap.empty()) {
+    std::lock_guard lk(m_mu);
+    m_crossfade_into = CrossfadeInto{fade_into, static_cast<float>(fade_first_packet + overlap.size()) * 0.02f};
+  }
+
   // Marker = “track boundary”
   // Put something useful in marker metadata (id is best)
 
   if (v && v->voiceclient) {
-    std::cout << "[Player] Inserting marker for guild " << m_guild_id << " track " << m_current->id << "\n";
-    v->voiceclient->insert_marker(m_current.value().id);
+    std::cout << "[Player] Inserting marker for guild " << m_guild_id << " track " << current.id << "\n";
+    v->voiceclient->insert_marker(current.id);
   }
 
-  std::cout << "[Player] Finished play call for guild " << m_guild_id << " track " << m_current->id << "\n";
+  // The overlap goes after the marker: when it fires, the next play() has
+  // all of it buffered ahead and continues from the stored packets
+  if (!overlap.empty() && v && v->voiceclient) {
+    std::cout << "[Player] Crossfading into " << fade_into << " for guild " << m_guild_id << "\n";
+    for (auto& packet : overlap) v->voiceclient->send_audio_opus(packet.data(), packet.size());
+  }
+
+  std::cout << "[Player] Finished play call for guild " << m_guild_id << " track " << current.id << "\n";
 
   return true;
 }
 
+void policarpo::Player::wait_for_download(const Song& song) {
+  {
+    std::lock_guard lk(m_mu);
+    if (m_awaiting == song.id) return; // already waiting on it
+    m_awaiting = song.id;
+  }
+  std::cout << "[Player] Waiting for " << song.id << " to download for guild " << m_guild_id << "\n";
+
+  // Stays "playing" meanwhile, so nothing else starts a track under it
+  DownloadResult result = download_track(song.id, DownloadPriority::Interactive, song.title);
+  std::thread([self = weak_from_this(), result, id = song.id]() {
+    const bool downloaded = result.get().has_value();
+    if (auto player = self.lock()) player->download_finished(id, downloaded);
+  }).detach();
+}
+
+void policarpo::Player::download_finished(const std::string& id, bool downloaded) {
+  {
+    std::lock_guard lk(m_mu);
+    if (m_awaiting != id) return; // skipped, jumped or stopped meanwhile
+    m_awaiting.reset();
+  }
+  is_playing = false;
+
+  if (!downloaded) {
+    std::cout << "[Player] Skipping " << id << ", download failed for guild " << m_guild_id << "\n";
+    get_next_track();
+    // Looping a track that can't be had would just fail again
+    std::lock_guard lk(m_mu);
+    if (m_current && track_get(*m_current).id == id) {
+      m_current.reset();
+      is_stopped = true;
+    }
+    if (!m_current) return;
+  }
+  play();
+}
+
 void policarpo::Player::update_text_channel(const dpp::snowflake& text_channel_id) {
   m_text_channel_id = text_channel_id;
 }
@@ -469,7 +725,7 @@ void policarpo::Player::get_next_track() {
       }
       if (m_current_index < m_queue.size()) {
         m_current = m_queue[m_current_index];
-        std::cout << "[Player] Next track is " << m_current->title << " for guild " << m_guild_id << "\n";
+        std::cout << "[Player] Next track is " << track_get(*m_current).title << " for guild " << m_guild_id << "\n";
         break;
       } else {
         std::cout << "[Player] No more tracks in queue for guild " << m_guild_id << "\n";
@@ -510,12 +766,64 @@ void policarpo::Player::get_next_track() {
         break;
       } else {
         m_current = m_queue[m_current_index];
-        std::cout << "[Player] LOOP_ALL next track is " << m_current->title << " for guild " << m_guild_id << "\n";
+        std::cout << "[Player] LOOP_ALL next track is " << track_get(*m_current).title << " for guild " << m_guild_id << "\n";
         break;
       }
   }
 }
 
+std::optional<policarpo::TrackHandle> policarpo::Player::peek_next_track() const {
+  std::vector<TrackHandle> next = upcoming_tracks(1);
+  if (next.empty()) return std::nullopt;
+  return next.front();
+}
+
+std::vector<policarpo::TrackHandle> policarpo::Player::upcoming_tracks(std::size_t count) const {
+  std::lock_guard lk(m_mu);
+  std::vector<TrackHandle> upcoming;
+  switch (m_loop_mode) {
+    case LOOP_CURRENT:
+      if (m_current && count > 0) upcoming.push_back(*m_current);
+      break;
+    case LOOP_ONCE:
+      // Once more, then on as with the loop off
+      if (m_current && count > 0) upcoming.push_back(*m_current);
+      [[fallthrough]];
+    case LOOP_OFF:
+      for (std::size_t i = m_current_index + 1; i < m_queue.size() && upcoming.size() < count; ++i) {
+        upcoming.push_back(m_queue[i]);
+      }
+      break;
+    case LOOP_ALL:
+      for (std::size_t step = 1; step <= m_queue.size() && upcoming.size() < count; ++step) {
+        upcoming.push_back(m_queue[(m_current_index + step) % m_queue.size()]);
+      }
+      break;
+  }
+  return upcoming;
+}
+
+void policarpo::Player::update_cache_window() {
+  std::vector<TrackHandle> next = upcoming_tracks(page_cache_prefetch_tracks());
+  std::string current;
+  int channel_bitrate = 0;
+  {
+    std::lock_guard lk(m_mu);
+    if (m_current) current = track_get(*m_current).id;
+    channel_bitrate = m_channel_bitrate;
+  }
+
+  // Tracks still downloading are skipped, they reach the disk through the
+  // page cache anyway
+  std::vector<UpcomingFile> upcoming;
+  for (TrackHandle track : next) {
+    const Song& song = track_get(track);
+    if (!library_contains(song.id)) continue;
+    upcoming.push_back(UpcomingFile{song.id, playback_path(song.id, song.duration, channel_bitrate)});
+  }
+  page_cache_window(m_guild_id, std::move(current), std::move(upcoming));
+}
+
 policarpo::current_state_t policarpo::Player::get_state() {
   if (m_queue.empty()) {
     if (is_waiting) {
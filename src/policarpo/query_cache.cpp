@@ -0,0 +1,171 @@
+#include "policarpo/query_cache.hpp"
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+namespace policarpo {
+
+namespace {
+  // A week: popular searches keep resolving to the same upload, but a new
+  // re-upload or a taken down video should eventually be noticed
+  QueryCache g_queries{"songs/queries.json", 20000, std::chrono::hours(24 * 7)};
+  std::once_flag g_once;
+
+  // Longer than any sane search, not worth keeping in memory
+  constexpr std::size_t k_max_query_length = 200;
+
+  std::int64_t unix_now() {
+    using namespace std::chrono;
+    return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+  }
+}
+
+void query_cache_init() {
+  std::call_once(g_once, [] { g_queries.load(); });
+}
+
+std::optional<std::string> query_cache_get(std::string_view query) {
+  query_cache_init();
+  std::string key = normalize_query(query);
+  if (key.empty()) return std::nullopt;
+  return g_queries.get(key);
+}
+
+void query_cache_put(std::string_view query, std::string_view id) {
+  query_cache_init();
+  std::string key = normalize_query(query);
+  if (key.empty() || key.size() > k_max_query_length || id.empty()) return;
+  g_queries.put(key, std::string(id));
+}
+
+std::string normalize_query(std::string_view query) {
+  std::string out;
+  out.reserve(query.size());
+
+  bool pending_space = false;
+  for (char c : query) {
+    const auto uc = static_cast<unsigned char>(c);
+    if (std::isspace(uc)) {
+      pending_space = !out.empty();
+      continue;
+    }
+    if (pending_space) out.push_back(' ');
+    pending_space = false;
+    // Only ASCII is folded, UTF-8 bytes pass through untouched
+    out.push_back(uc < 0x80 ? static_cast<char>(std::tolower(uc)) : c);
+  }
+  return out;
+}
+
+QueryCache::QueryCache(std::filesystem::path path, std::size_t capacity, std::chrono::seconds ttl)
+  : m_path(std::move(path)), m_capacity(capacity), m_ttl(ttl) {}
+
+bool QueryCache::expired(const Entry& entry, std::int64_t now) const {
+  return now - entry.resolved_at > m_ttl.count();
+}
+
+void QueryCache::load() {
+  std::ifstream in(m_path, std::ios::binary);
+  if (!in) return;
+
+  // [[query, id, resolved_at], ...] most recently used first. Bounded by
+  // m_capacity so parsing it whole is fine.
+  nlohmann::json data = nlohmann::json::parse(in, nullptr, false);
+  if (!data.is_array()) {
+    std::cerr << "[Query Cache] Warning: " << m_path << " is corrupt, starting empty\n";
+    return;
+  }
+
+  std::lock_guard lk(m_mu);
+  m_lru.clear();
+  m_by_key.clear();
+
+  const std::int64_t now = unix_now();
+  for (const auto& row : data) {
+    if (!row.is_array() || row.size() != 3 || !row[0].is_string() || !row[1].is_string() || !row[2].is_number_integer()) continue;
+
+    Entry entry{row[0].get<std::string>(), row[1].get<std::string>(), row[2].get<std::int64_t>()};
+    if (expired(entry, now) || m_by_key.contains(entry.key)) continue;
+    if (m_lru.size() >= m_capacity) break;
+
+    m_lru.push_back(std::move(entry));
+    m_by_key[m_lru.back().key] = std::prev(m_lru.end());
+  }
+  std::cout << "[Query Cache] Loaded " << m_lru.size() << " resolved queries\n";
+}
+
+void QueryCache::save() {
+  std::lock_guard lk(m_mu);
+  save_locked();
+}
+
+void QueryCache::save_locked() {
+  std::filesystem::create_directories(m_path.parent_path());
+
+  auto tmp = m_path;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      std::cerr << "[Query Cache] Error: could not write " << tmp << "\n";
+      return;
+    }
+
+    auto quote = [](const std::string& s) {
+      return nlohmann::json(s).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    };
+
+    out << "[";
+    bool first = true;
+    for (const Entry& entry : m_lru) {
+      out << (first ? "\n  [" : ",\n  [") << quote(entry.key) << ", " << quote(entry.id) << ", " << entry.resolved_at << "]";
+      first = false;
+    }
+    out << (first ? "]" : "\n]") << "\n";
+    if (!out.flush()) return;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, m_path, ec);
+  if (ec) std::cerr << "[Query Cache] Error: could not replace " << m_path << ": " << ec.message() << "\n";
+}
+
+std::optional<std::string> QueryCache::get(const std::string& key) {
+  std::lock_guard lk(m_mu);
+  auto it = m_by_key.find(key);
+  if (it == m_by_key.end()) return std::nullopt;
+
+  if (expired(*it->second, unix_now())) {
+    m_lru.erase(it->second);
+    m_by_key.erase(it);
+    return std::nullopt;
+  }
+
+  // A hit only refreshes recency, the TTL still counts from the search
+  m_lru.splice(m_lru.begin(), m_lru, it->second);
+  return it->second->id;
+}
+
+void QueryCache::put(const std::string& key, std::string id) {
+  std::lock_guard lk(m_mu);
+  insert_locked(Entry{key, std::move(id), unix_now()});
+  save_locked(); // only after a network search, which costs far more than this
+}
+
+void QueryCache::insert_locked(Entry entry) {
+  if (auto it = m_by_key.find(entry.key); it != m_by_key.end()) {
+    m_lru.erase(it->second);
+    m_by_key.erase(it);
+  }
+
+  m_lru.push_front(std::move(entry));
+  m_by_key[m_lru.front().key] = m_lru.begin();
+
+  while (m_lru.size() > m_capacity) {
+    m_by_key.erase(m_lru.back().key);
+    m_lru.pop_back();
+  }
+}
+
+} // namespace policarpo
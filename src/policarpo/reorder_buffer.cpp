@@ -0,0 +1,37 @@
+#include "policarpo/reorder_buffer.hpp"
+#include <vector>
+
+namespace policarpo {
+
+std::uint64_t ReorderBuffer::reserve() {
+  std::lock_guard lk(m_mu);
+  return m_next_slot++;
+}
+
+void ReorderBuffer::complete(std::uint64_t slot, std::function<void()> commit) {
+  std::unique_lock lk(m_mu);
+  m_ready.emplace(slot, std::move(commit));
+  if (m_draining) return;
+  m_draining = true;
+
+  while (true) {
+    std::vector<std::function<void()>> batch;
+    for (auto it = m_ready.begin(); it != m_ready.end() && it->first == m_next_commit; it = m_ready.erase(it)) {
+      batch.push_back(std::move(it->second));
+      ++m_next_commit;
+    }
+    if (batch.empty()) {
+      m_draining = false;
+      return;
+    }
+
+    // Commits touch the player and reply to Discord, never under our lock
+    lk.unlock();
+    for (auto& fn : batch) {
+      if (fn) fn();
+    }
+    lk.lock();
+  }
+}
+
+} // namespace policarpo
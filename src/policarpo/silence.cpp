@@ -0,0 +1,54 @@
+#include "policarpo/silence.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace policarpo {
+
+namespace {
+  // -60 dBFS, below anything a listener would miss
+  constexpr float k_threshold = 0.001f;
+
+  constexpr std::int64_t k_packet_frames = 960;
+  constexpr std::int64_t k_frames_per_ms = 48;
+
+  // Kept before the first sound and after the last one, fades and attacks
+  // aren't cut short
+  constexpr std::int64_t k_lead_margin = 100 * k_frames_per_ms;
+  constexpr std::int64_t k_tail_margin = 300 * k_frames_per_ms;
+
+  // Less than this isn't noticeable, leave the track alone
+  constexpr std::int64_t k_min_trim = 1000 * k_frames_per_ms;
+}
+
+void SilenceDetector::add(const float* samples, std::size_t frames) {
+  const std::size_t count = frames * 2;
+  std::size_t first = count;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (std::abs(samples[i]) > k_threshold) {
+      first = i;
+      break;
+    }
+  }
+  if (first < count) {
+    std::size_t last = count - 1;
+    while (std::abs(samples[last]) <= k_threshold) --last;
+    if (m_first_sound < 0) m_first_sound = m_frames + static_cast<std::int64_t>(first / 2);
+    m_last_sound = m_frames + static_cast<std::int64_t>(last / 2);
+  }
+  m_frames += static_cast<std::int64_t>(frames);
+}
+
+SilenceTrim SilenceDetector::result() const {
+  // All silence: nothing sensible to cut, play it as is
+  if (m_first_sound < 0) return {};
+
+  SilenceTrim trim;
+  // Whole packets only, the feeder skips and stops on packet boundaries
+  std::int64_t lead = std::max<std::int64_t>(0, m_first_sound - k_lead_margin) / k_packet_frames * k_packet_frames;
+  std::int64_t tail = std::max<std::int64_t>(0, m_frames - 1 - m_last_sound - k_tail_margin) / k_packet_frames * k_packet_frames;
+  if (lead >= k_min_trim) trim.start = std::chrono::milliseconds(lead / k_frames_per_ms);
+  if (tail >= k_min_trim) trim.end = std::chrono::milliseconds(tail / k_frames_per_ms);
+  return trim;
+}
+
+} // namespace policarpo
@@ -1,8 +1,23 @@
 #include "policarpo/manager.hpp"
 #include "policarpo/player.hpp"
+#include "policarpo/bitrate_tiers.hpp"
 #include "policarpo/voice_session.hpp"
 #include "policarpo/song_manager.hpp"
 #include "policarpo/track_index.hpp"
+#include "policarpo/library.hpp"
+#include "policarpo/download_scheduler.hpp"
+#include "policarpo/negative_cache.hpp"
+#include "policarpo/opus_normalizer.hpp"
+#include "policarpo/query_cache.hpp"
+#include "policarpo/title_search.hpp"
+#include "policarpo/track_metadata.hpp"
+#include "policarpo/track_analysis.hpp"
+#include "policarpo/track_storage.hpp"
+#include "policarpo/track_verifier.hpp"
+#include "policarpo/transcoder.hpp"
+#include "policarpo/video_id.hpp"
+#include "policarpo/webm_remux.hpp"
+#include "policarpo/youtube_url.hpp"
 #include <chrono>
 #include <filesystem>
 #include <array>
@@ -75,73 +90,138 @@ std::string run_command(const std::string& cmd) {
     return result;
 }
 
+namespace {
+  // Renames a finished partial output over its final name
+  bool move_into_place(const std::filesystem::path& partial, const std::filesystem::path& output, std::string& output_file) {
+      std::error_code ec;
+      std::filesystem::rename(partial, output, ec);
+      if (ec) {
+          std::cerr << "[Song Manager] Error moving encoded file into place: " << ec.message() << std::endl;
+          std::filesystem::remove(partial, ec);
+          return false;
+      }
+      output_file = output.string();
+      return true;
+  }
+
+  std::filesystem::path partial_path(const std::filesystem::path& output) {
+      std::filesystem::path partial = output;
+      partial += ".part";
+      return partial;
+  }
+}
+
 bool reencode_to_opus(std::string_view input_file, std::string& output_file) {
-    output_file = std::string(input_file) + ".converted.opus";
-    std::string command = "ffmpeg -i \"" + std::string(input_file) + "\" -c:a libopus \"" + output_file + "\" -y";
-    int result = std::system(command.c_str());
-    return result == 0;
+    std::filesystem::path output(input_file);
+    output.replace_extension(".opus");
+
+    // Encoded next to the source and only moved into place once complete
+    const std::filesystem::path partial = partial_path(output);
+    if (!transcode_to_opus(std::filesystem::path(input_file), partial, storage_bitrate())) {
+        std::error_code ec;
+        std::filesystem::remove(partial, ec);
+        return false;
+    }
+    return move_into_place(partial, output, output_file);
+}
+
+bool convert_to_opus(std::string_view id, std::string_view input_file, std::string& output_file) {
+    const std::filesystem::path input(input_file);
+    std::filesystem::path output = input;
+    output.replace_extension(".opus");
+
+    const std::filesystem::path partial = partial_path(output);
+    std::filesystem::path remuxed = output;
+    remuxed += ".remux";
+    std::error_code ec;
+
+    RemuxResult remux = remux_webm_to_ogg(input, remuxed);
+    if (remux == RemuxResult::Remuxed) {
+        // Copied packets keep whatever framing the source had, bring them to
+        // 20 ms packets and uniform pages
+        std::string reason;
+        NormalizeResult normalized = normalize_ogg_opus(remuxed, partial, &reason);
+        std::filesystem::remove(remuxed, ec);
+        if (normalized == NormalizeResult::Normalized) return move_into_place(partial, output, output_file);
+
+        std::filesystem::remove(partial, ec);
+        if (normalized == NormalizeResult::Invalid) {
+            track_quarantine(input, id, reason);
+            return false;
+        }
+        std::cout << "[Song Manager] " << id << " has frames longer than 20 ms, re-encoding it" << std::endl;
+    } else {
+        std::filesystem::remove(remuxed, ec);
+        if (remux == RemuxResult::Invalid && input.extension() == ".webm") {
+            std::cerr << "[Song Manager] Warning: Could not remux " << input << ", re-encoding it instead" << std::endl;
+        }
+    }
+    return reencode_to_opus(input_file, output_file);
+}
+
+// Permanent problems with the video vs. us failing to talk to YouTube
+FailureReason classify_ytdlp_error(std::string_view error) {
+  for (std::string_view transient : {"Unable to download", "timed out", "HTTP Error 5", "HTTP Error 429", "Connection"}) {
+    if (error.find(transient) != std::string_view::npos) return FailureReason::DownloadFailed;
+  }
+  return FailureReason::Unavailable;
 }
 
 std::string download_opus_track(std::string_view url) {
-  std::string current_dir = std::filesystem::current_path().string();
-  std::string download_dir = current_dir + "/songs";
-  
-  // Check if it's a YouTube URL
-  std::string url_str(url);
-  if (url_str.find("youtube.com") == std::string::npos && 
-      url_str.find("youtu.be") == std::string::npos) {
+  // Check if it's a YouTube URL, and always download the plain watch URL
+  // for its id so tracking parameters or a list= never change what we fetch
+  std::string id = extract_youtube_id(url);
+  if (id.empty()) {
       std::cerr << "[Song Manager] Error: Only YouTube URLs are supported." << std::endl;
       return "";
   }
+  std::string url_str = youtube_watch_url(id);
+
+  // Downloads land in a staging dir the library doesn't watch, track_store
+  // moves them into the sharded layout once they are complete. One dir per
+  // id: jobs run in parallel and two videos can share a title, the file
+  // name stays the title since that's where download_url_track reads it.
+  // The scheduler never runs the same id twice at once.
+  std::error_code ec;
+  const std::filesystem::path job_dir = std::filesystem::absolute(k_incoming_dir / id);
+  std::filesystem::remove_all(job_dir, ec); // whatever a crashed attempt left behind
+  std::filesystem::create_directories(job_dir);
+  std::string download_dir = job_dir.string();
   
-  // First, get video info to check duration and if it's a livestream
-  std::string info_command = "yt-dlp --print duration --print is_live --no-warnings " + url_str + " 2>/dev/null";
-  std::string info_output = run_command(info_command);
-  
-  std::istringstream info_stream(info_output);
-  std::string line, duration_line, is_live_line;
-  bool found_duration = false, found_is_live = false;
-  
-  // Skip warning lines and find the actual data
-  while (std::getline(info_stream, line)) {
-    if (!found_duration && !line.empty() && line.find("WARNING") == std::string::npos && line.find("ERROR") == std::string::npos) {
-      duration_line = line;
-      found_duration = true;
-    } else if (found_duration && !found_is_live && !line.empty() && line.find("WARNING") == std::string::npos && line.find("ERROR") == std::string::npos) {
-      is_live_line = line;
-      found_is_live = true;
-      break;
-    }
+  // Check duration and whether it's a livestream before downloading anything.
+  // Usually answered in process from the search that found the id.
+  auto metadata = track_metadata(id);
+  if (!metadata && negative_cache_get(id)) {
+      std::cerr << "[Song Manager] Error: " << url_str << " can't be downloaded." << std::endl;
+      return "";
   }
-  
-  // Check if it's a livestream
-  if (is_live_line == "True" || is_live_line == "true") {
+
+  if (metadata && metadata->is_live) {
       std::cerr << "[Song Manager] Error: Livestreams are not supported." << std::endl;
+      negative_cache_put(id, FailureReason::Livestream);
       return "";
   }
-  
-  // Check duration (yt-dlp returns duration in seconds)
-  try {
-      if (!duration_line.empty() && duration_line != "NA") {
-          double duration_seconds = std::stod(duration_line);
-          if (duration_seconds > 9000) { // 2.5 hours = 9000 seconds
-              std::cerr << "[Song Manager] Error: Track is longer than 2.5 hours (" << format_duration(std::chrono::milliseconds(static_cast<long long>(duration_seconds * 1000))) << ")." << std::endl;
-              return "";
-          }
-      }
-  } catch (const std::exception& e) {
-      std::cerr << "[Song Manager] Warning: Could not parse duration: " << duration_line << std::endl;
+
+  if (metadata && metadata->duration > k_max_track_duration) {
+      std::cerr << "[Song Manager] Error: Track is longer than 2.5 hours (" << format_duration(metadata->duration) << ")." << std::endl;
+      negative_cache_put(id, FailureReason::TooLong);
+      return "";
   }
   
-  std::string command = "yt-dlp -f bestaudio --extract-audio --audio-format opus "
+  // Fetch the stream as is, preferring Opus so it only has to be copied into
+  // an Ogg file below. Anything else is encoded in process. Both stop near
+  // the bitrate our voice channels can carry, more is only disk and cache.
+  std::string command = "yt-dlp -f \"" + storage_format_selector() + "\" "
                         "--no-playlist --print after_move:filename "
                         "--output \"" + download_dir + "/%(title)s.%(ext)s\""
-                        " " + std::string(url) + " 2>&1";
+                        " " + url_str + " 2>&1";
 
   std::string output = run_command(command);
   // Check if the command was successful
   if (output.empty()) {
       std::cerr << "[Song Manager] Error: Command failed or returned no output." << std::endl;
+      std::filesystem::remove_all(job_dir, ec);
+      negative_cache_put(id, FailureReason::DownloadFailed);
       return "";
   }
   // Check if the output contains an error message
@@ -162,7 +242,23 @@ std::string download_opus_track(std::string_view url) {
   output = last_nonempty;
   output.erase(output.find_last_not_of(" \n\r\t") + 1);
 
-  return output;  // This is the downloaded .opus filename
+  // yt-dlp printed an error and never got to print a finished file
+  if (output.starts_with("ERROR")) {
+      std::filesystem::remove_all(job_dir, ec);
+      negative_cache_put(id, classify_ytdlp_error(output));
+      return "";
+  }
+
+  std::string encoded;
+  if (!convert_to_opus(id, output, encoded)) {
+      std::cerr << "[Song Manager] Error: Could not encode " << output << std::endl;
+      std::filesystem::remove_all(job_dir, ec);
+      negative_cache_put(id, FailureReason::DownloadFailed);
+      return "";
+  }
+  if (encoded != output) std::filesystem::remove(output, ec);
+
+  return encoded;  // This is the downloaded .opus filename
 }
 
 std::chrono::milliseconds get_audio_duration_ms(std::string_view filepath) {
@@ -174,19 +270,23 @@ std::chrono::milliseconds get_audio_duration_ms(std::string_view filepath) {
 }
 
 bool is_track_available(const policarpo::Song& track) {
-    std::string filepath = "songs/" + track.id + ".opus";
-    return file_exists(filepath);
+    return library_contains(track.id);
 }
 
 bool is_track_downloaded(std::string_view url) {
-  std::string id = extract_youtube_id_from_watch_url(url);
+  std::string id = extract_youtube_id(url);
   if (id.empty()) return false;
 
-  std::string filepath = "songs/" + id + ".opus";
-  return file_exists(filepath);
+  return library_contains(id);
 }
 
 std::optional<Song> download_url_track(std::string_view url) {
+    std::string id = extract_youtube_id(url);
+    if (id.empty()) {
+        std::cerr << "[Song Manager] Error: No video id in URL: " << url << std::endl;
+        return {};
+    }
+
     std::string filename = download_opus_track(url);
     if (filename.empty()) {
         std::cerr << "[Song Manager] Error: Failed to download track." << std::endl;
@@ -194,7 +294,6 @@ std::optional<Song> download_url_track(std::string_view url) {
     }
 
     std::cout << "[Song Manager] Downloaded file: " << filename << " ]" << "\n";
-    std::string id = std::string(url).substr(std::string(url).find("?v=") + 3, std::string(url).find_first_of("&", std::string(url).find("?v=") + 3) - (std::string(url).find("?v=") + 3));
 
     std::filesystem::path opus_file(filename);
     opus_file.replace_extension(".opus");
@@ -204,24 +303,40 @@ std::optional<Song> download_url_track(std::string_view url) {
         return {};
     }
 
-    // Rename file to id.opus
-    std::filesystem::path new_filename = opus_file.parent_path() / (id + ".opus");
-    try {
-        std::filesystem::rename(opus_file, new_filename);
-        std::cout << "[Song Manager] Renamed file to: " << new_filename << " ]" << "\n";
-    } catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << "[Song Manager] Error renaming file: " << e.what() << std::endl;
+    // Keep original filename as title (without extension)
+    std::string title = std::filesystem::path(filename).stem().string();
+
+    // Store it as id.opus in the sharded layout, the job's staging dir is
+    // done with either way
+    const bool stored = track_store(opus_file, id);
+    std::error_code ec;
+    std::filesystem::remove_all(k_incoming_dir / id, ec);
+    if (!stored) {
+        std::cerr << "[Song Manager] Error storing file: " << opus_file << std::endl;
         return {};
     }
+    library_add(id);
+    std::cout << "[Song Manager] Stored file as: " << track_path(id) << " ]" << "\n";
 
-    std::chrono::milliseconds duration = get_audio_duration_ms(new_filename.string());
-    
-    // Keep original filename as title (without extension)
-    std::string title = std::filesystem::path(filename).stem().string();
+    std::chrono::milliseconds duration = get_audio_duration_ms(track_path(id).string());
     
     return Song { id, title, duration };
 }
 
+std::optional<TrackHandle> fetch_track(const std::string& id, const std::string& title) {
+    std::optional<Song> downloaded = download_url_track(youtube_watch_url(id));
+    if (!downloaded) return std::nullopt;
+
+    // The search title is more reliable than the filename stem
+    if (!title.empty()) downloaded->title = title;
+    TrackHandle handle = policarpo::track_cache_upsert(*downloaded);
+
+    // Measured and checked off the download path, the track can already be played
+    track_analysis_queue(id);
+    track_verify_queue(id);
+    return handle;
+}
+
 nlohmann::json get_youtube_track_info(const std::string_view query) {
     std::vector<yt_search::YTrack> res;
 
@@ -238,77 +353,145 @@ nlohmann::json get_youtube_track_info(const std::string_view query) {
         {"length", res[0].length()}
     });
 
+    // The download that usually follows checks the length, save it a lookup
+    std::string id = extract_youtube_id(res[0].url());
+    auto length = parse_clock_duration(res[0].length());
+    if (!id.empty() && length) {
+        track_metadata_remember(TrackMetadata{id, res[0].title(), *length, false});
+    }
+
     return result;
 
 }
 
-// Minimal ID extractor. not perfect for youtu.be/shorts
-std::string extract_youtube_id_from_watch_url(std::string_view url) {
-  std::string s(url);
-
-  auto vpos = s.find("?v=");
-  if (vpos == std::string::npos) return {};
+// Video id of any YouTube link shape, empty if there is none
+std::string extract_youtube_id(std::string_view url) {
+  auto parsed = parse_youtube_url(url);
+  if (!parsed) return {};
+  return parsed->video_id;
+}
 
-  vpos += 3;
-  auto amp = s.find_first_of("&", vpos);
-  if (amp == std::string::npos) return s.substr(vpos);
-  return s.substr(vpos, amp - vpos);
+// Only links to the playlist page itself, a watch link inside a list plays just that video
+std::string extract_youtube_playlist_id(std::string_view url) {
+  auto parsed = parse_youtube_url(url);
+  if (!parsed || !parsed->video_id.empty()) return {};
+  return parsed->playlist_id;
 }
 
-// Cached load using index (title+duration)
-std::optional<policarpo::Song> load_cached_song_by_id(const std::string& id) {
-  const std::filesystem::path opus_file = "songs/" + id + ".opus";
-  if (!file_exists(opus_file)) return std::nullopt;
+std::vector<Song> list_playlist(std::string_view playlist_id) {
+  // Flat listing only reads the playlist pages, nothing per video
+  std::string command = "yt-dlp --flat-playlist --no-warnings "
+                        "--playlist-end " + std::to_string(k_max_playlist_entries) + " "
+                        "--print \"%(id)s\t%(duration)s\t%(title)s\" "
+                        "\"https://www.youtube.com/playlist?list=" + std::string(playlist_id) + "\" 2>/dev/null";
+  std::string output = run_command(command);
 
-  auto meta = policarpo::track_cache_get(id);
+  std::vector<Song> entries;
+  std::istringstream lines(output);
+  std::string line;
+  while (std::getline(lines, line)) {
+    const auto tab1 = line.find('\t');
+    const auto tab2 = tab1 == std::string::npos ? std::string::npos : line.find('\t', tab1 + 1);
+    if (tab2 == std::string::npos) continue;
 
-  std::string title;
-  std::chrono::milliseconds duration{0};
+    Song song{line.substr(0, tab1), line.substr(tab2 + 1)};
+    if (!is_youtube_video_id(song.id)) continue;
 
-  if (meta) {
-    title = meta->title;
-    duration = meta->duration;
+    // Deleted and private entries still show up, without a duration
+    const std::string duration = line.substr(tab1 + 1, tab2 - tab1 - 1);
+    try {
+      song.duration = std::chrono::milliseconds(static_cast<long long>(std::stod(duration) * 1000));
+    } catch (const std::exception&) {
+      continue;
+    }
+    if (song.duration > k_max_track_duration) continue;
+
+    entries.push_back(std::move(song));
+  }
+  return entries;
+}
+
+// Cached load using index (title+duration)
+std::optional<policarpo::TrackHandle> load_cached_song_by_id(const std::string& id) {
+  if (!library_contains(id)) return std::nullopt;
+  const std::filesystem::path opus_file = track_path(id);
+
+  auto handle = policarpo::track_cache_get(id);
+  if (handle) {
+    const Song& meta = policarpo::track_get(*handle);
+    if (!meta.title.empty() && meta.duration.count() != 0) return handle;
   }
 
+  Song song{id};
+  if (handle) song = policarpo::track_get(*handle);
+
   // Refresh missing fields if needed
-  if (title.empty()) title = id;
-  if (duration.count() == 0) duration = get_audio_duration_ms(opus_file.string());
+  if (song.title.empty()) song.title = id;
+  if (song.duration.count() == 0) song.duration = get_audio_duration_ms(opus_file.string());
 
-  // If index was missing or incomplete, persist what we now know
-  if (!meta || meta->title.empty() || meta->duration.count() == 0) {
-    policarpo::track_cache_upsert(id, {title, duration});
-  }
+  // Index was missing or incomplete, persist what we now know
+  return policarpo::track_cache_upsert(song);
+}
+
+std::optional<Song> resolve_query(std::string_view query) {
+  std::string safe_query = sanitize_search_query(query);
+  nlohmann::json track_info = get_youtube_track_info(safe_query);
+  if (track_info.empty()) return std::nullopt;
+
+  std::string id = extract_youtube_id(track_info["url"].get<std::string>());
+  if (id.empty()) return std::nullopt;
+
+  return Song{id, track_info["title"].get<std::string>()};
+}
 
-  return policarpo::Song{id, title, duration};
+// What is actually sent to the search, and what the query cache is keyed by
+std::string sanitize_search_query(std::string_view query) {
+  std::string safe_query(query);
+  safe_query.erase(std::remove_if(safe_query.begin(), safe_query.end(),
+    [](char c) {
+      return !(isalnum((unsigned char)c) || c == ' ' || c == '-' || c == '_' || c == '.' || c == '/');
+    }), safe_query.end());
+  return safe_query;
 }
 
-void get_track(const std::string_view search_query, std::function<void(std::optional<policarpo::Song>)> callback) {
+std::optional<FailureReason> track_failure_reason(std::string_view search_query) {
+  std::string id;
+  if (is_link(search_query)) {
+    id = extract_youtube_id(search_query);
+  } else if (auto cached_id = query_cache_get(sanitize_search_query(search_query))) {
+    id = *cached_id;
+  }
+  if (id.empty()) return std::nullopt;
+  return negative_cache_get(id);
+}
 
-  std::optional<Song> track;
+void get_track(const std::string_view search_query, std::function<void(std::optional<policarpo::TrackHandle>)> callback) {
+
+  std::optional<TrackHandle> track;
 
   if (is_link(search_query)) {
     std::cout << "[Song Manager] Skipping for link: " << search_query << "\n";
 
-    if (is_track_downloaded(search_query)) {
+    std::string id = extract_youtube_id(search_query);
+    if (id.empty()) {
+      std::cerr << "[Song Manager] Error: not a YouTube video link: " << search_query << "\n";
+    } else if (auto failure = negative_cache_get(id); failure && !library_contains(id)) {
+      std::cerr << "[Song Manager] Skipping " << id << ", failed recently: " << failure_reason_name(*failure) << "\n";
+    } else if (library_contains(id)) {
       std::cout << "[Song Manager] Track already downloaded.\n";
 
-      std::string id = extract_youtube_id_from_watch_url(search_query);
-      if (!id.empty()) {
-        track = load_cached_song_by_id(id);
-        if (track) {
-          std::cout << "[Song Manager] Adding " << track->title << " ]\n";
-        } else {
-          std::cerr << "[Song Manager] Error: cached .opus exists check failed for id=" << id << "\n";
-        }
+      track = load_cached_song_by_id(id);
+      if (track) {
+        std::cout << "[Song Manager] Adding " << policarpo::track_get(*track).title << " ]\n";
+      } else {
+        std::cerr << "[Song Manager] Error: cached .opus exists check failed for id=" << id << "\n";
       }
     } else {
       std::cout << "[Song Manager] Downloading track from URL.\n";
-      track = download_url_track(search_query);
+      track = download_track(id, DownloadPriority::Interactive).get();
 
       if (track) {
-        // Make sure it’s indexed for future cached loads
-        policarpo::track_cache_upsert(track->id, {track->title, track->duration});
-        std::cout << "[Song Manager] Adding " << track->title << " ]\n";
+        std::cout << "[Song Manager] Adding " << policarpo::track_get(*track).title << " ]\n";
       } else {
         std::cerr << "[Song Manager] Error: Failed to download track from URL.\n";
       }
@@ -317,11 +500,37 @@ void get_track(const std::string_view search_query, std::function<void(std::opti
   } else {
     std::cout << "[Song Manager] Searching for query: " << search_query << "\n";
 
-    std::string safe_query = std::string(search_query);
-    safe_query.erase(std::remove_if(safe_query.begin(), safe_query.end(),
-      [](char c) {
-        return !(isalnum((unsigned char)c) || c == ' ' || c == '-' || c == '_' || c == '.' || c == '/');
-      }), safe_query.end());
+    std::string safe_query = sanitize_search_query(search_query);
+
+    // Same search as before and the file is still here: no network at all
+    if (auto cached_id = query_cache_get(safe_query); cached_id && library_contains(*cached_id)) {
+      track = load_cached_song_by_id(*cached_id);
+      if (track) {
+        std::cout << "[Song Manager] Query cache hit, adding " << policarpo::track_get(*track).title << " ]\n";
+        if (callback) callback(track);
+        return;
+      }
+    } else if (auto failure = cached_id ? negative_cache_get(*cached_id) : std::nullopt) {
+      std::cerr << "[Song Manager] Skipping " << *cached_id << ", failed recently: " << failure_reason_name(*failure) << "\n";
+      if (callback) callback(std::nullopt);
+      return;
+    } else if (cached_id && download_in_flight(*cached_id)) {
+      // Usually started speculatively while they were typing this
+      std::cout << "[Song Manager] Joining download already in flight for " << *cached_id << "\n";
+      track = download_track(*cached_id, DownloadPriority::Interactive).get();
+      if (callback) callback(track);
+      return;
+    }
+
+    // Something we already have is clearly what they asked for
+    if (auto match = title_search_best(search_query); match && library_contains(match->id)) {
+      track = load_cached_song_by_id(match->id);
+      if (track) {
+        std::cout << "[Song Manager] Local match (" << match->score << "), adding " << policarpo::track_get(*track).title << " ]\n";
+        if (callback) callback(track);
+        return;
+      }
+    }
 
     nlohmann::json track_info = get_youtube_track_info(safe_query);
     if (track_info.empty()) {
@@ -337,61 +546,41 @@ void get_track(const std::string_view search_query, std::function<void(std::opti
     std::cout << "[Song Manager] Title: " << title << "\n";
     std::cout << "[Song Manager] URL: " << url << "\n";
 
-    std::string id = extract_youtube_id_from_watch_url(url);
+    std::string id = extract_youtube_id(url);
     if (id.empty()) {
       std::cerr << "[Song Manager] Error: could not extract id from url.\n";
       if (callback) callback(std::nullopt);
       return;
     }
+    query_cache_put(safe_query, id);
 
-    if (is_track_downloaded(url)) {
+    if (auto failure = negative_cache_get(id); failure && !library_contains(id)) {
+      std::cerr << "[Song Manager] Skipping " << id << ", failed recently: " << failure_reason_name(*failure) << "\n";
+    } else if (is_track_downloaded(url)) {
       std::cout << "[Song Manager] Track already downloaded.\n";
 
       track = load_cached_song_by_id(id);
       if (track) {
         // Optional: if index had id-title placeholder, upgrade it using fresh title from search
-        if (!track->title.empty() && track->title == id && !title.empty()) {
-          track->title = title;
-          policarpo::track_cache_upsert(id, {track->title, track->duration});
+        if (policarpo::track_get(*track).title == id && !title.empty()) {
+          Song upgraded = policarpo::track_get(*track);
+          upgraded.title = title;
+          track = policarpo::track_cache_upsert(upgraded);
         }
-        std::cout << "[Song Manager] Adding " << track->title << " ]\n";
+        std::cout << "[Song Manager] Adding " << policarpo::track_get(*track).title << " ]\n";
       } else {
         std::cerr << "[Song Manager] Error: cached file missing for id=" << id << "\n";
       }
 
     } else {
       std::cout << "[Song Manager] Downloading track.\n";
-      std::string filename = download_opus_track(url);
+      // Joins a speculative download of the same id if one is already going
+      track = download_track(id, DownloadPriority::Interactive, title).get();
 
-      if (filename.empty()) {
-        std::cerr << "[Song Manager] Error: Failed to download track.\n";
+      if (track) {
+        std::cout << "[Song Manager] Adding " << policarpo::track_get(*track).title << " ]\n";
       } else {
-        std::cout << "[Song Manager] Downloaded file: " << filename << " ]\n";
-
-        std::filesystem::path opus_file(filename);
-        opus_file.replace_extension(".opus");
-
-        if (!file_exists(opus_file)) {
-          std::cerr << "[Song Manager] Error: .opus file not found: " << opus_file << "\n";
-        } else {
-          std::filesystem::path new_filename = opus_file.parent_path() / (id + ".opus");
-          try {
-            std::filesystem::rename(opus_file, new_filename);
-            std::cout << "[Song Manager] Renamed file to: " << new_filename << " ]\n";
-
-            std::chrono::milliseconds duration = get_audio_duration_ms(new_filename.string());
-
-            // Use the title from track_info (more reliable than filename stem)
-            track = Song{id, title, duration};
-
-            // Index it so cached loads show the correct title
-            policarpo::track_cache_upsert(id, {title, duration});
-
-            std::cout << "[Song Manager] Adding " << track->title << " ]\n";
-          } catch (const std::filesystem::filesystem_error& e) {
-            std::cerr << "[Song Manager] Error renaming file: " << e.what() << "\n";
-          }
-        }
+        std::cerr << "[Song Manager] Error: Failed to download track.\n";
       }
     }
   }
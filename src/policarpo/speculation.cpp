@@ -0,0 +1,217 @@
+#include "policarpo/speculation.hpp"
+#include "policarpo/download_scheduler.hpp"
+#include "policarpo/library.hpp"
+#include "policarpo/negative_cache.hpp"
+#include "policarpo/query_cache.hpp"
+#include "policarpo/song_manager.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace policarpo {
+
+namespace {
+  Speculator g_speculator;
+
+  // Only search once the user stops typing for this long
+  constexpr auto k_typing_pause = std::chrono::milliseconds(1500);
+  constexpr std::size_t k_min_query_length = 4;
+
+  // Per guild: one speculative download at a time, and a handful per hour
+  constexpr std::size_t k_max_in_flight_per_guild = 1;
+  constexpr std::size_t k_max_per_hour_per_guild = 10;
+
+  // How long a speculative search waits to be submitted
+  constexpr auto k_resolved_ttl = std::chrono::minutes(10);
+
+  // Same key the query cache uses
+  std::string search_key(std::string_view query) {
+    return normalize_query(sanitize_search_query(query));
+  }
+}
+
+void speculation_enable() {
+  g_speculator.start();
+}
+
+void speculation_typing(dpp::snowflake guild_id, dpp::snowflake user_id, std::string_view typed,
+                        const std::vector<Suggestion>& suggestions) {
+  g_speculator.typing(guild_id, user_id, typed, suggestions);
+}
+
+void speculation_submitted(dpp::snowflake guild_id, dpp::snowflake user_id, std::string_view query) {
+  g_speculator.submitted(guild_id, user_id, query);
+}
+
+Speculator::~Speculator() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_worker.joinable()) m_worker.join();
+}
+
+void Speculator::start() {
+  std::lock_guard lk(m_mu);
+  if (m_running) return;
+  m_running = true;
+  m_worker = std::thread([this] { worker_loop(); });
+  std::cout << "[Speculation] Enabled\n";
+}
+
+void Speculator::typing(std::uint64_t guild_id, std::uint64_t user_id, std::string_view typed,
+                        const std::vector<Suggestion>& suggestions) {
+  std::lock_guard lk(m_mu);
+  if (!m_running) return;
+  const UserKey user{guild_id, user_id};
+
+  // A pasted link needs no search, fetch it right away
+  if (is_link(typed)) {
+    m_pending.erase(user);
+    std::string id = extract_youtube_id(typed);
+    if (!id.empty()) speculate_locked(user, id, {});
+    return;
+  }
+
+  if (!suggestions.empty()) {
+    m_pending.erase(user);
+    // Cached titles are links, nothing to fetch. A recent search may point
+    // at something that is not on disk (anymore).
+    const Suggestion& top = suggestions.front();
+    if (!is_link(top.value)) {
+      if (auto id = query_cache_get(top.value)) speculate_locked(user, *id, {});
+    }
+    return;
+  }
+
+  std::string query = normalize_query(typed);
+  if (query.size() < k_min_query_length) {
+    m_pending.erase(user);
+    return;
+  }
+  m_pending[user] = Pending{std::move(query), std::chrono::steady_clock::now() + k_typing_pause};
+  m_cv.notify_one();
+}
+
+void Speculator::submitted(std::uint64_t guild_id, std::uint64_t user_id, std::string_view query) {
+  std::unique_lock lk(m_mu);
+  if (!m_running) return;
+  const UserKey user{guild_id, user_id};
+  m_pending.erase(user);
+  m_searching.erase(user);
+
+  // A search made while they typed this is a real one now
+  std::string promoted;
+  if (!is_link(query)) {
+    auto resolved = m_resolved.find(search_key(query));
+    if (resolved != m_resolved.end()) {
+      if (std::chrono::steady_clock::now() < resolved->second.expires) promoted = std::move(resolved->second.id);
+      m_resolved.erase(resolved);
+    }
+  }
+
+  auto target = m_targets.find(user);
+  if (target != m_targets.end()) {
+    std::string id;
+    if (is_link(query)) {
+      id = extract_youtube_id(query);
+    } else if (!promoted.empty()) {
+      id = promoted;
+    } else if (auto cached = query_cache_get(sanitize_search_query(query))) {
+      id = *cached;
+    }
+
+    // Same id: /play joins the download and raises its priority
+    if (id != target->second) drop_target_locked(user);
+    m_targets.erase(user);
+  }
+  lk.unlock();
+
+  // Before /play looks the query up, it runs right after this
+  if (!promoted.empty()) query_cache_put(sanitize_search_query(query), promoted);
+}
+
+void Speculator::drop_target_locked(const UserKey& user) {
+  auto target = m_targets.find(user);
+  if (target == m_targets.end()) return;
+  download_cancel_speculative(target->second);
+  m_targets.erase(target);
+}
+
+void Speculator::speculate_locked(const UserKey& user, const std::string& id, std::string title) {
+  if (library_contains(id) || negative_cache_get(id)) return;
+
+  auto target = m_targets.find(user);
+  if (target != m_targets.end() && target->second == id) return;
+  drop_target_locked(user);
+
+  const auto guild_id = user.first;
+  std::size_t in_flight = 0;
+  for (const auto& [other, other_id] : m_targets) {
+    if (other.first == guild_id && download_in_flight(other_id)) ++in_flight;
+  }
+  if (in_flight >= k_max_in_flight_per_guild) return;
+
+  auto& started = m_started[guild_id];
+  const auto now = std::chrono::steady_clock::now();
+  while (!started.empty() && now - started.front() > std::chrono::hours(1)) started.pop_front();
+  if (started.size() >= k_max_per_hour_per_guild) return;
+
+  started.push_back(now);
+  m_targets[user] = id;
+  std::cout << "[Speculation] Prefetching " << id << " for guild " << guild_id << "\n";
+  download_track(id, DownloadPriority::Speculative, std::move(title));
+}
+
+void Speculator::worker_loop() {
+  std::unique_lock lk(m_mu);
+  while (!m_stop) {
+    if (m_pending.empty()) {
+      m_cv.wait(lk);
+      continue;
+    }
+
+    auto next = std::min_element(m_pending.begin(), m_pending.end(),
+      [](const auto& a, const auto& b) { return a.second.due < b.second.due; });
+    if (std::chrono::steady_clock::now() < next->second.due) {
+      m_cv.wait_until(lk, next->second.due);
+      continue;
+    }
+
+    const UserKey user = next->first;
+    const std::string query = std::move(next->second.query);
+    m_pending.erase(next);
+    m_searching.insert(user);
+
+    const std::string key = search_key(query);
+    std::optional<std::string> id;
+    if (auto resolved = m_resolved.find(key); resolved != m_resolved.end() && std::chrono::steady_clock::now() < resolved->second.expires) {
+      id = resolved->second.id;
+    }
+
+    // The search goes over the network, don't hold up autocomplete meanwhile
+    lk.unlock();
+    if (!id) id = query_cache_get(sanitize_search_query(query));
+    std::string title;
+    std::optional<std::string> searched;
+    if (!id) {
+      if (auto resolved = resolve_query(query)) {
+        id = searched = resolved->id;
+        title = resolved->title;
+      }
+    }
+    lk.lock();
+
+    if (searched) {
+      const auto now = std::chrono::steady_clock::now();
+      std::erase_if(m_resolved, [&](const auto& entry) { return entry.second.expires <= now; });
+      m_resolved[key] = Resolved{*searched, now + k_resolved_ttl};
+    }
+
+    // They kept typing or submitted while we searched
+    if (m_searching.erase(user) == 0 || m_pending.contains(user) || !id) continue;
+    speculate_locked(user, *id, std::move(title));
+  }
+}
+
+} // namespace policarpo
@@ -0,0 +1,84 @@
+#include "policarpo/suggestions.hpp"
+#include "policarpo/library.hpp"
+#include "policarpo/query_cache.hpp"
+#include "policarpo/song_manager.hpp"
+#include "policarpo/title_search.hpp"
+#include "policarpo/youtube_url.hpp"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace policarpo {
+
+namespace {
+  // Discord rejects choice names and values longer than this
+  constexpr std::size_t k_max_choice_length = 100;
+
+  // Recent searches only fill the top of the list, titles get the rest
+  constexpr std::size_t k_max_recent = 5;
+  constexpr std::size_t k_recent_per_guild = 64;
+
+  // Per guild, most recent first. One guild's searches are nobody else's
+  // business.
+  std::mutex g_recent_mu;
+  std::unordered_map<std::uint64_t, std::deque<std::string>> g_recent;
+
+  std::vector<std::string> recent_searches(std::uint64_t guild_id) {
+    std::lock_guard lk(g_recent_mu);
+    auto it = g_recent.find(guild_id);
+    if (it == g_recent.end()) return {};
+    return {it->second.begin(), it->second.end()};
+  }
+
+  // Cut at a character boundary, Discord counts characters not bytes
+  std::string truncate_utf8(std::string_view text, std::size_t max_chars) {
+    std::size_t chars = 0;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+      if ((static_cast<unsigned char>(text[i]) & 0xC0) != 0x80 && chars++ == max_chars) {
+        return std::string(text.substr(0, i));
+      }
+    }
+    return std::string(text);
+  }
+}
+
+void suggestions_record(std::uint64_t guild_id, std::string_view query) {
+  if (is_link(query)) return;
+  std::string normalized = normalize_query(query);
+  if (normalized.empty() || normalized.size() > k_max_choice_length) return;
+
+  std::lock_guard lk(g_recent_mu);
+  auto& recent = g_recent[guild_id];
+  std::erase(recent, normalized);
+  recent.push_front(std::move(normalized));
+  if (recent.size() > k_recent_per_guild) recent.pop_back();
+}
+
+std::vector<Suggestion> suggest_tracks(std::uint64_t guild_id, std::string_view typed, std::size_t limit) {
+  std::vector<Suggestion> out;
+  if (is_link(typed) || limit == 0) return out;
+
+  const std::string query = normalize_query(typed);
+  for (const std::string& recent : recent_searches(guild_id)) {
+    if (out.size() >= std::min(limit, k_max_recent)) break;
+    if (recent.find(query) == std::string::npos) continue;
+    out.push_back(Suggestion{recent, recent});
+  }
+  if (query.empty()) return out;
+
+  // Only what is on disk, picking one of these never waits for a download
+  auto cached = title_search_complete(typed, limit - out.size(), [](std::string_view id) {
+    return library_contains(id);
+  });
+  for (const Song& song : cached) {
+    const std::string length = " (" + format_duration(song.duration) + ")";
+    out.push_back(Suggestion{
+      truncate_utf8(song.title, k_max_choice_length - length.size()) + length,
+      youtube_watch_url(song.id),
+    });
+  }
+  return out;
+}
+
+} // namespace policarpo
@@ -0,0 +1,261 @@
+#include "policarpo/title_search.hpp"
+#include "policarpo/track_index.hpp"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <mutex>
+
+namespace policarpo {
+
+namespace {
+  TitleIndex g_titles;
+  std::once_flag g_once;
+
+  // A query has to be mostly made of a cached title to skip the search, and
+  // long enough (roughly one 4 letter word) that this means something
+  constexpr double k_min_score = 0.9;
+  constexpr std::size_t k_min_query_trigrams = 6;
+
+  // Long titles only get their first words indexed for prefix lookups
+  constexpr std::size_t k_max_word_starts = 12;
+  constexpr std::size_t k_max_tail = 1024;
+
+  // Distinct trigrams of a folded text, each packed into the low 24 bits of a key
+  std::vector<std::uint64_t> trigrams_of(std::string_view folded) {
+    std::vector<std::uint64_t> out;
+
+    while (!folded.empty()) {
+      const std::size_t end = folded.find(' ');
+      const std::string word = " " + std::string(folded.substr(0, end)) + " ";
+      folded = end == std::string_view::npos ? std::string_view{} : folded.substr(end + 1);
+
+      for (std::size_t i = 0; i + 3 <= word.size(); ++i) {
+        out.push_back((std::uint64_t(static_cast<unsigned char>(word[i])) << 16) |
+                      (std::uint64_t(static_cast<unsigned char>(word[i + 1])) << 8) |
+                      std::uint64_t(static_cast<unsigned char>(word[i + 2])));
+      }
+    }
+
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+  }
+}
+
+std::string fold_title(std::string_view text) {
+  std::string out;
+  out.reserve(text.size());
+
+  bool pending_space = false;
+  for (char c : text) {
+    const auto uc = static_cast<unsigned char>(c);
+    // UTF-8 bytes are kept as they are, ASCII punctuation splits words
+    if (uc >= 0x80 || std::isalnum(uc)) {
+      if (pending_space) out.push_back(' ');
+      pending_space = false;
+      out.push_back(uc < 0x80 ? static_cast<char>(std::tolower(uc)) : c);
+    } else {
+      pending_space = !out.empty();
+    }
+  }
+  return out;
+}
+
+void title_search_init() {
+  std::call_once(g_once, [] {
+    // Collected first so the index lock is never held while taking ours
+    std::vector<Song> songs;
+    track_cache_for_each([&songs](const Song& song) { songs.push_back(song); });
+
+    g_titles.assign(songs);
+    std::cout << "[Title Search] Indexed " << g_titles.size() << " titles\n";
+  });
+}
+
+void title_search_add(const Song& song) {
+  title_search_init();
+  g_titles.add(song);
+}
+
+void title_search_remove(std::string_view id) {
+  title_search_init();
+  g_titles.remove(id);
+}
+
+std::optional<TitleMatch> title_search_best(std::string_view query) {
+  title_search_init();
+  return g_titles.best(query, k_min_score);
+}
+
+std::vector<Song> title_search_complete(std::string_view prefix, std::size_t limit,
+                                        const std::function<bool(std::string_view id)>& keep) {
+  title_search_init();
+  return g_titles.complete(prefix, limit, keep);
+}
+
+void TitleIndex::add(const Song& song) {
+  std::unique_lock lk(m_mu);
+  add_locked(song);
+  if (m_tail.size() >= k_max_tail) merge_tail_locked();
+  if (m_dead > 1024 && m_dead * 4 > m_docs.size()) compact_locked();
+}
+
+void TitleIndex::assign(const std::vector<Song>& songs) {
+  std::unique_lock lk(m_mu);
+  clear_locked();
+  for (const Song& song : songs) add_locked(song);
+  merge_tail_locked();
+}
+
+void TitleIndex::add_locked(const Song& song) {
+  if (std::uint32_t* existing = m_doc_of.find(song.id)) {
+    Doc& doc = m_docs[*existing];
+    if (doc.song.title == song.title) {
+      doc.song.duration = song.duration;
+      return;
+    }
+    // Postings are append only, retire the old doc instead of editing them
+    doc.live = false;
+    ++m_dead;
+  }
+  if (song.title.empty() || song.title == song.id) {
+    m_doc_of.erase(song.id);
+    return;
+  }
+
+  const auto doc_id = static_cast<std::uint32_t>(m_docs.size());
+  std::string folded = fold_title(song.title);
+
+  const std::vector<std::uint64_t> grams = trigrams_of(folded);
+  for (std::uint64_t gram : grams) m_postings[gram].push_back(doc_id);
+
+  std::size_t starts = 0;
+  for (std::size_t i = 0; i < folded.size() && starts < k_max_word_starts; ++i) {
+    if (i == 0 || folded[i - 1] == ' ') {
+      m_tail.push_back(WordStart{doc_id, static_cast<std::uint32_t>(i)});
+      ++starts;
+    }
+  }
+
+  m_docs.push_back(Doc{song, std::move(folded), static_cast<std::uint32_t>(grams.size()), true});
+  m_doc_of.insert_or_assign(song.id, doc_id);
+}
+
+void TitleIndex::remove(std::string_view id) {
+  std::unique_lock lk(m_mu);
+  std::uint32_t* doc_id = m_doc_of.find(id);
+  if (!doc_id) return;
+  m_docs[*doc_id].live = false;
+  m_doc_of.erase(id);
+  ++m_dead;
+}
+
+std::size_t TitleIndex::size() const {
+  std::shared_lock lk(m_mu);
+  return m_docs.size() - m_dead;
+}
+
+void TitleIndex::clear_locked() {
+  m_docs.clear();
+  m_doc_of.clear();
+  m_postings.clear();
+  m_sorted.clear();
+  m_tail.clear();
+  m_dead = 0;
+}
+
+void TitleIndex::compact_locked() {
+  std::vector<Doc> docs = std::move(m_docs);
+  clear_locked();
+  for (Doc& doc : docs) {
+    if (doc.live) add_locked(doc.song);
+  }
+  merge_tail_locked();
+}
+
+std::string_view TitleIndex::text_at(const WordStart& start) const {
+  return std::string_view(m_docs[start.doc].folded).substr(start.offset);
+}
+
+void TitleIndex::merge_tail_locked() {
+  auto by_text = [this](const WordStart& a, const WordStart& b) { return text_at(a) < text_at(b); };
+  std::sort(m_tail.begin(), m_tail.end(), by_text);
+
+  const auto middle = static_cast<std::ptrdiff_t>(m_sorted.size());
+  m_sorted.insert(m_sorted.end(), m_tail.begin(), m_tail.end());
+  std::inplace_merge(m_sorted.begin(), m_sorted.begin() + middle, m_sorted.end(), by_text);
+  m_tail.clear();
+}
+
+std::optional<TitleMatch> TitleIndex::best(std::string_view query, double min_score) const {
+  const std::vector<std::uint64_t> grams = trigrams_of(fold_title(query));
+  if (grams.size() < k_min_query_trigrams) return std::nullopt;
+
+  std::shared_lock lk(m_mu);
+
+  // Count shared trigrams per doc, only touching docs that share any
+  std::vector<std::uint16_t> shared(m_docs.size(), 0);
+  std::vector<std::uint32_t> touched;
+  for (std::uint64_t gram : grams) {
+    const std::vector<std::uint32_t>* docs = m_postings.find(gram);
+    if (!docs) continue;
+    for (std::uint32_t doc_id : *docs) {
+      if (shared[doc_id]++ == 0) touched.push_back(doc_id);
+    }
+  }
+
+  // Rank by how much of the query the title covers, then prefer titles
+  // with little else in them (Dice)
+  const auto needed = static_cast<std::uint32_t>(min_score * grams.size() + 0.999);
+  const Doc* best = nullptr;
+  double best_score = 0, best_dice = 0;
+  for (std::uint32_t doc_id : touched) {
+    if (shared[doc_id] < needed) continue;
+    const Doc& doc = m_docs[doc_id];
+    if (!doc.live) continue;
+
+    const double score = double(shared[doc_id]) / grams.size();
+    const double dice = 2.0 * shared[doc_id] / double(grams.size() + doc.trigrams);
+    if (score > best_score || (score == best_score && dice > best_dice)) {
+      best = &doc;
+      best_score = score;
+      best_dice = dice;
+    }
+  }
+
+  if (!best) return std::nullopt;
+  return TitleMatch{best->song.id, best_score};
+}
+
+std::vector<Song> TitleIndex::complete(std::string_view prefix, std::size_t limit,
+                                       const std::function<bool(std::string_view id)>& keep) const {
+  const std::string folded = fold_title(prefix);
+  std::vector<Song> out;
+  if (folded.empty() || limit == 0) return out;
+
+  std::shared_lock lk(m_mu);
+  std::vector<std::uint32_t> seen;
+
+  // False once we have enough
+  auto take = [&](const WordStart& start) {
+    const Doc& doc = m_docs[start.doc];
+    if (!doc.live || std::find(seen.begin(), seen.end(), start.doc) != seen.end()) return true;
+    seen.push_back(start.doc);
+    if (keep && !keep(doc.song.id)) return true;
+    out.push_back(doc.song);
+    return out.size() < limit;
+  };
+
+  auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), std::string_view(folded),
+    [this](const WordStart& start, std::string_view text) { return text_at(start) < text; });
+  for (; it != m_sorted.end() && text_at(*it).starts_with(folded); ++it) {
+    if (!take(*it)) return out;
+  }
+
+  for (const WordStart& start : m_tail) {
+    if (text_at(start).starts_with(folded) && !take(start)) return out;
+  }
+  return out;
+}
+
+} // namespace policarpo
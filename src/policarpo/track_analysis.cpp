@@ -0,0 +1,122 @@
+#include "policarpo/track_analysis.hpp"
+#include "policarpo/ogg_reader.hpp"
+#include "policarpo/track_index.hpp"
+#include "policarpo/track_storage.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <opus/opus.h>
+
+namespace policarpo {
+
+namespace {
+  TrackAnalyzer g_analyzer;
+
+  constexpr int k_channels = 2;
+  constexpr int k_max_frame_samples = 5760; // 120 ms, the longest Opus packet
+}
+
+std::optional<TrackAnalysis> analyze_track(const std::filesystem::path& file) {
+  OggOpusReader reader;
+  if (!reader.open(file)) return std::nullopt;
+
+  // Mono decodes as two equal channels, which is also how it gets played
+  int error = OPUS_OK;
+  std::unique_ptr<OpusDecoder, decltype(&opus_decoder_destroy)> decoder(
+    opus_decoder_create(48000, k_channels, &error), opus_decoder_destroy);
+  if (error != OPUS_OK || !decoder) return std::nullopt;
+
+  LoudnessMeter meter;
+  SilenceDetector silence;
+  std::vector<float> pcm(k_max_frame_samples * k_channels);
+  std::vector<unsigned char> packet;
+  std::int64_t granule = -1;
+  int skip = reader.head().pre_skip;
+
+  while (reader.next(packet, granule)) {
+    if (packet.empty()) continue;
+    int samples = opus_decode_float(decoder.get(), packet.data(), static_cast<opus_int32>(packet.size()), pcm.data(), k_max_frame_samples, 0);
+    if (samples < 0) return std::nullopt;
+
+    const int dropped = std::min(skip, samples);
+    skip -= dropped;
+    const float* audio = pcm.data() + dropped * k_channels;
+    meter.add(audio, static_cast<std::size_t>(samples - dropped));
+    silence.add(audio, static_cast<std::size_t>(samples - dropped));
+  }
+  if (reader.failed()) return std::nullopt;
+
+  // Too short to gate counts as silent, so it isn't measured again
+  return TrackAnalysis{meter.result().value_or(Loudness{}), silence.result()};
+}
+
+void track_analysis_queue(const std::string& id) {
+  g_analyzer.submit(id);
+}
+
+TrackAnalyzer::~TrackAnalyzer() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_worker.joinable()) m_worker.join();
+}
+
+void TrackAnalyzer::submit(const std::string& id) {
+  std::lock_guard lk(m_mu);
+  if (m_queued.contains(id)) return;
+  m_queued.insert_or_assign(id, true);
+  m_ids.push_back(id);
+
+  if (!m_worker.joinable()) m_worker = std::thread([this] { worker_loop(); });
+  m_cv.notify_one();
+}
+
+void TrackAnalyzer::worker_loop() {
+  // Same footing as the transcoder, playback always comes first
+  setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), 10);
+
+  while (true) {
+    std::string id;
+    {
+      std::unique_lock lk(m_mu);
+      m_cv.wait(lk, [&] { return m_stop || !m_ids.empty(); });
+      if (m_stop) return;
+      id = std::move(m_ids.front());
+      m_ids.pop_front();
+    }
+    analyze(id);
+
+    std::lock_guard lk(m_mu);
+    m_queued.erase(id);
+  }
+}
+
+void TrackAnalyzer::analyze(const std::string& id) {
+  const auto started = std::chrono::steady_clock::now();
+  std::optional<TrackAnalysis> analysis = analyze_track(track_path(id));
+  if (!analysis) {
+    std::cerr << "[Track Analysis] Warning: could not analyze " << id << "\n";
+    return;
+  }
+
+  // Re-read right before writing, the entry may have changed meanwhile
+  auto handle = track_cache_get(id);
+  if (!handle) return;
+  Song song = track_get(*handle);
+  song.loudness = analysis->loudness;
+  song.trim = analysis->trim;
+  track_cache_upsert(song);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  std::cout << "[Track Analysis] " << id << ": " << analysis->loudness.integrated_lufs << " LUFS, "
+            << analysis->loudness.true_peak_dbtp << " dBTP, silence " << analysis->trim.start.count() << " ms / "
+            << analysis->trim.end.count() << " ms (" << seconds << " s)\n";
+}
+
+} // namespace policarpo
@@ -1,86 +1,339 @@
 #include "policarpo/track_index.hpp"
+#include "policarpo/title_search.hpp"
+#include <cstdlib>
 #include <fstream>
+#include <functional>
+#include <iostream>
 #include <nlohmann/json.hpp>
 
 namespace policarpo {
 
 namespace {
-  TrackIndex g_index{"songs/index.json"};
+  TrackIndex g_index{"songs/index.bin"};
   std::once_flag g_once;
+
+  // How long changes wait in memory before they go into a snapshot
+  constexpr std::chrono::seconds k_flush_interval{5};
+
+  // Streams {"<id>": {"title": ..., "duration_ms": ..., "loudness_lufs": ...,
+  // "true_peak_dbtp": ..., "trim_start_ms": ..., "trim_end_ms": ...}, ...}
+  // straight into Songs without materialising the document.
+  class IndexJsonSax : public nlohmann::json_sax<nlohmann::json> {
+  public:
+    explicit IndexJsonSax(std::function<void(Song)> on_entry)
+      : m_on_entry(std::move(on_entry)) {}
+
+    bool saw_root() const { return m_saw_root; }
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+
+    bool number_float(number_float_t val, const string_t&) override {
+      loudness_field(val);
+      return true;
+    }
+
+    bool number_integer(number_integer_t val) override {
+      if (at_field("duration_ms")) m_song.duration = std::chrono::milliseconds(val);
+      loudness_field(static_cast<double>(val));
+      return true;
+    }
+
+    bool number_unsigned(number_unsigned_t val) override {
+      if (at_field("duration_ms")) m_song.duration = std::chrono::milliseconds(static_cast<long long>(val));
+      loudness_field(static_cast<double>(val));
+      trim_field(static_cast<long long>(val));
+      return true;
+    }
+
+    bool string(string_t& val) override {
+      if (at_field("title")) m_song.title = std::move(val);
+      return true;
+    }
+
+    bool binary(binary_t&) override { return true; }
+
+    bool start_object(std::size_t) override {
+      ++m_depth;
+      if (m_depth == 1) m_saw_root = true;
+      if (m_depth == 2) m_song = Song{m_id};
+      return true;
+    }
+
+    bool end_object() override {
+      if (m_depth == 2 && !m_song.title.empty()) m_on_entry(std::move(m_song));
+      --m_depth;
+      return true;
+    }
+
+    bool start_array(std::size_t) override { ++m_depth; return true; }
+    bool end_array() override { --m_depth; return true; }
+
+    bool key(string_t& val) override {
+      if (m_depth == 1) m_id = std::move(val);
+      else if (m_depth == 2) m_field = std::move(val);
+      return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override {
+      return false;
+    }
+
+  private:
+    bool at_field(std::string_view name) const { return m_depth == 2 && m_field == name; }
+
+    void loudness_field(double val) {
+      if (at_field("loudness_lufs")) {
+        if (!m_song.loudness) m_song.loudness = Loudness{};
+        m_song.loudness->integrated_lufs = static_cast<float>(val);
+      } else if (at_field("true_peak_dbtp")) {
+        if (!m_song.loudness) m_song.loudness = Loudness{};
+        m_song.loudness->true_peak_dbtp = static_cast<float>(val);
+      }
+    }
+
+    void trim_field(long long val) {
+      if (at_field("trim_start_ms")) {
+        if (!m_song.trim) m_song.trim = SilenceTrim{};
+        m_song.trim->start = std::chrono::milliseconds(val);
+      } else if (at_field("trim_end_ms")) {
+        if (!m_song.trim) m_song.trim = SilenceTrim{};
+        m_song.trim->end = std::chrono::milliseconds(val);
+      }
+    }
+
+    std::function<void(Song)> m_on_entry;
+    int m_depth{0};
+    bool m_saw_root{false};
+    std::string m_id;
+    std::string m_field;
+    Song m_song;
+  };
 }
 
 void track_cache_init() {
-  std::call_once(g_once, [] { g_index.load(); });
+  std::call_once(g_once, [] {
+    g_index.load();
+    // Pending changes are written at exit. From atexit, because by the time
+    // g_index is destroyed the track table its handles point into may be gone.
+    std::atexit([] { g_index.shutdown(); });
+  });
 }
 
-std::optional<TrackMeta> track_cache_get(const std::string& id) {
+std::optional<TrackHandle> track_cache_get(const std::string& id) {
   track_cache_init();
   return g_index.get(id);
 }
 
-void track_cache_upsert(const std::string& id, const TrackMeta& meta) {
+TrackHandle track_cache_upsert(const Song& song) {
+  track_cache_init();
+  TrackHandle handle = g_index.upsert(song);
+  title_search_add(song);
+  return handle;
+}
+
+bool track_cache_erase(const std::string& id) {
   track_cache_init();
-  g_index.upsert(id, meta);
+  if (!g_index.erase(id)) return false;
+  title_search_remove(id);
+  return true;
 }
 
-TrackIndex::TrackIndex(std::filesystem::path json_path)
-  : m_path(std::move(json_path)) {}
+std::size_t track_cache_erase_if(const std::function<bool(const std::string&)>& pred) {
+  track_cache_init();
+  // The title index has its own lock, only touched once ours is released
+  const std::vector<std::string> removed = g_index.erase_if(pred);
+  for (const std::string& id : removed) title_search_remove(id);
+  return removed.size();
+}
+
+void track_cache_for_each(const std::function<void(const Song&)>& fn) {
+  track_cache_init();
+  g_index.for_each(fn);
+}
+
+TrackIndex::TrackIndex(std::filesystem::path snapshot_path)
+  : m_path(std::move(snapshot_path)) {}
+
+TrackIndex::~TrackIndex() {
+  shutdown();
+}
+
+void TrackIndex::shutdown() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_flusher.joinable()) m_flusher.join();
+
+  bool dirty;
+  {
+    std::lock_guard lk(m_mu);
+    dirty = m_dirty;
+  }
+  if (dirty) save();
+}
 
 void TrackIndex::load() {
-  std::lock_guard lk(m_mu);
-  m_by_id.clear();
+  {
+    std::lock_guard lk(m_mu);
+    m_by_id.clear();
+    m_interned.clear();
+    m_erased.clear();
 
-  if (!std::filesystem::exists(m_path)) return;
+    if (m_snapshot.open(m_path)) {
+      std::cout << "[Track Index] Mapped " << m_snapshot.size() << " tracks from " << m_path << "\n";
+      return;
+    }
+  }
 
-  std::ifstream in(m_path);
-  if (!in) return;
+  auto legacy = m_path;
+  legacy.replace_extension(".json");
+  if (!std::filesystem::exists(legacy)) return;
 
-  nlohmann::json j;
-  try {
-    in >> j;
-  } catch (...) {
-    return; // corrupt index? ignore for now
+  if (import_json(legacy)) {
+    std::cout << "[Track Index] Imported " << m_snapshot.size() << " tracks from " << legacy << "\n";
   }
+}
 
-  if (!j.is_object()) return;
+bool TrackIndex::import_json(const std::filesystem::path& json_path) {
+  std::ifstream in(json_path, std::ios::binary);
+  if (!in) return false;
 
-  for (auto it = j.begin(); it != j.end(); ++it) {
-    const std::string id = it.key();
-    const auto& val = it.value();
-    if (!val.is_object()) continue;
+  // Imported entries go straight into the next snapshot, they are not
+  // interned until something actually asks for them.
+  std::vector<Song> imported;
+  VideoIdMap<std::size_t> position;
+  IndexJsonSax sax([&](Song song) {
+    if (std::size_t* at = position.find(song.id)) {
+      imported[*at] = std::move(song);
+      return;
+    }
+    position.insert_or_assign(song.id, imported.size());
+    imported.push_back(std::move(song));
+  });
 
-    TrackMeta meta;
-    if (val.contains("title") && val["title"].is_string())
-      meta.title = val["title"].get<std::string>();
-    if (val.contains("duration_ms") && val["duration_ms"].is_number_integer())
-      meta.duration = std::chrono::milliseconds(val["duration_ms"].get<long long>());
+  // Entries parsed before an error are kept, a truncated index still helps
+  if (!nlohmann::json::sax_parse(in, &sax)) {
+    std::cerr << "[Track Index] Warning: " << json_path << " is corrupt, imported what could be read\n";
+  }
+  if (!sax.saw_root()) return false;
 
-    if (!meta.title.empty())
-      m_by_id.emplace(id, std::move(meta));
+  std::lock_guard write_lk(m_write_mu);
+  Captured captured;
+  {
+    std::lock_guard lk(m_mu);
+    for (Song& song : merged_entries_locked()) {
+      if (!position.contains(song.id)) imported.push_back(std::move(song));
+    }
+    captured = capture_locked();
   }
+  return write_snapshot(std::move(imported), captured);
 }
 
-void TrackIndex::save() {
+bool TrackIndex::export_json(const std::filesystem::path& json_path) const {
+  std::ofstream out(json_path, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+
+  // Stream entries out one by one instead of building a DOM first
+  auto quote = [](const std::string& s) {
+    return nlohmann::json(s).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  };
+
   std::lock_guard lk(m_mu);
+  bool first = true;
+  out << "{";
+  auto write_entry = [&](const Song& song) {
+    out << (first ? "\n  " : ",\n  ") << quote(song.id) << ": {\n"
+        << "    \"duration_ms\": " << song.duration.count() << ",\n";
+    if (song.loudness) {
+      out << "    \"loudness_lufs\": " << song.loudness->integrated_lufs << ",\n"
+          << "    \"true_peak_dbtp\": " << song.loudness->true_peak_dbtp << ",\n";
+    }
+    if (song.trim) {
+      out << "    \"trim_start_ms\": " << song.trim->start.count() << ",\n"
+          << "    \"trim_end_ms\": " << song.trim->end.count() << ",\n";
+    }
+    out << "    \"title\": " << quote(song.title) << "\n  }";
+    first = false;
+  };
 
-  nlohmann::json j = nlohmann::json::object();
-  for (const auto& [id, meta] : m_by_id) {
-    j[id] = {
-      {"title", meta.title},
-      {"duration_ms", meta.duration.count()}
-    };
+  m_snapshot.for_each([&](const Song& song) {
+    if (!m_by_id.contains(song.id) && !m_erased.contains(song.id)) write_entry(song);
+  });
+  m_by_id.for_each([&](const std::string&, TrackHandle handle) {
+    write_entry(track_get(handle));
+  });
+  out << (first ? "}" : "\n}") << "\n";
+  return static_cast<bool>(out.flush());
+}
+
+bool TrackIndex::save() {
+  std::lock_guard write_lk(m_write_mu);
+  std::vector<Song> entries;
+  Captured captured;
+  {
+    std::lock_guard lk(m_mu);
+    entries = merged_entries_locked();
+    captured = capture_locked();
   }
+  return write_snapshot(std::move(entries), captured);
+}
+
+std::vector<Song> TrackIndex::merged_entries_locked() const {
+  std::vector<Song> entries;
+  entries.reserve(m_snapshot.size() + m_by_id.size());
+
+  m_snapshot.for_each([&](Song song) {
+    if (!m_by_id.contains(song.id) && !m_erased.contains(song.id)) entries.push_back(std::move(song));
+  });
+  m_by_id.for_each([&](const std::string&, TrackHandle handle) {
+    entries.push_back(track_get(handle));
+  });
+  return entries;
+}
+
+TrackIndex::Captured TrackIndex::capture_locked() const {
+  Captured captured;
+  captured.generation = m_generation;
+  m_by_id.for_each([&](const std::string& id, TrackHandle handle) {
+    captured.upserts.emplace_back(id, handle);
+  });
+  m_erased.for_each([&](const std::string& id, bool) {
+    captured.erased.push_back(id);
+  });
+  return captured;
+}
+
+void TrackIndex::mark_dirty_locked() {
+  m_dirty = true;
+  ++m_generation;
+  // Lazily, so nothing is spawned during static initialisation
+  if (!m_flusher.joinable()) m_flusher = std::thread([this] { flush_loop(); });
+}
+
+void TrackIndex::flush_loop() {
+  std::unique_lock lk(m_mu);
+  while (!m_stop) {
+    m_cv.wait_for(lk, k_flush_interval, [&] { return m_stop; });
+    if (!m_dirty || m_stop) continue;
+    lk.unlock();
+    save();
+    lk.lock();
+  }
+}
 
+bool TrackIndex::write_snapshot(std::vector<Song> entries, const Captured& captured) {
   std::filesystem::create_directories(m_path.parent_path());
 
   // Atomic-ish write: write temp then rename
   auto tmp = m_path;
   tmp += ".tmp";
 
-  {
-    std::ofstream out(tmp, std::ios::trunc);
-    if (!out) return;
-    out << j.dump(2);
+  if (!TrackSnapshot::write(tmp, std::move(entries))) {
+    std::cerr << "[Track Index] Error: could not write " << tmp << "\n";
+    return false;
   }
 
   std::error_code ec;
@@ -90,21 +343,84 @@ void TrackIndex::save() {
     std::filesystem::remove(m_path, ec);
     std::filesystem::rename(tmp, m_path, ec);
   }
+
+  TrackSnapshot fresh;
+  if (!fresh.open(m_path)) return false;
+
+  // Only what was captured is in the new snapshot. Anything upserted or
+  // erased again during the write stays pending.
+  std::lock_guard lk(m_mu);
+  m_snapshot.swap(fresh);
+  for (const auto& [id, handle] : captured.upserts) {
+    if (const TrackHandle* pending = m_by_id.find(id); pending && *pending == handle) m_by_id.erase(id);
+  }
+  for (const std::string& id : captured.erased) m_erased.erase(id);
+  m_interned.clear();
+  m_dirty = m_generation != captured.generation;
+  return true;
 }
 
-std::optional<TrackMeta> TrackIndex::get(const std::string& id) const {
+std::optional<TrackHandle> TrackIndex::get(const std::string& id) const {
   std::lock_guard lk(m_mu);
-  auto it = m_by_id.find(id);
-  if (it == m_by_id.end()) return std::nullopt;
-  return it->second;
+  if (const TrackHandle* handle = m_by_id.find(id)) return *handle;
+  if (const TrackHandle* handle = m_interned.find(id)) return *handle;
+  if (m_erased.contains(id)) return std::nullopt;
+
+  auto song = m_snapshot.find(id);
+  if (!song) return std::nullopt;
+
+  TrackHandle handle = track_intern(*song);
+  m_interned.insert_or_assign(id, handle);
+  return handle;
 }
 
-void TrackIndex::upsert(const std::string& id, TrackMeta meta) {
-  {
-    std::lock_guard lk(m_mu);
-    m_by_id[id] = std::move(meta);
+TrackHandle TrackIndex::upsert(const Song& song) {
+  TrackHandle handle = track_intern(song);
+  std::lock_guard lk(m_mu);
+  m_by_id[song.id] = handle;
+  m_erased.erase(song.id);
+  mark_dirty_locked();
+  return handle;
+}
+
+bool TrackIndex::erase(const std::string& id) {
+  std::lock_guard lk(m_mu);
+  const bool present = m_by_id.contains(id) || (!m_erased.contains(id) && m_snapshot.find(id));
+  if (!present) return false;
+  m_by_id.erase(id);
+  m_interned.erase(id);
+  m_erased.insert_or_assign(id, true);
+  mark_dirty_locked();
+  return true;
+}
+
+std::vector<std::string> TrackIndex::erase_if(const std::function<bool(const std::string&)>& pred) {
+  std::lock_guard lk(m_mu);
+  std::vector<std::string> removed;
+  m_snapshot.for_each([&](const Song& song) {
+    if (!m_by_id.contains(song.id) && !m_erased.contains(song.id) && pred(song.id)) removed.push_back(song.id);
+  });
+  m_by_id.for_each([&](const std::string& id, TrackHandle) {
+    if (pred(id)) removed.push_back(id);
+  });
+
+  for (const std::string& id : removed) {
+    m_by_id.erase(id);
+    m_interned.erase(id);
+    m_erased.insert_or_assign(id, true);
   }
-  save(); // simple + safe; you can batch later if you want
+  if (!removed.empty()) mark_dirty_locked();
+  return removed;
+}
+
+void TrackIndex::for_each(const std::function<void(const Song&)>& fn) const {
+  std::lock_guard lk(m_mu);
+  m_snapshot.for_each([&](const Song& song) {
+    if (!m_by_id.contains(song.id) && !m_erased.contains(song.id)) fn(song);
+  });
+  m_by_id.for_each([&](const std::string&, TrackHandle handle) {
+    fn(track_get(handle));
+  });
 }
 
 } // namespace policarpo
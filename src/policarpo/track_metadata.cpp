@@ -0,0 +1,161 @@
+#include "policarpo/track_metadata.hpp"
+#include "policarpo/negative_cache.hpp"
+#include "policarpo/song_manager.hpp"
+#include "policarpo/youtube_url.hpp"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <nlohmann/json.hpp>
+#include "yt-search/yt-search.h"
+
+namespace policarpo {
+
+namespace {
+  SearchMetadataProvider g_search;
+  YtDlpMetadataProvider g_ytdlp;
+
+  std::mutex g_fixture_mu;
+  std::unique_ptr<FixtureMetadataProvider> g_fixture;
+
+  // Search results are only worth remembering until the download they lead to
+  constexpr std::size_t k_max_remembered = 1024;
+}
+
+std::optional<std::chrono::milliseconds> parse_clock_duration(std::string_view text) {
+  if (text.empty()) return std::nullopt;
+
+  long long seconds = 0;
+  long long part = 0;
+  bool digits = false;
+  for (char c : text) {
+    if (c >= '0' && c <= '9') {
+      part = part * 10 + (c - '0');
+      digits = true;
+    } else if (c == ':' && digits) {
+      seconds = seconds * 60 + part;
+      part = 0;
+      digits = false;
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (!digits) return std::nullopt;
+  return std::chrono::seconds(seconds * 60 + part);
+}
+
+void SearchMetadataProvider::remember(const TrackMetadata& metadata) {
+  std::lock_guard lk(m_mu);
+  if (m_recent.size() >= k_max_remembered) m_recent.clear();
+  m_recent.insert_or_assign(metadata.id, metadata);
+}
+
+std::optional<TrackMetadata> SearchMetadataProvider::lookup(std::string_view id) {
+  {
+    std::lock_guard lk(m_mu);
+    if (const TrackMetadata* known = m_recent.find(id)) return *known;
+  }
+
+  yt_search::YSearchResult data = yt_search::search(std::string(id));
+  for (const auto& result : data.trackResults()) {
+    if (extract_youtube_id(result.url()) != id) continue;
+
+    // Live streams and premieres come without a length, let yt-dlp tell which
+    auto duration = parse_clock_duration(result.length());
+    if (!duration) return std::nullopt;
+
+    TrackMetadata metadata{std::string(id), result.title(), *duration, false};
+    remember(metadata);
+    return metadata;
+  }
+  return std::nullopt;
+}
+
+std::optional<TrackMetadata> YtDlpMetadataProvider::lookup(std::string_view id) {
+  std::string command = "yt-dlp --print duration --print is_live --print title --no-warnings " + youtube_watch_url(id) + " 2>&1";
+  std::string output = run_command(command);
+
+  std::istringstream stream(output);
+  std::string line;
+  std::vector<std::string> fields;
+  while (std::getline(stream, line)) {
+    if (line.starts_with("ERROR")) {
+      std::cerr << "[Track Metadata] yt-dlp error for " << id << ": " << line << std::endl;
+      if (fields.empty()) negative_cache_put(id, classify_ytdlp_error(line));
+      return std::nullopt;
+    }
+    if (line.empty() || line.starts_with("WARNING")) continue;
+    fields.push_back(line);
+  }
+  if (fields.size() < 2) return std::nullopt;
+
+  TrackMetadata metadata{std::string(id)};
+  try {
+    if (fields[0] != "NA") {
+      metadata.duration = std::chrono::milliseconds(static_cast<long long>(std::stod(fields[0]) * 1000));
+    }
+  } catch (const std::exception&) {
+    std::cerr << "[Track Metadata] Warning: Could not parse duration: " << fields[0] << std::endl;
+  }
+  metadata.is_live = fields[1] == "True" || fields[1] == "true";
+  if (fields.size() > 2) metadata.title = fields[2];
+  return metadata;
+}
+
+FixtureMetadataProvider::FixtureMetadataProvider(const std::filesystem::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  nlohmann::json data = nlohmann::json::parse(in, nullptr, false);
+  if (!data.is_object()) {
+    std::cerr << "[Track Metadata] Warning: fixture " << path << " is missing or not a JSON object\n";
+    return;
+  }
+
+  for (const auto& [id, entry] : data.items()) {
+    if (!entry.is_object()) continue;
+    TrackMetadata metadata{id};
+    metadata.title = entry.value("title", std::string{});
+    metadata.duration = std::chrono::milliseconds(entry.value("duration_ms", std::int64_t{0}));
+    metadata.is_live = entry.value("is_live", false);
+    m_entries.insert_or_assign(id, std::move(metadata));
+  }
+}
+
+std::optional<TrackMetadata> FixtureMetadataProvider::lookup(std::string_view id) {
+  if (const TrackMetadata* entry = m_entries.find(id)) return *entry;
+  return std::nullopt;
+}
+
+std::optional<TrackMetadata> track_metadata(std::string_view id) {
+  {
+    std::lock_guard lk(g_fixture_mu);
+    if (g_fixture) {
+      if (auto metadata = g_fixture->lookup(id)) return metadata;
+    }
+  }
+
+  for (MetadataProvider* provider : {static_cast<MetadataProvider*>(&g_search), static_cast<MetadataProvider*>(&g_ytdlp)}) {
+    if (auto metadata = provider->lookup(id)) {
+      #ifdef DEBUG_MODE
+        std::cout << "[Track Metadata] " << id << " from " << provider->name() << "\n";
+      #endif
+      return metadata;
+    }
+    // A definite failure, no point asking the next one
+    if (negative_cache_get(id)) return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+void track_metadata_remember(const TrackMetadata& metadata) {
+  g_search.remember(metadata);
+}
+
+bool track_metadata_use_fixture(const std::filesystem::path& path) {
+  auto fixture = std::make_unique<FixtureMetadataProvider>(path);
+  std::cout << "[Track Metadata] Using fixture " << path << " (" << fixture->size() << " entries)\n";
+
+  std::lock_guard lk(g_fixture_mu);
+  g_fixture = std::move(fixture);
+  return g_fixture->size() > 0;
+}
+
+} // namespace policarpo
@@ -0,0 +1,318 @@
+#include "policarpo/track_snapshot.hpp"
+#include "policarpo/video_id.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace policarpo {
+
+namespace {
+  constexpr char k_magic[8] = {'W', 'A', 'L', 'D', 'O', 'I', 'D', 'X'};
+
+  constexpr std::uint64_t align8(std::uint64_t n) { return (n + 7) & ~std::uint64_t{7}; }
+
+  // Interpolation probes before falling back to plain binary search
+  constexpr int k_max_interpolation_steps = 8;
+
+  // Bytes of Record each version writes, newer versions only append fields
+  constexpr std::uint32_t k_record_sizes[] = {16, 32, 40};
+
+  // Record::flags
+  constexpr std::uint32_t k_has_loudness = 1;
+  constexpr std::uint32_t k_has_trim = 2;
+}
+
+struct TrackSnapshot::Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t record_size;
+  std::uint64_t packed_count;
+  std::uint64_t other_count;
+  std::uint64_t keys_offset;
+  std::uint64_t records_offset;
+  std::uint64_t names_offset;
+  std::uint64_t other_records_offset;
+  std::uint64_t arena_offset;
+  std::uint64_t arena_size;
+};
+
+struct TrackSnapshot::Record {
+  std::uint32_t title_offset;
+  std::uint32_t title_length;
+  std::int64_t duration_ms;
+  // version 2
+  float loudness_lufs;
+  float true_peak_dbtp;
+  std::uint32_t flags;
+  std::uint32_t reserved;
+  // version 3
+  std::int32_t trim_start_ms;
+  std::int32_t trim_end_ms;
+};
+
+struct TrackSnapshot::Name {
+  std::uint32_t offset;
+  std::uint32_t length;
+};
+
+TrackSnapshot::~TrackSnapshot() {
+  close();
+}
+
+bool TrackSnapshot::open(const std::filesystem::path& path) {
+  static_assert(sizeof(Record) == k_record_sizes[k_version - 1], "bump k_version with the record");
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd); // the mapping keeps the file alive
+  if (data == MAP_FAILED) return false;
+
+  m_data = static_cast<const std::byte*>(data);
+  m_size = static_cast<std::size_t>(st.st_size);
+  m_header = reinterpret_cast<const Header*>(m_data);
+
+  const Header& h = *m_header;
+  auto in_bounds = [&](std::uint64_t offset, std::uint64_t bytes) {
+    return offset <= m_size && bytes <= m_size - offset;
+  };
+
+  const bool valid =
+    std::memcmp(h.magic, k_magic, sizeof(k_magic)) == 0 &&
+    h.version >= 1 && h.version <= k_version &&
+    h.record_size >= k_record_sizes[h.version - 1] &&
+    in_bounds(h.keys_offset, h.packed_count * sizeof(std::uint64_t)) &&
+    in_bounds(h.records_offset, h.packed_count * h.record_size) &&
+    in_bounds(h.names_offset, h.other_count * sizeof(Name)) &&
+    in_bounds(h.other_records_offset, h.other_count * h.record_size) &&
+    in_bounds(h.arena_offset, h.arena_size);
+
+  if (!valid) {
+    std::cerr << "[Track Snapshot] Ignoring invalid snapshot: " << path << "\n";
+    close();
+    return false;
+  }
+
+  m_keys = reinterpret_cast<const std::uint64_t*>(m_data + h.keys_offset);
+  return true;
+}
+
+void TrackSnapshot::close() {
+  if (m_data) {
+    munmap(const_cast<std::byte*>(m_data), m_size);
+  }
+  m_data = nullptr;
+  m_size = 0;
+  m_header = nullptr;
+  m_keys = nullptr;
+}
+
+void TrackSnapshot::swap(TrackSnapshot& other) noexcept {
+  std::swap(m_data, other.m_data);
+  std::swap(m_size, other.m_size);
+  std::swap(m_header, other.m_header);
+  std::swap(m_keys, other.m_keys);
+}
+
+std::size_t TrackSnapshot::size() const {
+  if (!m_header) return 0;
+  return m_header->packed_count + m_header->other_count;
+}
+
+std::optional<Song> TrackSnapshot::find(std::string_view id) const {
+  if (!m_header) return std::nullopt;
+
+  if (auto key = pack_video_id(id)) {
+    auto index = find_packed(*key);
+    if (!index) return std::nullopt;
+    return make_song(std::string(id), packed_record(*index));
+  }
+
+  auto index = find_other(id);
+  if (!index) return std::nullopt;
+  return make_song(std::string(id), other_record(*index));
+}
+
+void TrackSnapshot::for_each(const std::function<void(Song)>& fn) const {
+  if (!m_header) return;
+
+  for (std::size_t i = 0; i < m_header->packed_count; ++i) {
+    fn(make_song(unpack_video_id(m_keys[i]), packed_record(i)));
+  }
+
+  const auto* names = reinterpret_cast<const Name*>(m_data + m_header->names_offset);
+  for (std::size_t i = 0; i < m_header->other_count; ++i) {
+    fn(make_song(std::string(arena_string(names[i].offset, names[i].length)), other_record(i)));
+  }
+}
+
+Song TrackSnapshot::make_song(std::string id, const std::byte* record) const {
+  // Copy only what this snapshot has, fields it predates stay zeroed
+  Record rec{};
+  std::memcpy(&rec, record, std::min<std::size_t>(m_header->record_size, sizeof(Record)));
+
+  Song song{std::move(id)};
+  song.title = std::string(arena_string(rec.title_offset, rec.title_length));
+  song.duration = std::chrono::milliseconds(rec.duration_ms);
+  if (rec.flags & k_has_loudness) song.loudness = Loudness{rec.loudness_lufs, rec.true_peak_dbtp};
+  if (rec.flags & k_has_trim) {
+    song.trim = SilenceTrim{std::chrono::milliseconds(rec.trim_start_ms), std::chrono::milliseconds(rec.trim_end_ms)};
+  }
+  return song;
+}
+
+std::string_view TrackSnapshot::arena_string(std::uint32_t offset, std::uint32_t length) const {
+  if (static_cast<std::uint64_t>(offset) + length > m_header->arena_size) return {};
+  return {reinterpret_cast<const char*>(m_data + m_header->arena_offset + offset), length};
+}
+
+const std::byte* TrackSnapshot::packed_record(std::size_t index) const {
+  return m_data + m_header->records_offset + index * m_header->record_size;
+}
+
+const std::byte* TrackSnapshot::other_record(std::size_t index) const {
+  return m_data + m_header->other_records_offset + index * m_header->record_size;
+}
+
+std::optional<std::size_t> TrackSnapshot::find_packed(std::uint64_t key) const {
+  const std::size_t n = m_header->packed_count;
+  if (n == 0) return std::nullopt;
+
+  // Packed ids are close to uniformly distributed, so interpolation usually
+  // lands within a slot or two. Bail out to binary search if it doesn't.
+  std::size_t lo = 0, hi = n - 1;
+  for (int step = 0; step < k_max_interpolation_steps; ++step) {
+    if (key < m_keys[lo] || key > m_keys[hi]) return std::nullopt;
+    if (m_keys[lo] == m_keys[hi]) break;
+
+    const long double fraction = static_cast<long double>(key - m_keys[lo]) / (m_keys[hi] - m_keys[lo]);
+    const std::size_t pos = lo + static_cast<std::size_t>(fraction * (hi - lo));
+    if (m_keys[pos] == key) return pos;
+    if (m_keys[pos] < key) {
+      lo = pos + 1;
+    } else {
+      if (pos == 0) return std::nullopt;
+      hi = pos - 1;
+    }
+    if (lo > hi) return std::nullopt;
+  }
+
+  const std::uint64_t* first = m_keys + lo;
+  const std::uint64_t* last = m_keys + hi + 1;
+  const std::uint64_t* it = std::lower_bound(first, last, key);
+  if (it == last || *it != key) return std::nullopt;
+  return static_cast<std::size_t>(it - m_keys);
+}
+
+std::optional<std::size_t> TrackSnapshot::find_other(std::string_view id) const {
+  const auto* names = reinterpret_cast<const Name*>(m_data + m_header->names_offset);
+  const auto* end = names + m_header->other_count;
+  const auto* it = std::lower_bound(names, end, id, [this](const Name& name, std::string_view value) {
+    return arena_string(name.offset, name.length) < value;
+  });
+  if (it == end || arena_string(it->offset, it->length) != id) return std::nullopt;
+  return static_cast<std::size_t>(it - names);
+}
+
+bool TrackSnapshot::write(const std::filesystem::path& path, std::vector<Song> entries) {
+  std::vector<std::pair<std::uint64_t, const Song*>> packed;
+  std::vector<const Song*> other;
+  packed.reserve(entries.size());
+
+  for (const Song& song : entries) {
+    if (auto key = pack_video_id(song.id)) {
+      packed.emplace_back(*key, &song);
+    } else {
+      other.push_back(&song);
+    }
+  }
+
+  std::sort(packed.begin(), packed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+  std::sort(other.begin(), other.end(), [](const Song* a, const Song* b) { return a->id < b->id; });
+
+  std::string arena;
+  auto add_string = [&arena](const std::string& s) {
+    Name name{static_cast<std::uint32_t>(arena.size()), static_cast<std::uint32_t>(s.size())};
+    arena += s;
+    return name;
+  };
+  auto make_record = [&](const Song& song) {
+    Name title = add_string(song.title);
+    Record record{title.offset, title.length, static_cast<std::int64_t>(song.duration.count())};
+    if (song.loudness) {
+      record.loudness_lufs = song.loudness->integrated_lufs;
+      record.true_peak_dbtp = song.loudness->true_peak_dbtp;
+      record.flags |= k_has_loudness;
+    }
+    if (song.trim) {
+      record.trim_start_ms = static_cast<std::int32_t>(song.trim->start.count());
+      record.trim_end_ms = static_cast<std::int32_t>(song.trim->end.count());
+      record.flags |= k_has_trim;
+    }
+    return record;
+  };
+
+  std::vector<std::uint64_t> keys;
+  std::vector<Record> records;
+  std::vector<Name> names;
+  std::vector<Record> other_records;
+  keys.reserve(packed.size());
+  records.reserve(packed.size());
+
+  for (const auto& [key, song] : packed) {
+    keys.push_back(key);
+    records.push_back(make_record(*song));
+  }
+  for (const Song* song : other) {
+    names.push_back(add_string(song->id));
+    other_records.push_back(make_record(*song));
+  }
+
+  Header h{};
+  std::memcpy(h.magic, k_magic, sizeof(k_magic));
+  h.version = k_version;
+  h.record_size = sizeof(Record);
+  h.packed_count = keys.size();
+  h.other_count = names.size();
+  h.keys_offset = align8(sizeof(Header));
+  h.records_offset = align8(h.keys_offset + keys.size() * sizeof(std::uint64_t));
+  h.names_offset = align8(h.records_offset + records.size() * sizeof(Record));
+  h.other_records_offset = align8(h.names_offset + names.size() * sizeof(Name));
+  h.arena_offset = align8(h.other_records_offset + other_records.size() * sizeof(Record));
+  h.arena_size = arena.size();
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+
+  std::uint64_t written = 0;
+  auto put = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+    static constexpr char k_padding[8] = {};
+    out.write(k_padding, static_cast<std::streamsize>(offset - written));
+    out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    written = offset + bytes;
+  };
+
+  put(0, &h, sizeof(h));
+  put(h.keys_offset, keys.data(), keys.size() * sizeof(std::uint64_t));
+  put(h.records_offset, records.data(), records.size() * sizeof(Record));
+  put(h.names_offset, names.data(), names.size() * sizeof(Name));
+  put(h.other_records_offset, other_records.data(), other_records.size() * sizeof(Record));
+  put(h.arena_offset, arena.data(), arena.size());
+
+  return static_cast<bool>(out.flush());
+}
+
+} // namespace policarpo
@@ -0,0 +1,249 @@
+#include "policarpo/track_storage.hpp"
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+
+namespace policarpo {
+
+namespace {
+  // How old an unreferenced object must be before init removes it
+  constexpr std::chrono::minutes k_orphan_grace{10};
+
+  std::string to_hex(const unsigned char* data, std::size_t size) {
+    static constexpr char k_digits[] = "0123456789abcdef";
+    std::string out(size * 2, '0');
+    for (std::size_t i = 0; i < size; ++i) {
+      out[i * 2] = k_digits[data[i] >> 4];
+      out[i * 2 + 1] = k_digits[data[i] & 0xF];
+    }
+    return out;
+  }
+
+  // Two levels of 256 directories, picked from the first bytes of a hex name
+  std::filesystem::path fan_out(const std::filesystem::path& root, std::string_view hex, std::string_view file) {
+    return root / std::string(hex.substr(0, 2)) / std::string(hex.substr(2, 2)) / std::string(file);
+  }
+
+  std::filesystem::path object_path(const std::string& digest) {
+    return fan_out(k_objects_dir, digest, digest + ".opus");
+  }
+
+  // Replace target with a hard link to object without a window where it is missing
+  bool link_into_place(const std::filesystem::path& object, const std::filesystem::path& target) {
+    std::error_code ec;
+    std::filesystem::create_directories(target.parent_path(), ec);
+
+    auto tmp = target;
+    tmp += ".tmp";
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::create_hard_link(object, tmp, ec);
+    if (ec) {
+      std::cerr << "[Track Storage] Error linking " << target << ": " << ec.message() << "\n";
+      return false;
+    }
+    std::filesystem::rename(tmp, target, ec);
+    if (ec) {
+      std::cerr << "[Track Storage] Error moving " << target << " into place: " << ec.message() << "\n";
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+    return true;
+  }
+
+  // A stored track's object holds the same damaged content. Without it a
+  // download of the same audio gets a fresh object instead of a link back
+  // to the damage. Only done on quarantine, a scan of the objects is fine.
+  void remove_object_of(const std::filesystem::path& file) {
+    struct stat target;
+    if (::stat(file.c_str(), &target) != 0 || target.st_nlink < 2) return;
+
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(k_objects_dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+      struct stat object;
+      if (::stat(it->path().c_str(), &object) == 0 && object.st_dev == target.st_dev && object.st_ino == target.st_ino) {
+        std::error_code remove_ec;
+        std::filesystem::remove(it->path(), remove_ec);
+        return;
+      }
+    }
+  }
+
+  // ab/cd for an id. FNV-1a, ids are short and this only has to spread them evenly.
+  std::string id_shard(std::string_view id) {
+    std::uint32_t hash = 2166136261u;
+    for (char c : id) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 16777619u;
+    }
+    const unsigned char bytes[2] = {static_cast<unsigned char>(hash >> 24), static_cast<unsigned char>(hash >> 16)};
+    return to_hex(bytes, 2);
+  }
+}
+
+std::filesystem::path track_path(std::string_view id) {
+  return fan_out(k_songs_dir, id_shard(id), std::string(id) + ".opus");
+}
+
+std::filesystem::path track_derived_path(std::string_view id, int bitrate) {
+  return fan_out(k_derived_dir, id_shard(id), std::string(id) + "-" + std::to_string(bitrate / 1000) + "k.opus");
+}
+
+std::optional<std::string> track_content_hash(const std::filesystem::path& file) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) return std::nullopt;
+
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) return std::nullopt;
+
+  // Page bodies only: headers carry a random serial and their CRCs, and
+  // the header packets (granule 0) the encoder's vendor string. Bodies in
+  // order are the packets in order, whatever the paging.
+  std::vector<char> buffer(1 << 16);
+  bool ok = true;
+  auto hash = [&](const char* data, std::size_t size) {
+    ok = ok && EVP_DigestUpdate(ctx.get(), data, size) == 1;
+  };
+
+  unsigned char header[27];
+  unsigned char lacing[255];
+  while (ok && in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+    if (std::memcmp(header, "OggS", 4) != 0) {
+      // Not Ogg from here on, all of it counts
+      hash(reinterpret_cast<const char*>(header), sizeof(header));
+      break;
+    }
+    if (!in.read(reinterpret_cast<char*>(lacing), header[26])) {
+      hash(reinterpret_cast<const char*>(header), sizeof(header));
+      hash(reinterpret_cast<const char*>(lacing), static_cast<std::size_t>(in.gcount()));
+      break;
+    }
+    std::size_t body = 0;
+    for (std::size_t i = 0; i < header[26]; ++i) body += lacing[i];
+
+    std::int64_t granule = 0;
+    std::memcpy(&granule, header + 6, sizeof(granule)); // little endian, like the hosts we run on
+    const bool audio = granule != 0;
+    while (body > 0 && in) {
+      in.read(buffer.data(), static_cast<std::streamsize>(std::min(body, buffer.size())));
+      if (audio) hash(buffer.data(), static_cast<std::size_t>(in.gcount()));
+      body -= static_cast<std::size_t>(in.gcount());
+    }
+  }
+  while (ok && in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    hash(buffer.data(), static_cast<std::size_t>(in.gcount()));
+  }
+  if (!ok || in.bad()) return std::nullopt;
+
+  std::array<unsigned char, EVP_MAX_MD_SIZE> digest{};
+  unsigned int length = 0;
+  if (EVP_DigestFinal_ex(ctx.get(), digest.data(), &length) != 1) return std::nullopt;
+  return to_hex(digest.data(), length);
+}
+
+bool track_store(const std::filesystem::path& file, std::string_view id) {
+  auto digest = track_content_hash(file);
+  if (!digest) {
+    std::cerr << "[Track Storage] Error: could not hash " << file << "\n";
+    return false;
+  }
+
+  const std::filesystem::path object = object_path(*digest);
+  std::error_code ec;
+
+  // Damaged objects are removed when their track is quarantined, one
+  // that is here can be shared as is
+  if (std::filesystem::exists(object, ec)) {
+    std::cout << "[Track Storage] " << id << " has the same audio as an existing track, sharing it\n";
+    std::filesystem::remove(file, ec);
+  } else {
+    std::filesystem::create_directories(object.parent_path(), ec);
+    std::filesystem::rename(file, object, ec);
+    if (ec) {
+      std::cerr << "[Track Storage] Error storing " << file << ": " << ec.message() << "\n";
+      return false;
+    }
+  }
+
+  return link_into_place(object, track_path(id));
+}
+
+void track_quarantine(const std::filesystem::path& file, std::string_view id, std::string_view reason) {
+  std::error_code ec;
+  remove_object_of(file);
+  std::filesystem::create_directories(k_quarantine_dir, ec);
+
+  const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  const std::filesystem::path target = k_quarantine_dir / (std::string(id) + "-" + std::to_string(now) + file.extension().string());
+  std::filesystem::rename(file, target, ec);
+  if (ec) {
+    std::cerr << "[Track Storage] Error quarantining " << file << ", deleting it: " << ec.message() << "\n";
+    std::filesystem::remove(file, ec);
+    return;
+  }
+  std::cerr << "[Track Storage] Quarantined " << id << " (" << reason << ") as " << target << "\n";
+}
+
+void track_storage_init() {
+  std::error_code ec;
+  std::filesystem::create_directories(k_objects_dir, ec);
+
+  // Flat layout from older versions: songs/<id>.opus
+  std::vector<std::filesystem::path> flat;
+  for (auto it = std::filesystem::directory_iterator(k_songs_dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    if (it->is_regular_file() && it->path().extension() == ".opus") flat.push_back(it->path());
+  }
+
+  if (!flat.empty()) {
+    std::cout << "[Track Storage] Migrating " << flat.size() << " tracks to the sharded layout\n";
+    std::size_t moved = 0;
+    for (const auto& file : flat) {
+      if (track_store(file, file.stem().string())) ++moved;
+    }
+    std::cout << "[Track Storage] Migrated " << moved << "/" << flat.size() << " tracks\n";
+  }
+
+  // Objects only referenced by themselves lost their last id (deleted by
+  // hand). Recent ones may be a download between its rename into objects
+  // and its link into place.
+  std::size_t orphans = 0;
+  const auto cutoff = std::filesystem::file_time_type::clock::now() - k_orphan_grace;
+  for (auto it = std::filesystem::recursive_directory_iterator(k_objects_dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+    std::error_code link_ec;
+    if (it->is_regular_file() && std::filesystem::hard_link_count(it->path(), link_ec) == 1 && !link_ec &&
+        std::filesystem::last_write_time(it->path(), link_ec) < cutoff && !link_ec) {
+      std::filesystem::remove(it->path(), link_ec);
+      ++orphans;
+    }
+  }
+  if (orphans > 0) {
+    std::cout << "[Track Storage] Removed " << orphans << " unreferenced objects\n";
+  }
+
+  // Copies named <id>-<k>k.opus whose track was deleted, and unfinished ones
+  std::size_t stale = 0;
+  for (auto it = std::filesystem::recursive_directory_iterator(k_derived_dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+    const std::string stem = it->path().stem().string();
+    const std::size_t dash = stem.rfind('-');
+    std::error_code file_ec;
+    if (!it->is_regular_file(file_ec) || dash == std::string::npos) continue;
+    if (it->path().extension() != ".opus" ||
+        (!std::filesystem::exists(track_path(std::string_view(stem).substr(0, dash)), file_ec) && !file_ec)) {
+      std::filesystem::remove(it->path(), file_ec);
+      ++stale;
+    }
+  }
+  if (stale > 0) {
+    std::cout << "[Track Storage] Removed " << stale << " copies of deleted tracks\n";
+  }
+}
+
+} // namespace policarpo
@@ -0,0 +1,59 @@
+#include "policarpo/track_table.hpp"
+#include <mutex>
+#include <stdexcept>
+
+namespace policarpo {
+
+namespace {
+  TrackTable g_table;
+}
+
+TrackHandle track_intern(const Song& song) {
+  return g_table.intern(song);
+}
+
+const Song& track_get(TrackHandle handle) {
+  return g_table.get(handle);
+}
+
+std::optional<TrackHandle> track_find(const std::string& id) {
+  return g_table.find(id);
+}
+
+TrackHandle TrackTable::intern(const Song& song) {
+  std::unique_lock lk(m_mu);
+
+  if (const TrackHandle* existing_handle = m_by_id.find(song.id)) {
+    const Song& existing = m_entries[*existing_handle];
+    if (existing.title == song.title && existing.duration == song.duration && existing.loudness == song.loudness && existing.trim == song.trim) {
+      return *existing_handle;
+    }
+  }
+
+  const auto handle = static_cast<TrackHandle>(m_entries.size());
+  m_entries.push_back(song);
+  m_by_id[song.id] = handle;
+  return handle;
+}
+
+const Song& TrackTable::get(TrackHandle handle) const {
+  std::shared_lock lk(m_mu);
+  if (handle >= m_entries.size()) {
+    throw std::out_of_range("unknown track handle");
+  }
+  return m_entries[handle];
+}
+
+std::optional<TrackHandle> TrackTable::find(const std::string& id) const {
+  std::shared_lock lk(m_mu);
+  const TrackHandle* handle = m_by_id.find(id);
+  if (!handle) return std::nullopt;
+  return *handle;
+}
+
+std::size_t TrackTable::size() const {
+  std::shared_lock lk(m_mu);
+  return m_entries.size();
+}
+
+} // namespace policarpo
@@ -0,0 +1,311 @@
+#include "policarpo/track_verifier.hpp"
+#include "policarpo/download_scheduler.hpp"
+#include "policarpo/library.hpp"
+#include "policarpo/ogg_crc.hpp"
+#include "policarpo/track_index.hpp"
+#include "policarpo/track_storage.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace policarpo {
+
+namespace {
+  TrackVerifier g_verifier;
+
+  constexpr std::size_t k_read_chunk = 1 << 20;
+  constexpr std::size_t k_direct_align = 4096;
+  constexpr std::uint8_t k_flag_eos = 0x04;
+
+  // ioprio_set(2) has no glibc wrapper
+  constexpr int k_ioprio_who_process = 1;
+  constexpr int k_ioprio_class_idle = 3;
+  constexpr int k_ioprio_class_shift = 13;
+
+  std::uint32_t get_le32(const unsigned char* p) {
+    return static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8 |
+           static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+  }
+
+  // Front to back reads that leave the page cache alone: O_DIRECT where
+  // the filesystem has it, otherwise buffered and dropped behind us
+  class SequentialFile {
+  public:
+    explicit SequentialFile(const std::filesystem::path& file)
+      : m_path(file), m_buffer(static_cast<unsigned char*>(std::aligned_alloc(k_direct_align, k_read_chunk)), std::free) {
+      m_fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+      if (m_fd < 0) open_buffered();
+    }
+
+    ~SequentialFile() {
+      if (m_fd < 0) return;
+      if (!m_direct) posix_fadvise(m_fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(m_fd);
+    }
+
+    bool ok() const { return m_fd >= 0 && m_buffer; }
+    const std::string& error() const { return m_error; }
+
+    // Appends the next chunk to out. 0 at the end, -1 on a read error.
+    ssize_t read_into(std::vector<unsigned char>& out) {
+      ssize_t got = pread(m_fd, m_buffer.get(), k_read_chunk, m_offset);
+      if (got < 0 && errno == EINVAL && m_direct) {
+        // Opened fine but this filesystem won't do direct reads after all
+        close(m_fd);
+        open_buffered();
+        if (m_fd < 0) return -1;
+        got = pread(m_fd, m_buffer.get(), k_read_chunk, m_offset);
+      }
+      if (got < 0) {
+        m_error = std::strerror(errno);
+        return -1;
+      }
+      out.insert(out.end(), m_buffer.get(), m_buffer.get() + got);
+      m_offset += got;
+      return got;
+    }
+
+  private:
+    void open_buffered() {
+      m_direct = false;
+      m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (m_fd >= 0) posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    std::filesystem::path m_path;
+    std::unique_ptr<unsigned char, decltype(&std::free)> m_buffer;
+    int m_fd{-1};
+    bool m_direct{true};
+    off_t m_offset{0};
+    std::string m_error;
+  };
+}
+
+void track_verifier_configure(const VerifySettings& settings) {
+  g_verifier.configure(settings);
+}
+
+void track_verify_library() {
+  g_verifier.verify_all();
+}
+
+void track_verify_queue(const std::string& id) {
+  g_verifier.submit(id, true);
+}
+
+std::optional<std::string> verify_ogg_file(const std::filesystem::path& file,
+                                           const std::function<void(std::size_t)>& wait_for_budget) {
+  SequentialFile in(file);
+  if (!in.ok()) return "can't open it";
+
+  std::vector<unsigned char> data;
+  std::size_t pos = 0;
+  bool at_end = false;
+  bool read_failed = false;
+
+  // Makes sure n bytes past pos are buffered, false if the file has fewer
+  auto have = [&](std::size_t n) {
+    while (data.size() - pos < n && !at_end) {
+      data.erase(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(pos));
+      pos = 0;
+      if (wait_for_budget) wait_for_budget(k_read_chunk);
+      const ssize_t got = in.read_into(data);
+      read_failed = got < 0;
+      at_end = got <= 0;
+    }
+    return data.size() - pos >= n;
+  };
+
+  std::size_t pages = 0;
+  bool saw_eos = false;
+  while (have(1)) {
+    if (saw_eos) return "data after the end of stream page";
+    if (!have(27)) break;
+    if (std::memcmp(data.data() + pos, "OggS", 4) != 0 || data[pos + 4] != 0) return "bad header on page " + std::to_string(pages);
+
+    const std::size_t segments = data[pos + 26];
+    if (!have(27 + segments)) break;
+    std::size_t body = 0;
+    for (std::size_t i = 0; i < segments; ++i) body += data[pos + 27 + i];
+    if (!have(27 + segments + body)) break;
+
+    // The stored checksum is computed with its own field zeroed
+    const unsigned char* p = data.data() + pos;
+    unsigned char header[27];
+    std::memcpy(header, p, sizeof(header));
+    std::memset(header + 22, 0, 4);
+    std::uint32_t crc = ogg_crc32(header, sizeof(header));
+    crc = ogg_crc32(p + 27, segments + body, crc);
+    if (crc != get_le32(p + 22)) return "page " + std::to_string(pages) + " checksum mismatch";
+
+    saw_eos = (p[5] & k_flag_eos) != 0;
+    pos += 27 + segments + body;
+    ++pages;
+  }
+
+  if (read_failed) return "read error: " + in.error();
+  if (pos < data.size()) return "cut short inside page " + std::to_string(pages);
+  if (pages == 0) return "empty file";
+  if (!saw_eos) return "no end of stream page, cut short";
+  return std::nullopt;
+}
+
+TrackVerifier::~TrackVerifier() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto& worker : m_workers) worker.join();
+}
+
+void TrackVerifier::configure(const VerifySettings& settings) {
+  std::lock_guard lk(m_mu);
+  m_settings = settings;
+  m_settings.workers = std::clamp<std::size_t>(m_settings.workers, 1, 8);
+}
+
+void TrackVerifier::start_locked() {
+  if (!m_workers.empty()) return;
+  for (std::size_t i = 0; i < m_settings.workers; ++i) {
+    m_workers.emplace_back([this] { worker_loop(); });
+  }
+}
+
+void TrackVerifier::submit(const std::string& id, bool urgent) {
+  std::lock_guard lk(m_mu);
+  if (m_queued.contains(id)) return;
+  m_queued.insert_or_assign(id, false);
+  if (urgent) {
+    m_ids.push_front(id);
+  } else {
+    m_ids.push_back(id);
+  }
+  start_locked();
+  m_cv.notify_one();
+}
+
+void TrackVerifier::verify_all() {
+  std::lock_guard lk(m_mu);
+  if (m_settings.read_mbps <= 0) return;
+  m_list_pending = true;
+  start_locked();
+  m_cv.notify_one();
+}
+
+void TrackVerifier::worker_loop() {
+  // Lowest CPU priority, and the disk only when nothing else wants it
+  setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), 19);
+  syscall(SYS_ioprio_set, k_ioprio_who_process, gettid(), k_ioprio_class_idle << k_ioprio_class_shift);
+
+  while (true) {
+    std::string id;
+    bool list = false;
+    {
+      std::unique_lock lk(m_mu);
+      m_cv.wait(lk, [&] { return m_stop || m_list_pending || !m_ids.empty(); });
+      if (m_stop) return;
+      if (m_list_pending) {
+        m_list_pending = false;
+        list = true;
+      } else {
+        id = std::move(m_ids.front());
+        m_ids.pop_front();
+      }
+    }
+
+    if (list) {
+      list_library();
+      continue;
+    }
+    const bool damaged = verify(id);
+
+    std::lock_guard lk(m_mu);
+    const bool* from_pass = m_queued.find(id);
+    if (from_pass && *from_pass) {
+      if (damaged) ++m_pass_damaged;
+      if (--m_pass_left == 0) {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_pass_started).count();
+        std::cout << "[Track Verifier] Library checked in " << seconds << " s, " << m_pass_damaged << " damaged\n";
+      }
+    }
+    m_queued.erase(id);
+  }
+}
+
+void TrackVerifier::list_library() {
+  std::vector<std::string> ids;
+  std::error_code ec;
+  for (auto it = std::filesystem::directory_iterator(k_songs_dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    const std::filesystem::path dir = it->path();
+    if (!it->is_directory() || dir == k_objects_dir || dir == k_incoming_dir || dir == k_quarantine_dir || dir == k_derived_dir) continue;
+
+    std::error_code walk_ec;
+    for (auto file = std::filesystem::recursive_directory_iterator(dir, walk_ec); !walk_ec && file != std::filesystem::recursive_directory_iterator(); file.increment(walk_ec)) {
+      if (file->path().extension() == ".opus") ids.push_back(file->path().stem().string());
+    }
+  }
+
+  std::lock_guard lk(m_mu);
+  m_pass_left = 0;
+  m_pass_damaged = 0;
+  m_pass_started = std::chrono::steady_clock::now();
+  for (auto& id : ids) {
+    if (m_queued.contains(id)) continue;
+    m_queued.insert_or_assign(id, true); // part of the pass
+    m_ids.push_back(std::move(id));
+    ++m_pass_left;
+  }
+  std::cout << "[Track Verifier] Checking " << m_pass_left << " tracks at up to " << m_settings.read_mbps
+            << " MB/s, CRC kernel: " << ogg_crc_kernel_name() << "\n";
+  m_cv.notify_all();
+}
+
+bool TrackVerifier::verify(const std::string& id) {
+  const std::filesystem::path file = track_path(id);
+  std::error_code ec;
+  std::optional<std::string> reason;
+  if (std::filesystem::exists(file, ec)) {
+    reason = verify_ogg_file(file, [this](std::size_t bytes) { wait_for_budget(bytes); });
+  }
+
+  if (reason) {
+    // The index entry goes with the file, keep its title for the download
+    std::string title;
+    if (auto handle = track_cache_get(id)) title = track_get(*handle).title;
+    std::cerr << "[Track Verifier] " << id << " is damaged (" << *reason << "), downloading it again\n";
+    track_quarantine(file, id, *reason);
+    library_remove(id);
+    download_track(id, DownloadPriority::Background, title);
+  }
+  return reason.has_value();
+}
+
+void TrackVerifier::wait_for_budget(std::size_t bytes) {
+  int mbps = 0;
+  {
+    std::lock_guard lk(m_mu);
+    mbps = m_settings.read_mbps;
+  }
+  if (mbps <= 0) return;
+
+  // One schedule for all workers: each read starts when the budget spent
+  // so far has been paid for at the configured rate
+  const auto cost = std::chrono::microseconds(static_cast<long long>(bytes) / mbps);
+  std::chrono::steady_clock::time_point start;
+  {
+    std::lock_guard lk(m_budget_mu);
+    start = std::max(m_budget_at, std::chrono::steady_clock::now());
+    m_budget_at = start + cost;
+  }
+  std::this_thread::sleep_until(start);
+}
+
+} // namespace policarpo
@@ -0,0 +1,242 @@
+#include "policarpo/transcoder.hpp"
+#include "policarpo/ogg_writer.hpp"
+#include "policarpo/opus_normalizer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <opus/opus.h>
+
+extern char** environ;
+
+namespace policarpo {
+
+namespace {
+  Transcoder g_transcoder;
+
+  constexpr int k_sample_rate = 48000;
+  constexpr int k_channels = 2;
+  constexpr int k_max_packet = 1275 * 3;
+
+  // ffmpeg decoding whatever it is into 48 kHz stereo s16 on a pipe. Spawned
+  // without a shell, titles end up in file names and may contain anything.
+  class PcmPipe {
+  public:
+    explicit PcmPipe(const std::filesystem::path& input) {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC) != 0) return;
+
+      posix_spawn_file_actions_t actions;
+      posix_spawn_file_actions_init(&actions);
+      posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+      const std::string in = input.string();
+      const char* argv[] = {"ffmpeg", "-nostdin", "-v", "error", "-i", in.c_str(), "-vn",
+                            "-f", "s16le", "-ac", "2", "-ar", "48000", "pipe:1", nullptr};
+      if (posix_spawnp(&m_pid, "ffmpeg", &actions, nullptr, const_cast<char**>(argv), environ) != 0) {
+        m_pid = -1;
+      }
+      posix_spawn_file_actions_destroy(&actions);
+      close(fds[1]);
+      m_fd = m_pid > 0 ? fds[0] : (close(fds[0]), -1);
+    }
+
+    ~PcmPipe() { wait(); }
+
+    bool ok() const { return m_fd >= 0; }
+
+    // Fills frame as far as the stream goes, returns samples per channel read
+    int read_frame(opus_int16* frame) {
+      auto* out = reinterpret_cast<char*>(frame);
+      const std::size_t want = sizeof(opus_int16) * k_channels * k_frame_samples;
+      std::size_t got = 0;
+      while (got < want && m_fd >= 0) {
+        ssize_t n = ::read(m_fd, out + got, want - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += static_cast<std::size_t>(n);
+      }
+      return static_cast<int>(got / (sizeof(opus_int16) * k_channels));
+    }
+
+    // Exit status of ffmpeg, true if it decoded everything
+    bool wait() {
+      if (m_fd >= 0) close(m_fd);
+      m_fd = -1;
+      if (m_pid <= 0) return m_status_ok;
+
+      int status = 0;
+      while (waitpid(m_pid, &status, 0) < 0 && errno == EINTR) {}
+      m_pid = -1;
+      m_status_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      return m_status_ok;
+    }
+
+  private:
+    pid_t m_pid{-1};
+    int m_fd{-1};
+    bool m_status_ok{false};
+  };
+
+  double thread_cpu_seconds() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+  }
+}
+
+void transcoder_configure(const TranscodeSettings& settings) {
+  g_transcoder.configure(settings);
+}
+
+bool transcode_to_opus(const std::filesystem::path& input, const std::filesystem::path& output, int bitrate) {
+  return g_transcoder.submit(input, output, bitrate).get();
+}
+
+Transcoder::~Transcoder() {
+  {
+    std::lock_guard lk(m_mu);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto& worker : m_workers) worker.join();
+}
+
+void Transcoder::configure(const TranscodeSettings& settings) {
+  std::lock_guard lk(m_mu);
+  m_settings = settings;
+  m_settings.bitrate = std::clamp(m_settings.bitrate, 6000, 510000);
+  m_settings.complexity = std::clamp(m_settings.complexity, 0, 10);
+}
+
+void Transcoder::start_locked() {
+  if (!m_workers.empty()) return;
+
+  std::size_t count = m_settings.workers;
+  if (count == 0) count = std::max<std::size_t>(std::thread::hardware_concurrency() / 4, 1);
+  std::cout << "[Transcoder] " << count << " workers, " << m_settings.bitrate / 1000 << " kbps, complexity " << m_settings.complexity << "\n";
+
+  for (std::size_t i = 0; i < count; ++i) {
+    m_workers.emplace_back([this] { worker_loop(); });
+  }
+}
+
+std::future<bool> Transcoder::submit(std::filesystem::path input, std::filesystem::path output, int bitrate) {
+  std::lock_guard lk(m_mu);
+  start_locked();
+
+  Job job{std::move(input), std::move(output), bitrate, {}};
+  std::future<bool> result = job.done.get_future();
+  m_jobs.push_back(std::move(job));
+  m_cv.notify_one();
+  return result;
+}
+
+void Transcoder::worker_loop() {
+  // Below the gateway and voice threads, encoding can always wait a bit
+  setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), 10);
+
+  while (true) {
+    Job job;
+    {
+      std::unique_lock lk(m_mu);
+      m_cv.wait(lk, [&] { return m_stop || !m_jobs.empty(); });
+      if (m_stop) return;
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    job.done.set_value(encode(job.input, job.output, job.bitrate));
+  }
+}
+
+bool Transcoder::encode(const std::filesystem::path& input, const std::filesystem::path& output, int bitrate) {
+  TranscodeSettings settings;
+  {
+    std::lock_guard lk(m_mu);
+    settings = m_settings;
+  }
+  if (bitrate > 0) settings.bitrate = std::clamp(bitrate, 6000, 510000);
+
+  const auto started = std::chrono::steady_clock::now();
+  const double cpu_started = thread_cpu_seconds();
+
+  int error = OPUS_OK;
+  std::unique_ptr<OpusEncoder, decltype(&opus_encoder_destroy)> encoder(
+    opus_encoder_create(k_sample_rate, k_channels, OPUS_APPLICATION_AUDIO, &error), opus_encoder_destroy);
+  if (error != OPUS_OK || !encoder) {
+    std::cerr << "[Transcoder] Error creating encoder: " << opus_strerror(error) << "\n";
+    return false;
+  }
+  opus_encoder_ctl(encoder.get(), OPUS_SET_BITRATE(settings.bitrate));
+  opus_encoder_ctl(encoder.get(), OPUS_SET_COMPLEXITY(settings.complexity));
+  opus_encoder_ctl(encoder.get(), OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+
+  opus_int32 lookahead = 0;
+  opus_encoder_ctl(encoder.get(), OPUS_GET_LOOKAHEAD(&lookahead));
+
+  PcmPipe pcm(input);
+  if (!pcm.ok()) {
+    std::cerr << "[Transcoder] Error: could not start ffmpeg to decode " << input << "\n";
+    return false;
+  }
+
+  // 20 ms frames in the normalized page layout, nothing to fix up afterwards
+  OggOpusWriter writer(k_packets_per_page);
+  OpusHead head;
+  head.channels = k_channels;
+  head.pre_skip = static_cast<std::uint16_t>(lookahead);
+  if (!writer.open(output, head, opus_get_version_string(), {std::string(k_layout_tag)})) return false;
+
+  // The decoder throws away pre_skip samples, so the encoder is fed that
+  // much silence past the end and the last granule trims the padding off.
+  std::vector<opus_int16> frame(k_frame_samples * k_channels);
+  std::vector<unsigned char> packet(k_max_packet);
+  std::int64_t input_samples = 0;
+  std::int64_t encoded = 0;
+  bool eof = false;
+
+  while (true) {
+    int got = eof ? 0 : pcm.read_frame(frame.data());
+    if (got < k_frame_samples) {
+      eof = true;
+      std::fill(frame.begin() + got * k_channels, frame.end(), 0);
+    }
+    input_samples += got;
+    if (eof && encoded >= input_samples + lookahead) break;
+
+    opus_int32 bytes = opus_encode(encoder.get(), frame.data(), k_frame_samples, packet.data(), k_max_packet);
+    if (bytes < 0) {
+      std::cerr << "[Transcoder] Error encoding " << input << ": " << opus_strerror(bytes) << "\n";
+      return false;
+    }
+    encoded += k_frame_samples;
+
+    const std::int64_t granule = eof ? std::min(encoded, input_samples + lookahead) : encoded;
+    if (!writer.write_packet(packet.data(), static_cast<std::size_t>(bytes), granule)) return false;
+  }
+
+  if (!pcm.wait() || input_samples == 0) {
+    std::cerr << "[Transcoder] Error: ffmpeg could not decode " << input << "\n";
+    return false;
+  }
+  if (!writer.finish()) {
+    std::cerr << "[Transcoder] Error writing " << output << "\n";
+    return false;
+  }
+
+  const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  const double audio = static_cast<double>(input_samples) / k_sample_rate;
+  std::cout << "[Transcoder] Encoded " << audio << " s of audio at " << settings.bitrate / 1000 << " kbps in " << wall << " s ("
+            << thread_cpu_seconds() - cpu_started << " s encoder CPU) " << input.filename() << "\n";
+  return true;
+}
+
+} // namespace policarpo
@@ -0,0 +1,49 @@
+#include "policarpo/video_id.hpp"
+#include <array>
+
+namespace policarpo {
+
+namespace {
+  constexpr std::string_view k_alphabet =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+  constexpr std::array<std::int8_t, 256> make_decode_table() {
+    std::array<std::int8_t, 256> table{};
+    for (auto& v : table) v = -1;
+    for (std::size_t i = 0; i < k_alphabet.size(); ++i) {
+      table[static_cast<unsigned char>(k_alphabet[i])] = static_cast<std::int8_t>(i);
+    }
+    return table;
+  }
+
+  constexpr auto k_decode = make_decode_table();
+}
+
+std::optional<VideoKey> pack_video_id(std::string_view id) {
+  if (id.size() != k_video_id_length) return std::nullopt;
+
+  VideoKey key = 0;
+  for (std::size_t i = 0; i + 1 < k_video_id_length; ++i) {
+    const int v = k_decode[static_cast<unsigned char>(id[i])];
+    if (v < 0) return std::nullopt;
+    key = (key << 6) | static_cast<VideoKey>(v);
+  }
+
+  // Last character only uses its top 4 bits, anything else is not a real id
+  const int last = k_decode[static_cast<unsigned char>(id.back())];
+  if (last < 0 || (last & 0x3) != 0) return std::nullopt;
+  return (key << 4) | static_cast<VideoKey>(last >> 2);
+}
+
+std::string unpack_video_id(VideoKey key) {
+  std::string id(k_video_id_length, 'A');
+  id[k_video_id_length - 1] = k_alphabet[(key & 0xF) << 2];
+  key >>= 4;
+  for (std::size_t i = k_video_id_length - 1; i-- > 0;) {
+    id[i] = k_alphabet[key & 0x3F];
+    key >>= 6;
+  }
+  return id;
+}
+
+} // namespace policarpo
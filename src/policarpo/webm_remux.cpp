@@ -0,0 +1,378 @@
+#include "policarpo/webm_remux.hpp"
+#include "policarpo/ogg_writer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+#include <opus/opus.h>
+
+namespace policarpo {
+
+namespace {
+  // Matroska element ids, only the ones on the way to the audio
+  constexpr std::uint32_t k_ebml = 0x1A45DFA3;
+  constexpr std::uint32_t k_doc_type = 0x4282;
+  constexpr std::uint32_t k_segment = 0x18538067;
+  constexpr std::uint32_t k_seek_head = 0x114D9B74;
+  constexpr std::uint32_t k_info = 0x1549A966;
+  constexpr std::uint32_t k_tracks = 0x1654AE6B;
+  constexpr std::uint32_t k_track_entry = 0xAE;
+  constexpr std::uint32_t k_track_number = 0xD7;
+  constexpr std::uint32_t k_track_type = 0x83;
+  constexpr std::uint32_t k_codec_id = 0x86;
+  constexpr std::uint32_t k_codec_private = 0x63A2;
+  constexpr std::uint32_t k_cluster = 0x1F43B675;
+  constexpr std::uint32_t k_simple_block = 0xA3;
+  constexpr std::uint32_t k_block_group = 0xA0;
+  constexpr std::uint32_t k_block = 0xA1;
+  constexpr std::uint32_t k_discard_padding = 0x75A2;
+  constexpr std::uint32_t k_cues = 0x1C53BB6B;
+  constexpr std::uint32_t k_chapters = 0x1043A770;
+  constexpr std::uint32_t k_tags = 0x1254C367;
+  constexpr std::uint32_t k_attachments = 0x1941A469;
+
+  constexpr std::uint64_t k_unknown_size = ~0ull;
+  constexpr std::uint64_t k_track_type_audio = 2;
+
+  // Segment children, these end a cluster whose size wasn't written
+  bool is_segment_child(std::uint32_t id) {
+    return id == k_cluster || id == k_cues || id == k_tags || id == k_seek_head || id == k_info ||
+           id == k_tracks || id == k_chapters || id == k_attachments;
+  }
+
+  struct Element {
+    std::uint32_t id{0};
+    std::uint64_t size{0};  // k_unknown_size while still being streamed
+    std::uint64_t start{0}; // first byte of the data
+
+    std::uint64_t end(std::uint64_t parent_end) const {
+      return size == k_unknown_size ? parent_end : start + size;
+    }
+  };
+
+  struct OpusTrack {
+    std::uint64_t number{0};
+    std::vector<unsigned char> codec_private;
+  };
+
+  class EbmlReader {
+  public:
+    explicit EbmlReader(const std::filesystem::path& path) : m_in(path, std::ios::binary) {
+      std::error_code ec;
+      m_size = std::filesystem::file_size(path, ec);
+      if (ec) m_in.setstate(std::ios::failbit);
+    }
+
+    bool ok() const { return static_cast<bool>(m_in); }
+    std::uint64_t size() const { return m_size; }
+    std::uint64_t pos() { return static_cast<std::uint64_t>(m_in.tellg()); }
+
+    std::optional<Element> next(std::uint64_t parent_end) {
+      if (pos() >= parent_end) return std::nullopt;
+      Element e;
+      if (!read_id(e.id) || !read_vint(e.size)) return std::nullopt;
+      e.start = pos();
+      if (e.size != k_unknown_size && e.start + e.size > m_size) {
+        // Cut off download, read what is there
+        e.size = m_size - e.start;
+      }
+      return e;
+    }
+
+    void seek(std::uint64_t offset) {
+      m_in.clear();
+      m_in.seekg(static_cast<std::streamoff>(offset));
+    }
+
+    bool read(std::vector<unsigned char>& out, std::uint64_t size) {
+      out.resize(size);
+      m_in.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(size));
+      return static_cast<bool>(m_in);
+    }
+
+    std::uint64_t read_uint(std::uint64_t size) {
+      std::uint64_t value = 0;
+      for (std::uint64_t i = 0; i < size && i < 8; ++i) value = (value << 8) | static_cast<unsigned char>(m_in.get());
+      return value;
+    }
+
+    std::int64_t read_int(std::uint64_t size) {
+      if (size == 0 || size > 8) return 0;
+      std::uint64_t value = read_uint(size);
+      const int unused = 64 - static_cast<int>(size) * 8;
+      return static_cast<std::int64_t>(value << unused) >> unused;
+    }
+
+    std::string read_string(std::uint64_t size) {
+      std::string value(size, '\0');
+      m_in.read(value.data(), static_cast<std::streamsize>(size));
+      return value.substr(0, value.find('\0'));
+    }
+
+  private:
+    // Ids keep their length marker bits, sizes don't
+    bool read_id(std::uint32_t& id) {
+      int first = m_in.get();
+      if (first <= 0) return false;
+      int length = 1;
+      while (length <= 4 && !(first & (0x80 >> (length - 1)))) ++length;
+      if (length > 4) return false;
+      id = static_cast<std::uint32_t>(first);
+      for (int i = 1; i < length; ++i) id = (id << 8) | static_cast<unsigned char>(m_in.get());
+      return static_cast<bool>(m_in);
+    }
+
+    bool read_vint(std::uint64_t& value) {
+      int first = m_in.get();
+      if (first <= 0) return false;
+      int length = 1;
+      while (length <= 8 && !(first & (0x80 >> (length - 1)))) ++length;
+      if (length > 8) return false;
+
+      value = static_cast<std::uint64_t>(first) & (0xFFu >> length);
+      bool all_ones = value == (0xFFu >> length);
+      for (int i = 1; i < length; ++i) {
+        int byte = m_in.get();
+        all_ones = all_ones && byte == 0xFF;
+        value = (value << 8) | static_cast<unsigned char>(byte);
+      }
+      if (all_ones) value = k_unknown_size;
+      return static_cast<bool>(m_in);
+    }
+
+    std::ifstream m_in;
+    std::uint64_t m_size{0};
+  };
+
+  // Variable length integer inside a block buffer
+  bool parse_vint(const std::vector<unsigned char>& data, std::size_t& at, std::uint64_t& value, int* length_out = nullptr) {
+    if (at >= data.size() || data[at] == 0) return false;
+    int length = 1;
+    while (!(data[at] & (0x80 >> (length - 1)))) ++length;
+    if (at + length > data.size()) return false;
+    value = data[at] & (0xFFu >> length);
+    for (int i = 1; i < length; ++i) value = (value << 8) | data[at + i];
+    at += length;
+    if (length_out) *length_out = length;
+    return true;
+  }
+
+  // Splits a (Simple)Block into its frames for our track, in order
+  bool block_frames(const std::vector<unsigned char>& block, std::uint64_t track,
+                    std::vector<std::pair<std::size_t, std::size_t>>& frames) {
+    frames.clear();
+    std::size_t at = 0;
+    std::uint64_t number = 0;
+    if (!parse_vint(block, at, number)) return false;
+    if (number != track) return true;
+    if (at + 3 > block.size()) return false;
+    const unsigned char flags = block[at + 2];
+    at += 3;
+
+    const int lacing = (flags >> 1) & 3;
+    if (lacing == 0) {
+      frames.emplace_back(at, block.size() - at);
+      return true;
+    }
+
+    if (at >= block.size()) return false;
+    const std::size_t count = block[at++] + 1u;
+    std::vector<std::size_t> sizes;
+
+    if (lacing == 1) { // Xiph
+      for (std::size_t i = 0; i + 1 < count; ++i) {
+        std::size_t size = 0;
+        while (at < block.size() && block[at] == 255) size += block[at++];
+        if (at >= block.size()) return false;
+        sizes.push_back(size + block[at++]);
+      }
+    } else if (lacing == 3) { // EBML, differences to the previous size
+      std::uint64_t first = 0;
+      if (!parse_vint(block, at, first)) return false;
+      sizes.push_back(first);
+      for (std::size_t i = 1; i + 1 < count; ++i) {
+        std::uint64_t raw = 0;
+        int length = 0;
+        if (!parse_vint(block, at, raw, &length)) return false;
+        const std::int64_t bias = (std::int64_t{1} << (7 * length - 1)) - 1;
+        const std::int64_t size = static_cast<std::int64_t>(sizes.back()) + static_cast<std::int64_t>(raw) - bias;
+        if (size < 0) return false;
+        sizes.push_back(static_cast<std::size_t>(size));
+      }
+    }
+
+    std::size_t used = 0;
+    for (std::size_t size : sizes) used += size;
+    if (at + used > block.size()) return false;
+
+    if (lacing == 2) { // fixed, all the same size
+      const std::size_t size = (block.size() - at) / count;
+      sizes.assign(count, size);
+    } else {
+      sizes.push_back(block.size() - at - used);
+    }
+
+    for (std::size_t size : sizes) {
+      frames.emplace_back(at, size);
+      at += size;
+    }
+    return at <= block.size();
+  }
+
+  std::optional<OpusHead> parse_opus_head(const std::vector<unsigned char>& data) {
+    if (data.size() < 19 || std::string(data.begin(), data.begin() + 8) != "OpusHead") return std::nullopt;
+    // Mapping families other than 0 carry a channel table we don't write
+    if (data[18] != 0 || data[9] == 0 || data[9] > 2) return std::nullopt;
+
+    OpusHead head;
+    head.channels = data[9];
+    head.pre_skip = static_cast<std::uint16_t>(data[10] | (data[11] << 8));
+    head.input_rate = data[12] | (data[13] << 8) | (data[14] << 16) | (static_cast<std::uint32_t>(data[15]) << 24);
+    head.output_gain = static_cast<std::int16_t>(data[16] | (data[17] << 8));
+    return head;
+  }
+
+  std::optional<OpusTrack> find_opus_track(EbmlReader& in, std::uint64_t tracks_end, bool& saw_audio) {
+    std::optional<OpusTrack> found;
+    while (auto entry = in.next(tracks_end)) {
+      const std::uint64_t entry_end = entry->end(tracks_end);
+      if (entry->id != k_track_entry) {
+        in.seek(entry_end);
+        continue;
+      }
+
+      OpusTrack track;
+      std::uint64_t type = 0;
+      std::string codec;
+      while (auto field = in.next(entry_end)) {
+        switch (field->id) {
+          case k_track_number: track.number = in.read_uint(field->size); break;
+          case k_track_type: type = in.read_uint(field->size); break;
+          case k_codec_id: codec = in.read_string(field->size); break;
+          case k_codec_private: in.read(track.codec_private, field->size); break;
+          default: break;
+        }
+        in.seek(field->end(entry_end));
+      }
+
+      if (type == k_track_type_audio) {
+        saw_audio = true;
+        if (codec == "A_OPUS" && !found) found = std::move(track);
+      }
+      in.seek(entry_end);
+    }
+    return found;
+  }
+}
+
+RemuxResult remux_webm_to_ogg(const std::filesystem::path& input, const std::filesystem::path& output) {
+  const auto started = std::chrono::steady_clock::now();
+
+  EbmlReader in(input);
+  if (!in.ok()) return RemuxResult::Invalid;
+
+  auto header = in.next(in.size());
+  if (!header || header->id != k_ebml) return RemuxResult::Invalid;
+  std::string doc_type;
+  while (auto field = in.next(header->end(in.size()))) {
+    if (field->id == k_doc_type) doc_type = in.read_string(field->size);
+    in.seek(field->end(header->end(in.size())));
+  }
+  if (doc_type != "webm" && doc_type != "matroska") return RemuxResult::Invalid;
+
+  std::optional<Element> segment;
+  while ((segment = in.next(in.size())) && segment->id != k_segment) {
+    in.seek(segment->end(in.size()));
+  }
+  if (!segment) return RemuxResult::Invalid;
+  const std::uint64_t segment_end = segment->end(in.size());
+
+  std::optional<OpusTrack> track;
+  std::optional<OpusHead> head;
+  bool saw_audio = false;
+  OggOpusWriter writer;
+
+  std::vector<unsigned char> block;
+  std::vector<std::pair<std::size_t, std::size_t>> frames;
+  std::int64_t granule = 0;
+
+  // Writes the frames of one block, the last one shortened by discard samples
+  auto emit = [&](std::int64_t discard) {
+    if (!block_frames(block, track->number, frames)) return false;
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+      const unsigned char* data = block.data() + frames[i].first;
+      const auto size = static_cast<opus_int32>(frames[i].second);
+      const int samples = opus_packet_get_nb_samples(data, size, 48000);
+      if (samples <= 0) return false;
+
+      granule += samples;
+      std::int64_t end = granule;
+      if (i + 1 == frames.size() && discard > 0) end = std::max<std::int64_t>(granule - discard, 0);
+      if (!writer.write_packet(data, frames[i].second, end)) return false;
+    }
+    return true;
+  };
+
+  std::optional<Element> pending; // read past the end of a cluster of unknown size
+  while (true) {
+    std::optional<Element> element = pending ? pending : in.next(segment_end);
+    pending.reset();
+    if (!element) break;
+    const std::uint64_t element_end = element->end(segment_end);
+
+    if (element->id == k_tracks) {
+      track = find_opus_track(in, element_end, saw_audio);
+      if (!track) return saw_audio ? RemuxResult::NotOpus : RemuxResult::Invalid;
+      head = parse_opus_head(track->codec_private);
+      if (!head || !writer.open(output, *head, "policarpo remux")) return RemuxResult::Invalid;
+      in.seek(element_end);
+      continue;
+    }
+
+    if (element->id != k_cluster) {
+      in.seek(element_end);
+      continue;
+    }
+    // Track info always comes before the first cluster
+    if (!head) return RemuxResult::Invalid;
+
+    while (auto child = in.next(element_end)) {
+      if (element->size == k_unknown_size && is_segment_child(child->id)) {
+        pending = child;
+        break;
+      }
+
+      const std::uint64_t child_end = child->end(element_end);
+      if (child->id == k_simple_block) {
+        if (!in.read(block, child_end - child->start) || !emit(0)) return RemuxResult::Invalid;
+      } else if (child->id == k_block_group) {
+        std::int64_t discard_ns = 0;
+        bool has_block = false;
+        while (auto field = in.next(child_end)) {
+          if (field->id == k_block) {
+            has_block = in.read(block, field->end(child_end) - field->start);
+          } else if (field->id == k_discard_padding) {
+            discard_ns = in.read_int(field->size);
+          }
+          in.seek(field->end(child_end));
+        }
+        // DiscardPadding is in nanoseconds, whatever the timecode scale
+        const std::int64_t discard = discard_ns * 48000 / 1000000000;
+        if (has_block && !emit(discard)) return RemuxResult::Invalid;
+      }
+      in.seek(child_end);
+    }
+  }
+
+  if (!head || writer.packets_written() == 0 || !writer.finish()) return RemuxResult::Invalid;
+
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  std::cout << "[Remux] " << writer.packets_written() << " packets copied in " << elapsed << " s " << input.filename() << "\n";
+  return RemuxResult::Remuxed;
+}
+
+} // namespace policarpo
@@ -0,0 +1,103 @@
+#include "policarpo/youtube_url.hpp"
+#include "policarpo/video_id.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace policarpo {
+
+namespace {
+  std::string to_lower(std::string_view s) {
+    std::string out(s);
+    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return out;
+  }
+
+  bool consume_prefix(std::string_view& s, std::string_view prefix) {
+    if (s.size() < prefix.size()) return false;
+    if (to_lower(s.substr(0, prefix.size())) != prefix) return false;
+    s.remove_prefix(prefix.size());
+    return true;
+  }
+
+  // First path segment after prefix, e.g. "/shorts/<id>/whatever" -> "<id>"
+  std::string_view segment_after(std::string_view path, std::string_view prefix) {
+    if (!path.starts_with(prefix)) return {};
+    path.remove_prefix(prefix.size());
+    return path.substr(0, path.find('/'));
+  }
+
+  std::string_view query_param(std::string_view query, std::string_view key) {
+    while (!query.empty()) {
+      const std::size_t amp = query.find('&');
+      std::string_view pair = query.substr(0, amp);
+      query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+
+      const std::size_t eq = pair.find('=');
+      if (eq != std::string_view::npos && pair.substr(0, eq) == key) return pair.substr(eq + 1);
+    }
+    return {};
+  }
+
+  bool is_playlist_id(std::string_view id) {
+    return !id.empty() && std::all_of(id.begin(), id.end(), [](unsigned char c) {
+      return std::isalnum(c) || c == '-' || c == '_';
+    });
+  }
+}
+
+std::optional<YoutubeUrl> parse_youtube_url(std::string_view url) {
+  while (!url.empty() && std::isspace(static_cast<unsigned char>(url.front()))) url.remove_prefix(1);
+  while (!url.empty() && std::isspace(static_cast<unsigned char>(url.back()))) url.remove_suffix(1);
+
+  if (!consume_prefix(url, "https://")) consume_prefix(url, "http://");
+
+  // Split into host, path and query, the fragment is never interesting
+  url = url.substr(0, url.find('#'));
+  const std::size_t host_end = url.find_first_of("/?");
+  std::string host = to_lower(url.substr(0, host_end));
+  std::string_view rest = host_end == std::string_view::npos ? std::string_view{} : url.substr(host_end);
+
+  host = host.substr(0, host.find(':'));
+  for (std::string_view sub : {"www.", "m.", "music."}) {
+    if (host.starts_with(sub)) {
+      host.erase(0, sub.size());
+      break;
+    }
+  }
+
+  const std::size_t query_start = rest.find('?');
+  const std::string_view path = rest.substr(0, query_start);
+  const std::string_view query = query_start == std::string_view::npos ? std::string_view{} : rest.substr(query_start + 1);
+
+  YoutubeUrl out;
+  std::string_view id;
+
+  if (host == "youtu.be") {
+    id = segment_after(path, "/");
+  } else if (host == "youtube.com" || host == "youtube-nocookie.com") {
+    if (path == "/watch" || path == "/watch/") {
+      id = query_param(query, "v");
+    } else {
+      for (std::string_view prefix : {"/shorts/", "/embed/", "/v/", "/live/", "/e/"}) {
+        id = segment_after(path, prefix);
+        if (!id.empty()) break;
+      }
+    }
+  } else {
+    return std::nullopt;
+  }
+
+  if (is_youtube_video_id(id)) out.video_id = std::string(id);
+
+  std::string_view list = query_param(query, "list");
+  if (is_playlist_id(list)) out.playlist_id = std::string(list);
+
+  if (out.video_id.empty() && out.playlist_id.empty()) return std::nullopt;
+  return out;
+}
+
+std::string youtube_watch_url(std::string_view id) {
+  return "https://www.youtube.com/watch?v=" + std::string(id);
+}
+
+} // namespace policarpo